@@ -56,6 +56,8 @@ typedef enum {
   ENC_JPG_GET_HEADER,
   ENABLE_LOGGING,
   DISABLE_LOGGING,
+  SET_JPG_ROI,
+  SET_JPG_THUMBNAIL,
   JPG_CMD_END
 } JpgCommand;
 
@@ -65,6 +67,7 @@ typedef enum {
   INT_JPU_BIT_BUF_EMPTY = 2,
   INT_JPU_BIT_BUF_FULL = 2,
   INT_JPU_OVERFLOW,
+  INT_JPU_SLICE_DONE = INT_JPU_OVERFLOW,
 } InterruptJpu;
 
 typedef enum { JPG_TBL_NORMAL, JPG_TBL_MERGE } JpgTableMode;
@@ -118,7 +121,7 @@ typedef struct {
   Uint32 roiOffsetY;
   Uint32 roiWidth;
   Uint32 roiHeight;
-  Uint32 sliceHeight;
+  Uint32 sliceHeight; /*!<< output rows per INT_JPU_SLICE_DONE, 0 for none */
   Uint32 intrEnableBit;
   Uint32 rotation;           /*!<< 0, 90, 180, 270 */
   JpgMirrorDirection mirror; /*!<< 0(none), 1(vertical), 2(mirror), 3(both) */
@@ -141,6 +144,10 @@ typedef struct {
   int bytePosFrameStart;
   int ecsPtr;
   Uint32 frameCycle; /*!<< clock cycle */
+  Uint32 waitTimeUs; /*!<< time asleep waiting for the interrupt */
+  Uint32 spinTimeUs; /*!<< time polling the status before that */
+  Uint32 regWritesIssued; /*!<< register writes sent to the core */
+  Uint32 regWritesElided; /*!<< writes skipped, value already programmed */
   Uint32 rdPtr;
   Uint32 wrPtr;
   Uint32 decodedSliceYPos;
@@ -154,6 +161,17 @@ typedef struct {
   int size;
 } vpu_getbit_context_t;
 
+/* One Huffman table packed into MJPEG_HUFF_DATA_REG words. */
+typedef struct {
+  Uint32 min[16];  /*!<< MIN section, sign extended from 16 bits */
+  Uint32 max[16];  /*!<< MAX section, sign extended from 16 bits */
+  Uint32 ptr[16];  /*!<< PTR section, sign extended from 8 bits */
+  Uint32 val[256]; /*!<< VAL section, sign extended from 8 bits */
+  Uint32 valLen;   /*!<< Used words of val, more than 256 if malformed */
+  Uint32 padLen;   /*!<< 0xFFFFFFFF words written after val */
+  Uint64 key;      /*!<< Content hash, 0 for the built-in default tables */
+} JpgHuffImage;
+
 typedef struct {
   PhysicalAddress streamWrPtr;
   PhysicalAddress streamRdPtr;
@@ -161,6 +179,8 @@ typedef struct {
   PhysicalAddress streamBufStartAddr;
   PhysicalAddress streamBufEndAddr;
   int streamBufSize;
+  Uint32 streamRingSize; /*!<< Size of a circular stream buffer the core
+                            wraps in, 0 for a linear one */
   Uint32 streamFd;
   BYTE *pBitStream;
 
@@ -203,6 +223,9 @@ typedef struct {
   Uint32 huffMin[8][16];
   Uint32 huffMax[8][16];
   BYTE huffPtr[8][16];
+  JpgHuffImage huffImageBuf[8];
+  const JpgHuffImage *huffImage[8]; /*!<< huffImageBuf or a default image */
+  Uint64 huffImageHash;
   BYTE cInfoTab[4][6];
 
   int busReqNum;
@@ -251,6 +274,11 @@ typedef struct {
   Int32 thtc[THTC_LIST_CNT]; /*!<< Huffman table definition length and table
                                 class list : -1 indicates not exist. */
   Uint32 numHuffmanTable;
+  BOOL thumbNailEn;   /*!<< parse and decode the EXIF thumbnail instead */
+  Uint32 thumbOffset; /*!<< EXIF thumbnail JPEG from pBitStream */
+  Uint32 thumbSize;   /*!<< 0 if the last header had none */
+  Uint32 regWritesIssued;
+  Uint32 regWritesElided;
 } JpgDecInfo;
 
 typedef struct {
@@ -318,6 +346,8 @@ typedef struct {
                            CCW(Counter Clockwise)*/
   Uint32 mirrorIndex;   /*!<< 0: none, 1: vertical mirror, 2: horizontal mirror,
                            3: both */
+  Uint32 regWritesIssued;
+  Uint32 regWritesElided;
 } JpgEncInfo;
 
 typedef struct JpgInst {
@@ -325,6 +355,8 @@ typedef struct JpgInst {
   Int32 instIndex;
   Int32 loggingEnable;
   BOOL sliceInstMode;
+  Uint32 waitTimeUs; /* interrupt wait time of the current frame */
+  Uint32 spinTimeUs; /* status poll time of the current frame */
   JdiDeviceCtx devctx;
   union {
     JpgEncInfo encInfo;
@@ -380,6 +412,10 @@ typedef struct {
   EncodeState encodeState;
   Uint32 intStatus;
   Uint32 frameCycle; /*!<< clock cycle */
+  Uint32 waitTimeUs; /*!<< time asleep waiting for the interrupt */
+  Uint32 spinTimeUs; /*!<< time polling the status before that */
+  Uint32 regWritesIssued; /*!<< register writes sent to the core */
+  Uint32 regWritesElided; /*!<< writes skipped, value already programmed */
 } JpgEncOutputInfo;
 
 typedef struct {
@@ -459,18 +495,51 @@ Uint32 JPU_IsInit(JdiDeviceCtx devctx);
 
 int JPU_IsBusy(JpgHandle handle);
 Uint32 JPU_GetStatus(JpgHandle handle);
+Uint32 JPU_GetSlicePos(JpgHandle handle);
 void JPU_ClrStatus(JpgHandle handle, Uint32 val);
 
 JpgRet JPU_Init(int dev_id, JdiDeviceCtx *ctx);
 void JPU_DeInit(JdiDeviceCtx devctx);
 int JPU_GetOpenInstanceNum(JdiDeviceCtx devctx);
+/* Core pool. Every /dev/jpuN below MAX_NUM_JPU_CORE is probed once.
+ * JPU_InitLeastLoaded initializes the core with the fewest open instances,
+ * then the fewest queued frames, and returns its dev_id.
+ */
+int JPU_GetCoreNum(void);
+JpgRet JPU_GetCoreLoad(int dev_id, Int32 *instances, Int32 *queueDepth);
+JpgRet JPU_InitLeastLoaded(JdiDeviceCtx *ctx, int *dev_id);
 JpgRet JPU_GetVersionInfo(JdiDeviceCtx devctx, Uint32 *apiVersion,
                           Uint32 *hwRevision, Uint32 *hwProductId);
 
 // function for decode
+JpgRet JPU_RegisterDmaBuf(JdiDeviceCtx devctx, int fd);
+JpgRet JPU_UnregisterDmaBuf(JdiDeviceCtx devctx, int fd);
+void JPU_GetDmaCfgStats(JdiDeviceCtx devctx, Uint64 *hits, Uint64 *misses);
+/* The clock is gated once the core was idle for JPU_CLOCK_AUTOSUSPEND_MS and
+ * ungated by the next frame. The last close in the process gates it and
+ * closes the device right away. Reports how often this process toggled it and
+ * the time the first frame after the last wake took, and the worst one.
+ */
+void JPU_GetClockStats(JdiDeviceCtx devctx, Uint64 *onCount, Uint64 *offCount,
+                       Uint32 *wakeLatencyUs, Uint32 *wakeLatencyMaxUs);
+/* Frames of instances waiting for the core run in priority order, round-robin
+ * within a priority. An instance starts with JPU_PRIORITY_NORMAL and is never
+ * passed over more than a few times, so lower classes are not starved.
+ * JPU_GetLockStats reports how long this process waited for and held the
+ * device lock.
+ */
+JpgRet JPU_SetPriority(JpgHandle handle, JpgPriority priority);
+void JPU_GetLockStats(JdiDeviceCtx devctx, JpgLockStats *stats);
+/* Writes the binary register, ioctl, lock and interrupt trace of this
+ * process to path, for jpu_trace_dump to decode.
+ */
+JpgRet JPU_TraceDump(const char *path);
 JpgRet JPU_DecOpen(JdiDeviceCtx devctx, JpgDecHandle *, JpgDecOpenParam *);
 JpgRet JPU_DecClose(JpgDecHandle);
 JpgRet JPU_DecGetInitialInfo(JpgDecHandle handle, JpgDecInitialInfo *info);
+JpgRet JPU_DecProbe(const BYTE *data, Uint32 size, JpgDecInitialInfo *info);
+JpgRet JPU_DecParseInitialInfo(JpgDecHandle handle, JpgDecInfo *pDecInfo,
+                               JpgDecInitialInfo *info);
 JpgRet JPU_DecRegisterFrameBuffer(JpgDecHandle handle,
                                   FrameBufferInfo *bufArray, int num,
                                   int stride);
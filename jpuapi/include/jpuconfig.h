@@ -6,8 +6,8 @@
 #ifndef _JPU_CONFIG_H_
 #define _JPU_CONFIG_H_
 
-#define MAX_NUM_JPU_CORE 1
-#define MAX_NUM_INSTANCE 1
+#define MAX_NUM_JPU_CORE 4  // /dev/jpuN probed for the core pool
+#define MAX_NUM_INSTANCE 8  // open handles, time-multiplexed per frame
 #define MAX_INST_HANDLE_SIZE 48
 
 #define JPU_FRAME_ENDIAN JDI_LITTLE_ENDIAN
@@ -39,9 +39,28 @@
 #define JPU_INTERRUPT_TIMEOUT_MS 3600000  // 1 hour for simultation environment
 #endif
 
+#define JPU_DEC_ASYNC_QUEUE_DEPTH \
+  4  // frames submitted to one decoder and not yet polled
+#define JPU_ENC_ASYNC_QUEUE_DEPTH \
+  4  // frames submitted to one encoder and not yet polled
+#define JPU_DEC_POOL_IDLE_MAX 4  // released decoders kept open for reuse
+#define JPU_ENC_POOL_IDLE_MAX 4  // released encoders kept open for reuse
+#define JPU_SESSION_POOL_BUCKETS 16
+#define JPU_RESIZE_MAX_THREADS 4  // CPU resize threads, caller included
+#define JPU_RESIZE_BAND_MIN_ROWS \
+  32  // output rows a resize thread takes at least
+#define JPU_RESIZE_MT_MIN_PIXELS \
+  (640 * 480)  // smaller resizes run on the calling thread only
+
 #define JPU_INST_CTRL_TIMEOUT_MS (5000 * 4)
 #ifdef CNM_SIM_PLATFORM
 #undef JPU_INST_CTRL_TIMEOUT_MS
 #define JPU_INST_CTRL_TIMEOUT_MS 3600000  // 1 hour for simulation environment
 #endif
+
+#define JPU_BUSY_CHECK_TIMEOUT_MS 100  // BBC busy, reset and other short waits
+#ifdef CNM_SIM_PLATFORM
+#undef JPU_BUSY_CHECK_TIMEOUT_MS
+#define JPU_BUSY_CHECK_TIMEOUT_MS 3600000  // 1 hour for simulation environment
+#endif
 #endif /* _JPU_CONFIG_H_ */
@@ -5,12 +5,16 @@
 
 #include "jputypes.h"
 
-#ifndef JPUENC_H_INCLUDED
-#define JPUENC_H_INCLUDED
+#ifndef JPUDEC_H_INCLUDED
+#define JPUDEC_H_INCLUDED
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Opens a decoder session. The ROI fields of param are ignored, a ROI is set
+ * with AsrJpuDecSetParam(JPU_ROI) and the EXIF thumbnail picked with
+ * AsrJpuDecSetParam(JPU_THUMBNAIL).
+ */
 JpgRet AsrJpuDecOpen(void** handle, DecOpenParam* param);
 JpgRet AsrJpuDecSetParam(void* handle, Uint32 parameterIndex, void* value);
 JpgRet AsrJpuDecGetInitialInfo(void* handle, ImageBufferInfo* jpegImageBuffer,
@@ -19,6 +23,162 @@ JpgRet AsrJpuDecStartOneFrame(void* handle, FrameBufferInfo* frameBuffer,
                               ImageBufferInfo* jpegImageBuffer);
 JpgRet AsrJpuDecClose(void* handle);
 
+/* Decodes a JPEG that is still arriving, from disk or the network. The
+ * first imageSize bytes of jpegImageBuffer, the headers and at least
+ * JPU_GBU_SIZE bytes of the scan, have been parsed by AsrJpuDecGetInitialInfo;
+ * a shorter first chunk fails there. The core starts on them and, each time
+ * it runs out of data, fill appends the next chunk behind them, until it
+ * returns 0. The whole JPEG must fit in the dma-buf with a byte to spare;
+ * imageSize comes back with its length. The core is held meanwhile, so fill
+ * should not wait on anything slower than the input.
+ */
+JpgRet AsrJpuDecStartOneFrameFeed(void* handle, FrameBufferInfo* frameBuffer,
+                                  ImageBufferInfo* jpegImageBuffer,
+                                  JpgDecFillCallback fill, void* userData);
+
+/* Decodes a frame in bands of sliceHeight output rows, a multiple of the
+ * output MCU height, so that the top of the picture can be scaled or
+ * uploaded while the core decodes the rest. callback gets each band as it
+ * lands in the frame buffer, the last one with the frame done; a CPU reader
+ * syncs the frame dma-buf first. Not available with rotation or mirroring.
+ */
+JpgRet AsrJpuDecStartOneFrameSlices(void* handle, FrameBufferInfo* frameBuffer,
+                                    ImageBufferInfo* jpegImageBuffer,
+                                    Uint32 sliceHeight,
+                                    JpgDecSliceCallback callback,
+                                    void* userData);
+
+/* Reads the header of a JPEG in CPU memory, such as a malloc'ed or mmapped
+ * file, without a session, a device or a dma-buf. The headers up to the
+ * first scan must be in data. frameBuffer comes back with the strides,
+ * offsets and size of the buffer the picture decodes into for param, or for
+ * the source format unscaled when param is NULL.
+ */
+JpgRet AsrJpuDecProbe(const void* data, Uint32 size,
+                      const JpgDecProbeParam* param, JpgDecProbeInfo* probe);
+
+/* Decode-to-fit. After AsrJpuDecGetInitialInfo, sets the scale modes that
+ * shrink the picture the most while keeping it at least *width x *height,
+ * after rotation; a 0 side keeps the aspect ratio. *width and *height come
+ * back with the decoded size and frameBuffer with its layout, as from
+ * AsrJpuDecProbe, whose targetWidth and targetHeight do the same without a
+ * handle. What the 1/2^n steps leave over the target is for the caller.
+ */
+JpgRet AsrJpuDecFitSize(void* handle, Uint32* width, Uint32* height,
+                        FrameBufferInfo* frameBuffer);
+
+/* Resizes a decoded 8-bit planar or semi-planar picture to exactly
+ * dstWidth x dstHeight on the CPU, for what AsrJpuDecFitSize leaves over the
+ * target. Both frame buffers have the same format. The filter averages the
+ * source area of each output sample, so shrinking does not alias. Every
+ * plane must fit its stride and the dma-buf, JPG_RET_INVALID_PARAM otherwise.
+ * From JPU_RESIZE_MT_MIN_PIXELS on, output rows are split over up to
+ * JPU_RESIZE_MAX_THREADS threads, kept by the handle until it is closed.
+ */
+JpgRet AsrJpuDecResize(void* handle, FrameBufferInfo* src, Uint32 srcWidth,
+                       Uint32 srcHeight, FrameBufferInfo* dst, Uint32 dstWidth,
+                       Uint32 dstHeight);
+
+/* Decodes numJobs images in one call. Every header is parsed ahead of
+ * decoding, into a copy of the decoder state per job, and the device lock and
+ * clock are kept for the whole batch unless another session waits for the
+ * core. Every job gets its own status and timing. Returns JPG_RET_FAILURE if
+ * any job failed.
+ */
+JpgRet AsrJpuDecBatch(void* handle, JpgDecBatchJob* jobs, Uint32 numJobs);
+
+/* Decodes numJobs crops of one JPEG, each into its own frame buffer. The
+ * header is parsed and the bitstream mapped once, and the core writes only
+ * the crop. A crop with a 0 width is the whole picture. Every job gets the
+ * MCU aligned window it was decoded with and its own status. Returns
+ * JPG_RET_FAILURE if any crop failed. A single ROI can also be set with
+ * AsrJpuDecSetParam(JPU_ROI) for the next decodes of the handle.
+ */
+JpgRet AsrJpuDecStartOneFrameRois(void* handle,
+                                  ImageBufferInfo* jpegImageBuffer,
+                                  JpgDecRoiJob* jobs, Uint32 numJobs);
+
+/* Motion-JPEG streaming. AsrJpuDecStreamStart turns the dma-buf fd into a
+ * ring of size bytes, a multiple of the page size, and registers it when
+ * it can, the ring works without. Frames are appended back to back and may
+ * wrap at its end. The producer asks
+ * AsrJpuDecStreamGetWriteBuffer for the free room, contiguous even across
+ * the ring end, writes there and commits the bytes written; it may run in
+ * another thread than the decoder. AsrJpuDecStreamDecodeFrame decodes the
+ * next whole frame in place and frees its bytes, or returns
+ * JPG_RET_BIT_EMPTY until one is committed. With a NULL frameBuffer it only
+ * reports the header of the next frame. AsrJpuDecStreamStop, also done by
+ * close and release, unregisters the ring if it was registered.
+ */
+JpgRet AsrJpuDecStreamStart(void* handle, Int32 fd, Uint32 size);
+JpgRet AsrJpuDecStreamGetWriteBuffer(void* handle, void** data, Uint32* room);
+JpgRet AsrJpuDecStreamCommit(void* handle, Uint32 size);
+JpgRet AsrJpuDecStreamDecodeFrame(void* handle, FrameBufferInfo* frameBuffer,
+                                  JpgDecInitialInfo* info);
+JpgRet AsrJpuDecStreamStop(void* handle);
+
+/* Warm session pool. AsrJpuDecAcquire hands out an idle session opened with
+ * the same parameters, reset to its state right after open, or opens a new
+ * one. AsrJpuDecRelease returns it; it fails with JPG_RET_FRAME_NOT_COMPLETE
+ * while submitted frames are still running and drops completions nobody
+ * polled, and with JPG_RET_WRONG_CALL_SEQUENCE on a session already released.
+ * Up to JPU_DEC_POOL_IDLE_MAX idle sessions keep their instance and
+ * device open, AsrJpuDecPoolFlush closes them. AsrJpuDecClose on an idle
+ * session takes it out of the pool.
+ */
+JpgRet AsrJpuDecAcquire(void** handle, DecOpenParam* param);
+JpgRet AsrJpuDecRelease(void* handle);
+void AsrJpuDecPoolFlush(void);
+
+/* Asynchronous decode. AsrJpuDecSubmit parses the header in the calling
+ * thread and queues the frame; a per-handle worker drives the JPU. Each
+ * finished frame is either handed to the callback (from the worker thread)
+ * or queued for AsrJpuDecPoll, in which case the fd returned by
+ * AsrJpuDecGetEventFd becomes readable. frameBuffer and jpegImageBuffer must
+ * stay valid until their completion is delivered. AsrJpuDecClose completes
+ * the frames still queued with JPG_RET_CANCELED; without a callback it
+ * returns JPG_RET_FRAME_NOT_COMPLETE until every completion has been polled.
+ */
+JpgRet AsrJpuDecSubmit(void* handle, FrameBufferInfo* frameBuffer,
+                       ImageBufferInfo* jpegImageBuffer, void* userData);
+JpgRet AsrJpuDecPoll(void* handle, JpgDecCompletion* completion,
+                     Int32 timeoutMs);
+Int32 AsrJpuDecGetEventFd(void* handle);
+JpgRet AsrJpuDecSetCallback(void* handle, JpgDecCallback callback);
+
+/* A frame between the same two buffers as the previous frame on the core
+ * reuses its JPU MMU setup, and the CPU mapping of a bitstream buffer is
+ * kept for the next frame on it (JPU_DMABUF_PREFAULT=1 prefaults it).
+ * Registering a dma-buf saves looking up which buffer its fd refers to on
+ * every frame and keeps its CPU mapping from being evicted. Registration is
+ * optional, and a buffer must be unregistered before its fd is closed. The
+ * statistics count MMU setups reused (hits) and issued to the driver
+ * (misses) on the handle's device.
+ */
+JpgRet AsrJpuDecRegisterDmaBuf(void* handle, Int32 fd);
+JpgRet AsrJpuDecUnregisterDmaBuf(void* handle, Int32 fd);
+JpgRet AsrJpuDecGetDmaCfgStats(void* handle, Uint64* hits, Uint64* misses);
+
+/* Latency critical sessions such as preview set JPU_PRIORITY_HIGH so that
+ * their frames go before those of batch sessions, see JPU_SetPriority. The
+ * stats are the device lock wait and hold times of this process.
+ */
+JpgRet AsrJpuDecSetPriority(void* handle, JpgPriority priority);
+JpgRet AsrJpuDecGetLockStats(void* handle, JpgLockStats* stats);
+
+/* Clock gate toggles and wake latency of the handle's device, see
+ * JPU_GetClockStats.
+ */
+JpgRet AsrJpuDecGetClockStats(void* handle, Uint64* onCount, Uint64* offCount,
+                            Uint32* wakeLatencyUs, Uint32* wakeLatencyMaxUs);
+
+/* Sessions are opened on the least loaded of the /dev/jpuN cores. This
+ * reports the core of the handle, the instances open on it and the frames
+ * queued to it; JPU_GetCoreLoad reports any other core.
+ */
+JpgRet AsrJpuDecGetCoreLoad(void* handle, Int32* core, Int32* instances,
+                            Int32* queueDepth);
+
 #ifdef __cplusplus
 }
 #endif
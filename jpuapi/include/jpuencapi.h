@@ -17,6 +17,68 @@ JpgRet AsrJpuEncStartOneFrame(void* handle, FrameBufferInfo* frameBuffer,
                               ImageBufferInfo* jpegImageBuffer);
 JpgRet AsrJpuEncClose(void* handle);
 
+/* Warm session pool. AsrJpuEncAcquire hands out an idle session opened with
+ * the same parameters, reset to its state right after open, or opens a new
+ * one. AsrJpuEncRelease returns it; it fails with JPG_RET_FRAME_NOT_COMPLETE
+ * while submitted frames are still running and drops completions nobody
+ * polled, and with JPG_RET_WRONG_CALL_SEQUENCE on a session already released.
+ * Up to JPU_ENC_POOL_IDLE_MAX idle sessions keep their instance and
+ * device open, AsrJpuEncPoolFlush closes them. AsrJpuEncClose on an idle
+ * session takes it out of the pool.
+ */
+JpgRet AsrJpuEncAcquire(void** handle, EncOpenParam* param);
+JpgRet AsrJpuEncRelease(void* handle);
+void AsrJpuEncPoolFlush(void);
+
+/* Queued encode. AsrJpuEncSubmit maps the destination and writes the JPEG
+ * header in the calling thread, so it overlaps the frame the worker is
+ * running on the JPU. Completions are delivered in submit order, either to
+ * the callback (from the worker thread) or through AsrJpuEncPoll, with the
+ * fd from AsrJpuEncGetEventFd readable while one is pending. Encoder
+ * parameters must not change while frames are queued; AsrJpuEncSetParam
+ * fails JPU_QUALITY, JPU_QUANT_TAB and JPU_HUFFMAN_TAB with
+ * JPG_RET_WRONG_CALL_SEQUENCE until they have completed.
+ */
+JpgRet AsrJpuEncSubmit(void* handle, FrameBufferInfo* frameBuffer,
+                       ImageBufferInfo* jpegImageBuffer, void* userData);
+JpgRet AsrJpuEncPoll(void* handle, JpgEncCompletion* completion,
+                     Int32 timeoutMs);
+Int32 AsrJpuEncGetEventFd(void* handle);
+JpgRet AsrJpuEncSetCallback(void* handle, JpgEncCallback callback);
+
+/* A frame between the same two buffers as the previous frame on the core
+ * reuses its JPU MMU setup, and the CPU mapping of a output buffer is
+ * kept for the next frame on it (JPU_DMABUF_PREFAULT=1 prefaults it).
+ * Registering a dma-buf saves looking up which buffer its fd refers to on
+ * every frame and keeps its CPU mapping from being evicted. Registration is
+ * optional, and a buffer must be unregistered before its fd is closed. The
+ * statistics count MMU setups reused (hits) and issued to the driver
+ * (misses) on the handle's device.
+ */
+JpgRet AsrJpuEncRegisterDmaBuf(void* handle, Int32 fd);
+JpgRet AsrJpuEncUnregisterDmaBuf(void* handle, Int32 fd);
+JpgRet AsrJpuEncGetDmaCfgStats(void* handle, Uint64* hits, Uint64* misses);
+
+/* Latency critical sessions such as preview set JPU_PRIORITY_HIGH so that
+ * their frames go before those of batch sessions, see JPU_SetPriority. The
+ * stats are the device lock wait and hold times of this process.
+ */
+JpgRet AsrJpuEncSetPriority(void* handle, JpgPriority priority);
+JpgRet AsrJpuEncGetLockStats(void* handle, JpgLockStats* stats);
+
+/* Clock gate toggles and wake latency of the handle's device, see
+ * JPU_GetClockStats.
+ */
+JpgRet AsrJpuEncGetClockStats(void* handle, Uint64* onCount, Uint64* offCount,
+                            Uint32* wakeLatencyUs, Uint32* wakeLatencyMaxUs);
+
+/* Sessions are opened on the least loaded of the /dev/jpuN cores. This
+ * reports the core of the handle, the instances open on it and the frames
+ * queued to it; JPU_GetCoreLoad reports any other core.
+ */
+JpgRet AsrJpuEncGetCoreLoad(void* handle, Int32* core, Int32* instances,
+                            Int32* queueDepth);
+
 #ifdef __cplusplus
 }
 #endif
@@ -62,6 +62,7 @@ typedef enum {
   JPG_RET_INSUFFICIENT_RESOURCE,
   JPG_RET_INST_CTRL_ERROR,
   JPG_RET_NOT_SUPPORT,
+  JPG_RET_CANCELED, /*!<< queued frame dropped by close */
 } JpgRet;
 
 typedef enum {
@@ -83,6 +84,30 @@ typedef enum {
   MIRDIR_HOR_VER
 } JpgMirrorDirection;
 
+/* Class of the frames of an instance when instances wait for the core. */
+typedef enum {
+  JPU_PRIORITY_NORMAL = 0, /*!<< batch work such as thumbnails, the default */
+  JPU_PRIORITY_HIGH,       /*!<< latency critical streams such as preview */
+  JPU_PRIORITY_MAX
+} JpgPriority;
+
+#define JPU_LOCK_HIST_BUCKETS 20
+
+/* Device lock timing of one process on one core. Bucket 0 of a histogram
+ * counts times below 1us, bucket i times in [2^(i-1), 2^i) us and the last
+ * bucket everything longer.
+ */
+typedef struct {
+  Uint64 acquisitions; /*!<< times the lock was taken, recursion excluded */
+  Uint64 contended;    /*!<< acquisitions that had to wait */
+  Uint64 waitTotalUs;
+  Uint64 holdTotalUs;
+  Uint32 waitMaxUs;
+  Uint32 holdMaxUs;
+  Uint32 waitHist[JPU_LOCK_HIST_BUCKETS];
+  Uint32 holdHist[JPU_LOCK_HIST_BUCKETS];
+} JpgLockStats;
+
 typedef enum {
   FORMAT_420 = 0,
   FORMAT_422 = 1,
@@ -169,8 +194,26 @@ typedef enum {
                               JDI_LITTLE_ENDIAN*/
   JPU_FRAME_BUF_ENDIAN,    /*the endian of frame  EndianMode default
                               JDI_LITTLE_ENDIAN */
+  JPU_ROI,                 /*decoded window JpgDecRoi*, NULL or a 0 width
+                              decodes the whole picture default NULL*/
+  /* AsrJpuDecGetInitialInfo and AsrJpuDecProbe report where the JPEG
+   * thumbnail of an EXIF APP1 segment is in the image buffer, as
+   * thumbnailOffset and thumbnailSize. With JPU_THUMBNAIL enabled, that
+   * thumbnail is parsed and decoded instead of the picture and
+   * info->thumbnail is set. A gallery preview then costs a 160x120 decode
+   * rather than the full picture.
+   */
+  JPU_THUMBNAIL,           /*decode the EXIF thumbnail when the JPEG has one
+                              Uint32 0: disable 1: enable default 0 */
 } JpuParamIndex;
 
+typedef struct {
+  Uint32 x;      /*!<< left edge in source pixels */
+  Uint32 y;      /*!<< top edge in source pixels */
+  Uint32 width;  /*!<< in source pixels, 0 for the whole picture */
+  Uint32 height; /*!<< in source pixels */
+} JpgDecRoi;
+
 typedef struct {
   Uint32 picWidth;
   Uint32 picHeight;
@@ -234,5 +277,88 @@ typedef struct {
   int roiMCUSize;
   int colorComponents;
   Uint32 bitDepth;
+  Uint32 thumbnailOffset; /*!<< EXIF JPEG thumbnail in the image buffer */
+  Uint32 thumbnailSize;   /*!<< 0 without one */
+  BOOL thumbnail;         /*!<< the picture above is the thumbnail */
 } JpgDecInitialInfo;
+
+typedef struct {
+  JpgRet ret;     /*!<< result of the decode */
+  void* userData; /*!<< opaque pointer given to AsrJpuDecSubmit */
+  FrameBufferInfo* frameBuffer;
+  ImageBufferInfo* jpegImageBuffer;
+  JpgDecInitialInfo info; /*!<< header info parsed at submit time */
+  Uint32 frameCycle;      /*!<< clock cycle */
+  Uint32 waitTimeUs;      /*!<< time asleep waiting for the interrupt */
+  Uint32 spinTimeUs;      /*!<< time polling the status before that */
+  Uint32 regWritesIssued; /*!<< register writes sent to the core */
+  Uint32 regWritesElided; /*!<< writes skipped, value already programmed */
+} JpgDecCompletion;
+
+typedef void (*JpgDecCallback)(void* handle, JpgDecCompletion* completion);
+
+/* Writes up to size bytes of the rest of the stream to data. Returns the
+ * bytes written, 0 once the stream has ended or a negative value on error.
+ */
+typedef Int32 (*JpgDecFillCallback)(void* userData, void* data, Uint32 size);
+
+/* Output rows y to y + height - 1 of the frame buffer are decoded. Called
+ * with the core held, so it should hand the band off rather than process it.
+ */
+typedef void (*JpgDecSliceCallback)(void* userData, Uint32 y, Uint32 height);
+
+typedef struct {
+  FrameBufferInfo* frameBuffer;     /*!<< set by the caller */
+  ImageBufferInfo* jpegImageBuffer; /*!<< set by the caller */
+  JpgRet ret;                       /*!<< result of this image */
+  JpgDecInitialInfo info;           /*!<< header info */
+  Uint32 frameCycle;                /*!<< clock cycle */
+  Uint32 waitTimeUs;   /*!<< time asleep waiting for the interrupt */
+  Uint32 spinTimeUs;   /*!<< time polling the status before that */
+  Uint32 decodeTimeUs; /*!<< time from MMU setup to the output info */
+} JpgDecBatchJob;
+
+typedef struct {
+  FrameFormat outputFormat; /*!<< FORMAT_MAX keeps the source format */
+  CbCrInterLeave chromaInterleave;
+  PackedFormat packedFormat;
+  Uint32 iHorScaleMode; /*!<< 0 to 3, width divided by 1 << mode */
+  Uint32 iVerScaleMode; /*!<< 0 to 3, height divided by 1 << mode */
+  Uint32 rotation;      /*!<< 0, 90, 180, 270 */
+  Uint32 targetWidth;   /*!<< if set with targetHeight, picks the modes */
+  Uint32 targetHeight;  /*!<< 0 on one side keeps the aspect ratio */
+} JpgDecProbeParam;
+
+typedef struct {
+  JpgDecRoi roi;                /*!<< set by the caller */
+  FrameBufferInfo* frameBuffer; /*!<< set by the caller */
+  JpgRet ret;                   /*!<< result of this crop */
+  Uint32 offsetX; /*!<< crop start in the picture, rounded down to an MCU */
+  Uint32 offsetY; /*!<< crop start in the picture, rounded down to an MCU */
+  Uint32 width;   /*!<< decoded crop, whole MCUs */
+  Uint32 height;  /*!<< decoded crop, whole MCUs */
+} JpgDecRoiJob;
+
+typedef struct {
+  JpgDecInitialInfo info;
+  Uint32 outputWidth;  /*!<< decoded picture after scaling and rotation */
+  Uint32 outputHeight; /*!<< decoded picture after scaling and rotation */
+  FrameBufferInfo frameBuffer; /*!<< layout and size to allocate, fd is -1 */
+  Uint32 iHorScaleMode;        /*!<< the one given or picked for the target */
+  Uint32 iVerScaleMode;        /*!<< the one given or picked for the target */
+} JpgDecProbeInfo;
+
+typedef struct {
+  JpgRet ret;     /*!<< result of the encode */
+  void* userData; /*!<< opaque pointer given to AsrJpuEncSubmit */
+  FrameBufferInfo* frameBuffer;
+  ImageBufferInfo* jpegImageBuffer; /*!<< imageSize holds the JPEG size */
+  Uint32 frameCycle;                /*!<< clock cycle */
+  Uint32 waitTimeUs;                /*!<< time asleep waiting for the interrupt */
+  Uint32 spinTimeUs;                /*!<< time polling the status before that */
+  Uint32 regWritesIssued;           /*!<< register writes sent to the core */
+  Uint32 regWritesElided; /*!<< writes skipped, value already programmed */
+} JpgEncCompletion;
+
+typedef void (*JpgEncCallback)(void* handle, JpgEncCompletion* completion);
 #endif /* _JPU_TYPES_H_ */
@@ -23,6 +23,24 @@ typedef struct jpu_instance_pool_t {
   BOOL instance_pool_inited;
   void *instPendingInst[MAX_NUM_INSTANCE];
   jpeg_mm_t vmem;
+  Int32 reg_owner; /* pid of the process whose writes are in the core */
+  Int32 lock_pid;  /* pid of the device lock owner, 0 if the core is free */
+  Uint64 lock_thread;
+  Int32 lock_depth;
+  Int32 lock_inst;  /* instance holding the lock, -1 for device requests */
+  Int32 sched_last; /* instance that ran last */
+  Int32 sched_next; /* instance the lock is handed to, -1 if none */
+  Int32 sched_waiting[MAX_NUM_INSTANCE];
+  Int32 sched_prio[MAX_NUM_INSTANCE];    /* JpgPriority of each instance */
+  Int32 sched_skipped[MAX_NUM_INSTANCE]; /* hand-overs it was passed over */
+  Int32 sched_dev_waiting; /* device requests waiting for the core */
+  Int32 sched_dev_skipped; /* hand-overs made while they waited */
+  Uint32 sched_wake[MAX_NUM_INSTANCE]; /* futex, bumped to wake an instance */
+  Uint32 lock_seq; /* futex, bumped when the core is released to anyone */
+  Int32 queue_depth; /* frames queued to the core and not finished yet */
+  Int32 clock_on;    /* clock gate state of the core */
+  Uint64 idle_since_us; /* end of the last frame, the idle timer gates from */
+  Uint32 mmu_cfg_seq;   /* bumped by every JDI_IOCTL_CFG_MMU to the core */
 } jpu_instance_pool_t;
 
 typedef struct jpu_buffer_t {
@@ -33,6 +51,15 @@ typedef struct jpu_buffer_t {
   unsigned int fd;
 } jpu_buffer_t;
 
+/* Table RAMs of the core, loaded through HUFF_DATA and QMAT_DATA. */
+typedef enum {
+  JDI_TABLE_BANK_HUFF = 0,
+  JDI_TABLE_BANK_QMAT0,
+  JDI_TABLE_BANK_QMAT1,
+  JDI_TABLE_BANK_QMAT2,
+  JDI_TABLE_BANK_MAX
+} jdi_table_bank;
+
 typedef enum {
   JDI_LOG_CMD_PICRUN = 0,
   JDI_LOG_CMD_INIT = 1,
@@ -45,9 +72,12 @@ typedef enum {
 extern "C" {
 #endif
 int jdi_probe(int dev_id);
+int jdi_get_load(int dev_id, int *instances, int *queue_depth);
+void jdi_add_queue_depth(JdiDeviceCtx devctx, int delta);
 /* @brief It returns the number of task using JDI.
  */
 int jdi_get_task_num(JdiDeviceCtx devctx);
+int jdi_get_dev_id(JdiDeviceCtx devctx);
 JdiDeviceCtx jdi_init(int dev_id);
 int jdi_release(
     JdiDeviceCtx devctx);  // this function may be called only at system off.
@@ -56,15 +86,36 @@ int jdi_allocate_dma_memory(JdiDeviceCtx devctx, jpu_buffer_t *vb);
 void jdi_free_dma_memory(JdiDeviceCtx devctx, jpu_buffer_t *vb);
 
 int jdi_wait_interrupt(JdiDeviceCtx devctx, int timeout,
-                       unsigned int addr_int_reason, unsigned long instIdx);
+                       unsigned int addr_int_reason, unsigned long instIdx,
+                       Uint32 *spin_time_us);
 int jdi_hw_reset(JdiDeviceCtx devctx);
 int jdi_wait_inst_ctrl_busy(JdiDeviceCtx devctx, int timeout,
                             unsigned int addr_flag_reg, unsigned int flag);
+int jdi_wait_register(JdiDeviceCtx devctx, int timeout, unsigned int addr,
+                      unsigned int mask, unsigned int expect);
+Uint64 jdi_get_time_us(void);
+/* @brief Register writes sent to the hardware and skipped as redundant.
+ */
+void jdi_get_register_stats(JdiDeviceCtx devctx, Uint64 *issued,
+                            Uint64 *elided);
+int jdi_table_loaded(JdiDeviceCtx devctx, int bank, Uint64 hash);
+void jdi_set_table_hash(JdiDeviceCtx devctx, int bank, Uint64 hash);
+void jdi_get_table_stats(JdiDeviceCtx devctx, Uint64 *loaded,
+                         Uint64 *skipped);
+int jdi_register_dmabuf(JdiDeviceCtx devctx, int fd);
+int jdi_unregister_dmabuf(JdiDeviceCtx devctx, int fd);
+void *jdi_dmabuf_map(JdiDeviceCtx devctx, int fd, size_t size);
+void jdi_dmabuf_unmap(JdiDeviceCtx devctx, int fd, void *addr, size_t size);
+void jdi_dmabuf_sync(int fd, unsigned int flags);
+void jdi_get_dma_cfg_stats(JdiDeviceCtx devctx, Uint64 *hits,
+                           Uint64 *misses);
 JPU_DMA_CFG jdi_config_mmu(JdiDeviceCtx devctx, int input_buffer_fd,
                            int output_buffer_fd, unsigned int dataSize,
                            unsigned int appendingSize);
 int jdi_set_clock_gate(JdiDeviceCtx devctx, int enable);
 int jdi_get_clock_gate(JdiDeviceCtx devctx);
+void jdi_get_clock_stats(JdiDeviceCtx devctx, Uint64 *on, Uint64 *off,
+                         Uint32 *wake_latency_us, Uint32 *wake_latency_max_us);
 
 int jdi_open_instance(JdiDeviceCtx devctx, unsigned long instIdx);
 int jdi_close_instance(JdiDeviceCtx devctx, unsigned long instIdx);
@@ -76,6 +127,10 @@ void jdi_write_register(JdiDeviceCtx devctx, unsigned long addr,
 unsigned long jdi_read_register(JdiDeviceCtx devctx, unsigned long addr);
 #endif
 int jdi_lock(JdiDeviceCtx devctx);
+int jdi_lock_inst(JdiDeviceCtx devctx, int inst_idx);
+int jdi_set_priority(JdiDeviceCtx devctx, int inst_idx, int priority);
+int jdi_lock_contended(JdiDeviceCtx devctx);
+void jdi_get_lock_stats(JdiDeviceCtx devctx, JpgLockStats *stats);
 void jdi_unlock(JdiDeviceCtx devctx);
 void jdi_log(int cmd, int step, int inst);
 
@@ -0,0 +1,553 @@
+/*
+ * Copyright (C) 2019 ASR Micro Limited
+ * All Rights Reserved.
+ */
+
+#include "jdi_emu.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jpu.h"
+#include "jpulog.h"
+#include "jputypes.h"
+#include "regdefine.h"
+
+#define JDI_EMU_MAX_DEVICES 8
+#define JDI_EMU_REGISTER_PHYS 0x1000
+/* CODAJ10, reports itself as productId 1 revision 0x010000 */
+#define JDI_EMU_VERSION_INFO ((1 << 24) | 0x010000)
+
+#define JDI_EMU_PIC_START (1 << 0)
+#define JDI_EMU_PIC_INIT (1 << 1)
+#define JDI_EMU_INT_DONE (1 << 0)
+#define JDI_EMU_INT_ERROR (1 << 1)
+#define JDI_EMU_INT_BIT_EMPTY (1 << 2)
+#define JDI_EMU_INT_SLICE_DONE (1 << 3)
+#define JDI_EMU_STREAM_END (1UL << 31)
+#define JDI_EMU_ENC_ENABLE (1 << 3)
+
+#define REG(emu, addr) ((emu)->regs[(addr) >> 2])
+
+typedef struct jdi_emu_map_t {
+  unsigned char *cpu;
+  size_t size;
+  unsigned long iova;
+} jdi_emu_map_t;
+
+struct jdi_emu_t {
+  int dev_id;
+  int refs;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  unsigned int regs[JDI_EMU_REGISTER_SIZE / 4];
+  void *inst_pool;
+  size_t inst_pool_size;
+  int inst_open_count;
+  int clock_on;
+  BOOL running;
+  struct timespec deadline;
+  unsigned int run_cycles;
+  jdi_emu_map_t in_map;
+  jdi_emu_map_t out_map;
+  unsigned int clock_mhz;
+  unsigned int cycles_per_mcu;
+  unsigned int irq_latency_us;
+  unsigned int clock_wake_us;
+};
+
+typedef struct jdi_emu_bitwriter_t {
+  unsigned char *buf;
+  size_t cap;
+  size_t len;
+  unsigned int acc;
+  int nbits;
+} jdi_emu_bitwriter_t;
+
+static pthread_mutex_t emu_devices_lock = PTHREAD_MUTEX_INITIALIZER;
+static jdi_emu_t *emu_devices[JDI_EMU_MAX_DEVICES];
+
+static unsigned int emu_env(const char *name, unsigned int def) {
+  const char *val = getenv(name);
+
+  if (!val || !*val) return def;
+
+  return (unsigned int)strtoul(val, NULL, 0);
+}
+
+int jdi_emu_enabled(void) { return emu_env("JPU_EMULATOR", 0) != 0; }
+
+static void emu_timespec_add_us(struct timespec *ts, unsigned long us) {
+  ts->tv_sec += us / 1000000;
+  ts->tv_nsec += (us % 1000000) * 1000;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+static int emu_timespec_before(const struct timespec *a,
+                               const struct timespec *b) {
+  if (a->tv_sec != b->tv_sec) return a->tv_sec < b->tv_sec;
+
+  return a->tv_nsec < b->tv_nsec;
+}
+
+static unsigned char *emu_iova_to_cpu(jdi_emu_t *emu, unsigned long iova,
+                                      size_t *avail) {
+  jdi_emu_map_t *maps[2] = {&emu->in_map, &emu->out_map};
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    jdi_emu_map_t *m = maps[i];
+    if (m->cpu && iova >= m->iova && iova < m->iova + m->size) {
+      *avail = m->size - (iova - m->iova);
+      return m->cpu + (iova - m->iova);
+    }
+  }
+
+  *avail = 0;
+  return NULL;
+}
+
+static void emu_put_byte(jdi_emu_bitwriter_t *bw, unsigned char byte) {
+  if (bw->len < bw->cap) bw->buf[bw->len] = byte;
+  bw->len++;
+}
+
+static void emu_put_bits(jdi_emu_bitwriter_t *bw, unsigned int bits, int n) {
+  bw->acc = (bw->acc << n) | (bits & ((1u << n) - 1));
+  bw->nbits += n;
+  while (bw->nbits >= 8) {
+    unsigned char byte = (bw->acc >> (bw->nbits - 8)) & 0xff;
+    emu_put_byte(bw, byte);
+    if (byte == 0xff) emu_put_byte(bw, 0x00);
+    bw->nbits -= 8;
+  }
+}
+
+static void emu_flush_bits(jdi_emu_bitwriter_t *bw) {
+  if (bw->nbits) emu_put_bits(bw, 0x7f, 8 - bw->nbits);
+}
+
+/*
+ * The model does not run a DCT. Like the core it emits the SOS segment
+ * followed by the scan; the scan is a flat mid-gray image coded with the
+ * Annex K tables (DC category 0 and an EOB for every block), which completes
+ * the header JpgEncEncodeHeader wrote into a decodable stream.
+ */
+static void emu_encode_frame(jdi_emu_t *emu) {
+  jdi_emu_bitwriter_t bw;
+  unsigned int size = REG(emu, MJPEG_PIC_SIZE_REG);
+  unsigned int mcu = REG(emu, MJPEG_MCU_INFO_REG);
+  unsigned int width = size >> 16, height = size & 0xffff;
+  unsigned int blocks = (mcu >> 16) & 0x0f, comps = (mcu >> 12) & 0x07;
+  unsigned int lumaBlocks, mcuW = 8, mcuH = 8, numMcu, rstIntval, i, b;
+  unsigned long base = REG(emu, MJPEG_BBC_BAS_ADDR_REG);
+  size_t avail;
+
+  memset(&bw, 0x00, sizeof(bw));
+  bw.buf = emu_iova_to_cpu(emu, base, &avail);
+  if (!bw.buf) {
+    REG(emu, MJPEG_PIC_STATUS_REG) |= JDI_EMU_INT_ERROR;
+    return;
+  }
+  bw.cap = avail;
+
+  if (blocks == 6) {
+    mcuW = mcuH = 16;
+  } else if (blocks == 4) {
+    mcuW = 16;
+  }
+  lumaBlocks = (comps > 1 && blocks > 2) ? blocks - 2 : blocks;
+  numMcu = ((width + mcuW - 1) / mcuW) * ((height + mcuH - 1) / mcuH);
+  rstIntval = REG(emu, MJPEG_RST_INTVAL_REG);
+
+  emu_put_byte(&bw, 0xff);
+  emu_put_byte(&bw, 0xda);
+  emu_put_byte(&bw, 0x00);
+  emu_put_byte(&bw, 6 + 2 * comps);
+  emu_put_byte(&bw, comps);
+  for (i = 0; i < comps; i++) {
+    emu_put_byte(&bw, i + 1);
+    emu_put_byte(&bw, i ? 0x11 : 0x00);
+  }
+  emu_put_byte(&bw, 0x00);
+  emu_put_byte(&bw, 0x3f);
+  emu_put_byte(&bw, 0x00);
+
+  for (i = 0; i < numMcu; i++) {
+    if (rstIntval && i && (i % rstIntval) == 0) {
+      emu_flush_bits(&bw);
+      emu_put_byte(&bw, 0xff);
+      emu_put_byte(&bw, 0xd0 | (((i / rstIntval) - 1) & 0x7));
+    }
+    for (b = 0; b < lumaBlocks; b++) emu_put_bits(&bw, 0x0a, 6);
+    for (; b < blocks; b++) emu_put_bits(&bw, 0x00, 4);
+  }
+  emu_flush_bits(&bw);
+  emu_put_byte(&bw, 0xff);
+  emu_put_byte(&bw, 0xd9);
+
+  if (bw.len > bw.cap) {
+    REG(emu, MJPEG_PIC_STATUS_REG) |= JDI_EMU_INT_ERROR;
+    return;
+  }
+  REG(emu, MJPEG_BBC_RD_PTR_REG) = base;
+  REG(emu, MJPEG_BBC_WR_PTR_REG) = base + bw.len;
+  REG(emu, MJPEG_PIC_STATUS_REG) |= JDI_EMU_INT_DONE;
+}
+
+/* Output rows of the decoded picture, after clipping and scaling. */
+static unsigned int emu_output_height(jdi_emu_t *emu) {
+  unsigned int height = REG(emu, MJPEG_PIC_SIZE_REG) & 0xffff;
+  unsigned int scale = REG(emu, MJPEG_SCL_INFO_REG);
+
+  if (REG(emu, MJPEG_CLP_INFO_REG) & 1)
+    height = REG(emu, MJPEG_CLP_SIZE_REG) & 0xffff;
+  if (scale & 0x10) height >>= scale & 0x3;
+  return height;
+}
+
+/* Until the stream end is flagged the core consumes what is there up to
+ * the write pointer and holds until the host clears the bit buffer empty
+ * interrupt. With a slice height it also holds after each band of luma
+ * rows until the slice done interrupt is cleared. Returns 0 while holding.
+ */
+static int emu_decode_frame(jdi_emu_t *emu) {
+  unsigned long base = REG(emu, MJPEG_BBC_BAS_ADDR_REG);
+  unsigned long wrPtr = REG(emu, MJPEG_BBC_WR_PTR_REG);
+  unsigned int sliceHeight = REG(emu, MJPEG_SLICE_INFO_REG);
+  unsigned int pos = REG(emu, MJPEG_SLICE_POS_REG);
+  unsigned int height = emu_output_height(emu);
+  unsigned long stride = REG(emu, MJPEG_DPB_YSTRIDE_REG);
+  unsigned char *frame;
+  size_t avail;
+
+  if (!(REG(emu, MJPEG_BBC_STRM_CTRL_REG) & JDI_EMU_STREAM_END)) {
+    REG(emu, MJPEG_BBC_RD_PTR_REG) = wrPtr;
+    REG(emu, MJPEG_PIC_STATUS_REG) |= JDI_EMU_INT_BIT_EMPTY;
+    return 0;
+  }
+
+  frame = emu_iova_to_cpu(emu, REG(emu, MJPEG_DPB_BASE00_REG), &avail);
+  if (sliceHeight && pos + sliceHeight < height) {
+    if (frame && (pos + sliceHeight) * stride <= avail)
+      memset(frame + pos * stride, 0x80, sliceHeight * stride);
+    REG(emu, MJPEG_SLICE_POS_REG) = pos + sliceHeight;
+    REG(emu, MJPEG_PIC_STATUS_REG) |= JDI_EMU_INT_SLICE_DONE;
+    return 0;
+  }
+  if (frame) memset(frame, 0x80, avail);
+  REG(emu, MJPEG_SLICE_POS_REG) = height;
+
+  REG(emu, MJPEG_GBU_TCNT_REG) = (wrPtr - base) * 8;
+  REG(emu, MJPEG_BBC_RD_PTR_REG) = wrPtr;
+  REG(emu, MJPEG_PIC_STATUS_REG) |= JDI_EMU_INT_DONE;
+  return 1;
+}
+
+/* Run time up to the next stop, the whole frame or one band of it. */
+static unsigned long emu_run_us(jdi_emu_t *emu) {
+  unsigned long cycles = emu->run_cycles;
+  unsigned int sliceHeight = REG(emu, MJPEG_SLICE_INFO_REG);
+  unsigned int height = emu_output_height(emu);
+
+  if (REG(emu, MJPEG_PIC_CTRL_REG) & JDI_EMU_ENC_ENABLE) sliceHeight = 0;
+  if (sliceHeight && sliceHeight < height)
+    cycles = (unsigned long long)cycles * sliceHeight / height;
+  return emu->irq_latency_us + cycles / emu->clock_mhz;
+}
+
+static void emu_start_frame(jdi_emu_t *emu) {
+  unsigned int size = REG(emu, MJPEG_PIC_SIZE_REG);
+  unsigned long pixels = (unsigned long)(size >> 16) * (size & 0xffff);
+
+  emu->run_cycles = ((pixels + 255) / 256) * emu->cycles_per_mcu;
+
+  clock_gettime(CLOCK_MONOTONIC, &emu->deadline);
+  emu_timespec_add_us(&emu->deadline, emu_run_us(emu));
+  emu->running = TRUE;
+}
+
+/* The host refilled the stream, what is left takes an interrupt latency, or
+ * took the band, the next one takes its share of the frame.
+ */
+static void emu_resume_frame(jdi_emu_t *emu, unsigned int reason) {
+  unsigned long us = emu->irq_latency_us;
+
+  if (reason & JDI_EMU_INT_SLICE_DONE) us = emu_run_us(emu);
+  clock_gettime(CLOCK_MONOTONIC, &emu->deadline);
+  emu_timespec_add_us(&emu->deadline, us);
+  emu->running = TRUE;
+}
+
+/* Retires the running frame once its modelled run time has elapsed. */
+static void emu_update(jdi_emu_t *emu) {
+  struct timespec now;
+
+  if (!emu->running) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (emu_timespec_before(&now, &emu->deadline)) return;
+
+  emu->running = FALSE;
+  if (REG(emu, MJPEG_PIC_CTRL_REG) & JDI_EMU_ENC_ENABLE) {
+    emu_encode_frame(emu);
+  } else if (!emu_decode_frame(emu)) {
+    pthread_cond_broadcast(&emu->cond);
+    return;
+  }
+  REG(emu, MJPEG_CYCLE_INFO_REG) = emu->run_cycles;
+  REG(emu, MJPEG_PIC_START_REG) &= ~JDI_EMU_PIC_START;
+  pthread_cond_broadcast(&emu->cond);
+}
+
+static void emu_reset(jdi_emu_t *emu) {
+  memset(emu->regs, 0x00, sizeof(emu->regs));
+  REG(emu, MJPEG_VERSION_INFO_REG) = JDI_EMU_VERSION_INFO;
+  emu->running = FALSE;
+}
+
+static void emu_unmap(jdi_emu_map_t *map) {
+  if (map->cpu) munmap(map->cpu, map->size);
+  memset(map, 0x00, sizeof(*map));
+}
+
+static int emu_map(jdi_emu_map_t *map, int fd, unsigned long iova) {
+  off_t size;
+  void *cpu;
+
+  size = lseek(fd, 0, SEEK_END);
+  if (size <= 0) return -1;
+
+  cpu = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (cpu == MAP_FAILED) return -1;
+
+  map->cpu = cpu;
+  map->size = size;
+  map->iova = iova;
+  return 0;
+}
+
+static int emu_wait_interrupt(jdi_emu_t *emu, jpudrv_intr_info_t *info) {
+  struct timespec timeout;
+  unsigned int status;
+
+  clock_gettime(CLOCK_MONOTONIC, &timeout);
+  emu_timespec_add_us(&timeout, (unsigned long)info->timeout * 1000);
+
+  while (1) {
+    emu_update(emu);
+    status = REG(emu, MJPEG_PIC_STATUS_REG);
+    if (status & (JDI_EMU_INT_DONE | JDI_EMU_INT_ERROR)) {
+      // the driver ISR latches and clears the reason
+      REG(emu, MJPEG_PIC_STATUS_REG) = 0;
+      info->intr_reason = status;
+      return 0;
+    }
+    if (status & (JDI_EMU_INT_BIT_EMPTY | JDI_EMU_INT_SLICE_DONE)) {
+      // left set, clearing it is what resumes the core
+      info->intr_reason = status;
+      return 0;
+    }
+    if (emu->running && emu_timespec_before(&emu->deadline, &timeout)) {
+      pthread_cond_timedwait(&emu->cond, &emu->lock, &emu->deadline);
+      continue;
+    }
+    if (pthread_cond_timedwait(&emu->cond, &emu->lock, &timeout) ==
+        ETIMEDOUT) {
+      errno = ETIME;
+      return -1;
+    }
+  }
+}
+
+jdi_emu_t *jdi_emu_open(int dev_id, int *fd) {
+  jdi_emu_t *emu;
+  pthread_condattr_t condattr;
+
+  if (dev_id < 0 || dev_id >= JDI_EMU_MAX_DEVICES ||
+      dev_id >= (int)emu_env("JPU_EMU_CORES", 1)) {
+    errno = ENODEV;
+    return NULL;
+  }
+
+  // stands in for the device node so every jpu_fd check keeps working
+  *fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (*fd < 0) return NULL;
+
+  pthread_mutex_lock(&emu_devices_lock);
+  emu = emu_devices[dev_id];
+  if (!emu) {
+    emu = calloc(1, sizeof(jdi_emu_t));
+    if (!emu) {
+      pthread_mutex_unlock(&emu_devices_lock);
+      close(*fd);
+      *fd = -1;
+      return NULL;
+    }
+    emu->dev_id = dev_id;
+    pthread_mutex_init(&emu->lock, NULL);
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&emu->cond, &condattr);
+    pthread_condattr_destroy(&condattr);
+    emu->clock_mhz = emu_env("JPU_EMU_CLOCK_MHZ", 500);
+    emu->cycles_per_mcu = emu_env("JPU_EMU_CYCLES_PER_MCU", 256);
+    emu->irq_latency_us = emu_env("JPU_EMU_IRQ_LATENCY_US", 20);
+    emu->clock_wake_us = emu_env("JPU_EMU_CLOCK_WAKE_US", 100);
+    if (emu->clock_mhz == 0) emu->clock_mhz = 1;
+    emu_reset(emu);
+    emu_devices[dev_id] = emu;
+    JLOG(INFO, "[JDI] using software emulator for jpu device-%d\n", dev_id);
+  }
+  emu->refs++;
+  pthread_mutex_unlock(&emu_devices_lock);
+
+  return emu;
+}
+
+/* Like the kernel driver, the device state outlives its last user. */
+void jdi_emu_close(jdi_emu_t *emu, int fd) {
+  pthread_mutex_lock(&emu_devices_lock);
+  if (emu && emu->refs > 0) emu->refs--;
+  pthread_mutex_unlock(&emu_devices_lock);
+
+  if (fd >= 0) close(fd);
+}
+
+void *jdi_emu_mmap(jdi_emu_t *emu, size_t size, unsigned long offset) {
+  if (offset == JDI_EMU_REGISTER_PHYS) {
+    return size <= sizeof(emu->regs) ? (void *)emu->regs : MAP_FAILED;
+  }
+
+  if (!emu->inst_pool || size > emu->inst_pool_size) return MAP_FAILED;
+
+  return emu->inst_pool;
+}
+
+int jdi_emu_ioctl(jdi_emu_t *emu, unsigned long cmd, void *arg) {
+  int ret = 0;
+
+  pthread_mutex_lock(&emu->lock);
+
+  switch (cmd) {
+    case JDI_IOCTL_WAIT_INTERRUPT:
+      ret = emu_wait_interrupt(emu, (jpudrv_intr_info_t *)arg);
+      break;
+    case JDI_IOCTL_SET_CLOCK_GATE:
+      // the clock and power domain take a while to come up
+      if (!emu->clock_on && *(int *)arg) usleep(emu->clock_wake_us);
+      emu->clock_on = *(int *)arg;
+      break;
+    case JDI_IOCTL_RESET:
+      emu_reset(emu);
+      break;
+    case JDI_IOCTL_GET_INSTANCE_POOL: {
+      jpudrv_buffer_t *jdb = (jpudrv_buffer_t *)arg;
+      if (!emu->inst_pool) {
+        emu->inst_pool = mmap(NULL, jdb->size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (emu->inst_pool == MAP_FAILED) {
+          emu->inst_pool = NULL;
+          ret = -1;
+          break;
+        }
+        emu->inst_pool_size = jdb->size;
+      }
+      jdb->phys_addr = 0;
+      jdb->base = (unsigned long)emu->inst_pool;
+    } break;
+    case JDI_IOCTL_GET_REGISTER_INFO: {
+      jpudrv_buffer_t *jdb = (jpudrv_buffer_t *)arg;
+      jdb->phys_addr = JDI_EMU_REGISTER_PHYS;
+      jdb->size = JDI_EMU_REGISTER_SIZE;
+    } break;
+    case JDI_IOCTL_OPEN_INSTANCE:
+      ((jpudrv_inst_info_t *)arg)->inst_open_count = ++emu->inst_open_count;
+      break;
+    case JDI_IOCTL_CLOSE_INSTANCE:
+      if (emu->inst_open_count > 0) emu->inst_open_count--;
+      ((jpudrv_inst_info_t *)arg)->inst_open_count = emu->inst_open_count;
+      break;
+    case JDI_IOCTL_GET_INSTANCE_NUM:
+      *(int *)arg = emu->inst_open_count;
+      break;
+    case JDI_IOCTL_CFG_MMU: {
+      JPU_DMA_CFG *cfg = (JPU_DMA_CFG *)arg;
+      emu_unmap(&emu->in_map);
+      emu_unmap(&emu->out_map);
+      if (emu_map(&emu->in_map, cfg->intput_buf_fd, JDI_EMU_INPUT_IOVA) < 0 ||
+          emu_map(&emu->out_map, cfg->output_buf_fd, JDI_EMU_OUTPUT_IOVA) <
+              0) {
+        JLOG(ERR, "[JDI] emulator fail to map dma buffers %d/%d\n",
+             cfg->intput_buf_fd, cfg->output_buf_fd);
+        emu_unmap(&emu->in_map);
+        emu_unmap(&emu->out_map);
+        ret = -1;
+        break;
+      }
+      cfg->intput_virt_addr = JDI_EMU_INPUT_IOVA;
+      cfg->output_virt_addr = JDI_EMU_OUTPUT_IOVA;
+    } break;
+    default:
+      errno = ENOTTY;
+      ret = -1;
+      break;
+  }
+
+  pthread_mutex_unlock(&emu->lock);
+  return ret;
+}
+
+void jdi_emu_write_register(jdi_emu_t *emu, unsigned long addr,
+                            unsigned int data) {
+  if (addr >= JDI_EMU_REGISTER_SIZE) return;
+
+  pthread_mutex_lock(&emu->lock);
+  emu_update(emu);
+  switch (addr) {
+    case MJPEG_PIC_START_REG:
+      if (data & JDI_EMU_PIC_INIT) {
+        emu->running = FALSE;
+        REG(emu, MJPEG_PIC_STATUS_REG) = 0;
+        data &= ~JDI_EMU_PIC_INIT;
+      }
+      REG(emu, addr) = data;
+      if ((data & JDI_EMU_PIC_START) && !emu->running) emu_start_frame(emu);
+      break;
+    case MJPEG_PIC_STATUS_REG:
+      if ((data & REG(emu, addr) &
+           (JDI_EMU_INT_BIT_EMPTY | JDI_EMU_INT_SLICE_DONE)) &&
+          !emu->running && (REG(emu, MJPEG_PIC_START_REG) & JDI_EMU_PIC_START))
+        emu_resume_frame(emu, data & REG(emu, addr));
+      REG(emu, addr) &= ~data;
+      break;
+    case MJPEG_VERSION_INFO_REG:
+      break;
+    default:
+      REG(emu, addr) = data;
+      break;
+  }
+  pthread_mutex_unlock(&emu->lock);
+}
+
+unsigned int jdi_emu_read_register(jdi_emu_t *emu, unsigned long addr) {
+  unsigned int val;
+
+  if (addr >= JDI_EMU_REGISTER_SIZE) return (unsigned int)-1;
+
+  pthread_mutex_lock(&emu->lock);
+  emu_update(emu);
+  val = REG(emu, addr);
+  pthread_mutex_unlock(&emu->lock);
+
+  return val;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2019 ASR Micro Limited
+ * All Rights Reserved.
+ */
+
+#ifndef _JDI_EMU_H_
+#define _JDI_EMU_H_
+
+#include <stddef.h>
+
+/*
+ * In-process software model of the JPU kernel driver and the MJPEG register
+ * file. It is selected at run time by setting JPU_EMULATOR=1 and lets the
+ * whole JPU_Dec and JPU_Enc stack run on a machine without /dev/jpuN.
+ *
+ * Timing knobs (environment, all optional):
+ *   JPU_EMU_CLOCK_MHZ       core clock used to turn cycles into time (500)
+ *   JPU_EMU_CYCLES_PER_MCU  cycles charged per 16x16 MCU equivalent (256)
+ *   JPU_EMU_IRQ_LATENCY_US  fixed start-to-interrupt overhead (20)
+ *   JPU_EMU_CLOCK_WAKE_US   time to ungate the clock (100)
+ */
+
+#define JDI_EMU_REGISTER_SIZE 0x1000
+#define JDI_EMU_INPUT_IOVA 0x10000000
+#define JDI_EMU_OUTPUT_IOVA 0x40000000
+
+typedef struct jdi_emu_t jdi_emu_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int jdi_emu_enabled(void);
+jdi_emu_t *jdi_emu_open(int dev_id, int *fd);
+void jdi_emu_close(jdi_emu_t *emu, int fd);
+int jdi_emu_ioctl(jdi_emu_t *emu, unsigned long cmd, void *arg);
+void *jdi_emu_mmap(jdi_emu_t *emu, size_t size, unsigned long offset);
+void jdi_emu_write_register(jdi_emu_t *emu, unsigned long addr,
+                            unsigned int data);
+unsigned int jdi_emu_read_register(jdi_emu_t *emu, unsigned long addr);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  //#ifndef _JDI_EMU_H_
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2019 ASR Micro Limited
+ * All Rights Reserved.
+ */
+
+#include "jdi_trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "jpulog.h"
+
+__thread jdi_trace_ring_t *jdi_trace_ring;
+int jdi_trace_enabled = 1;
+
+static jdi_trace_ring_t *trace_rings; /* every ring, newest first */
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static pthread_mutex_t trace_dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Runs at thread exit, the entries stay for the dump and the next thread.
+static void jdi_trace_ring_put(void *arg) {
+  jdi_trace_ring_t *ring = (jdi_trace_ring_t *)arg;
+
+  __atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void jdi_trace_init(void) {
+  const char *env = getenv("JPU_TRACE");
+
+  if (env && atoi(env) == 0) {
+    jdi_trace_enabled = 0;
+    return;
+  }
+  pthread_key_create(&trace_key, jdi_trace_ring_put);
+}
+
+jdi_trace_ring_t *jdi_trace_ring_get(void) {
+  jdi_trace_ring_t *ring;
+  int free_ring = 0;
+
+  pthread_once(&trace_once, jdi_trace_init);
+  if (!jdi_trace_enabled) return NULL;
+
+  for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring;
+       ring = ring->next) {
+    if (__atomic_compare_exchange_n(&ring->in_use, &free_ring, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+    free_ring = 0;
+  }
+
+  if (!ring) {
+    ring = calloc(1, sizeof(jdi_trace_ring_t));
+    if (!ring) return NULL;
+    ring->in_use = 1;
+    ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+  }
+
+  ring->tid = (uint32_t)syscall(SYS_gettid);
+  pthread_setspecific(trace_key, ring);
+  jdi_trace_ring = ring;
+  return ring;
+}
+
+/* Copies the entries of a ring that are complete. The owner keeps writing
+ * meanwhile, so the slots it reached by the end of the copy are dropped.
+ */
+static uint32_t jdi_trace_ring_copy(jdi_trace_ring_t *ring,
+                                    jdi_trace_entry_t *out,
+                                    uint64_t *dropped) {
+  uint64_t head, first, safe, i;
+  uint32_t count;
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  first = head > JDI_TRACE_RING_ENTRIES ? head - JDI_TRACE_RING_ENTRIES : 0;
+  for (i = first; i < head; i++) {
+    out[i - first] = ring->entry[i & (JDI_TRACE_RING_ENTRIES - 1)];
+  }
+
+  safe = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) + 1;
+  safe = safe > JDI_TRACE_RING_ENTRIES ? safe - JDI_TRACE_RING_ENTRIES : 0;
+  if (safe > first) {
+    if (safe > head) safe = head;
+    memmove(out, out + (safe - first), (head - safe) * sizeof(*out));
+    first = safe;
+  }
+  count = (uint32_t)(head - first);
+  *dropped = first;
+
+  return count;
+}
+
+int jdi_trace_dump(const char *path) {
+  jdi_trace_file_hdr_t hdr;
+  jdi_trace_ring_hdr_t ring_hdr;
+  jdi_trace_ring_t *rings, *ring;
+  jdi_trace_entry_t *entries;
+  FILE *fp;
+  int ret = 0;
+
+  if (!path) return -1;
+
+  entries = malloc(sizeof(jdi_trace_entry_t) * JDI_TRACE_RING_ENTRIES);
+  if (!entries) return -1;
+
+  fp = fopen(path, "wb");
+  if (!fp) {
+    JLOG(ERR, "[JDI] can't open trace file %s\n", path);
+    free(entries);
+    return -1;
+  }
+
+  pthread_mutex_lock(&trace_dump_lock);
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, JDI_TRACE_FILE_MAGIC, sizeof(hdr.magic));
+  hdr.version = JDI_TRACE_FILE_VERSION;
+  hdr.entry_size = sizeof(jdi_trace_entry_t);
+  hdr.pid = (uint32_t)getpid();
+  // Rings are only added at the head, ones created from here on are left out.
+  rings = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+  for (ring = rings; ring; ring = ring->next) {
+    hdr.ring_count++;
+  }
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ret = -1;
+
+  for (ring = rings; ring; ring = ring->next) {
+    memset(&ring_hdr, 0, sizeof(ring_hdr));
+    ring_hdr.tid = ring->tid;
+    ring_hdr.count = jdi_trace_ring_copy(ring, entries, &ring_hdr.dropped);
+    if (fwrite(&ring_hdr, sizeof(ring_hdr), 1, fp) != 1 ||
+        fwrite(entries, sizeof(*entries), ring_hdr.count, fp) !=
+            ring_hdr.count) {
+      ret = -1;
+    }
+  }
+  pthread_mutex_unlock(&trace_dump_lock);
+
+  if (fclose(fp) != 0) ret = -1;
+  free(entries);
+
+  if (ret < 0) JLOG(ERR, "[JDI] fail to write trace file %s\n", path);
+  return ret;
+}
+
+void jdi_trace_incident(void) {
+  const char *path = getenv("JPU_TRACE_FILE");
+
+  if (!path || !jdi_trace_enabled) return;
+  if (jdi_trace_dump(path) == 0) {
+    JLOG(INFO, "[JDI] trace dumped to %s\n", path);
+  }
+}
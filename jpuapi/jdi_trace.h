@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2019 ASR Micro Limited
+ * All Rights Reserved.
+ */
+
+#ifndef _JDI_TRACE_H_
+#define _JDI_TRACE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Binary trace of the traffic between the library and the core: register
+ * writes and reads, ioctls, device lock hand-overs and interrupts. Every
+ * thread records into a ring of its own, so an event costs a timestamp and
+ * a few stores, without locks or formatting. Rings stay around after their
+ * thread exits and are reused by new threads.
+ *
+ * jdi_trace_dump writes the rings of the process to a file decoded offline
+ * by jpu_trace_dump. The library dumps on its own when an interrupt times
+ * out and JPU_TRACE_FILE names a file. JPU_TRACE=0 in the environment stops
+ * recording, building with JPU_TRACE=OFF removes the calls altogether.
+ */
+
+#define JDI_TRACE_RING_ENTRIES 4096 /* per thread, a power of two */
+#define JDI_TRACE_FILE_MAGIC "JPUTRACE"
+#define JDI_TRACE_FILE_VERSION 1
+
+typedef enum {
+  JDI_TRACE_REG_WRITE = 1, /* a: register offset, b: value */
+  JDI_TRACE_REG_READ,      /* a: register offset, b: value */
+  JDI_TRACE_IOCTL,         /* a: ioctl number, b: return value */
+  JDI_TRACE_LOCK,          /* a: instance or -1, b: time waited in us */
+  JDI_TRACE_UNLOCK,        /* a: instance or -1 */
+  JDI_TRACE_IRQ,           /* a: interrupt reason or -1, b: instance */
+  JDI_TRACE_EVENT_MAX
+} jdi_trace_event;
+
+typedef struct {
+  uint64_t ts_ns; /* CLOCK_MONOTONIC */
+  uint32_t tid;
+  uint16_t event; /* jdi_trace_event */
+  uint16_t dev_id;
+  uint32_t a;
+  uint32_t b;
+} jdi_trace_entry_t;
+
+/* File layout: the header, then ring_count times a jdi_trace_ring_hdr_t
+ * followed by its entries, oldest first.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t pid;
+  uint32_t ring_count;
+} jdi_trace_file_hdr_t;
+
+typedef struct {
+  uint32_t tid;     /* thread owning the ring when it was dumped */
+  uint32_t count;   /* entries that follow */
+  uint64_t dropped; /* older entries the ring has overwritten */
+} jdi_trace_ring_hdr_t;
+
+#ifdef SUPPORT_JPU_TRACE
+
+typedef struct jdi_trace_ring_t {
+  struct jdi_trace_ring_t *next;
+  uint32_t tid;
+  int in_use;
+  uint64_t head; /* entries ever written, published after each entry */
+  jdi_trace_entry_t entry[JDI_TRACE_RING_ENTRIES];
+} jdi_trace_ring_t;
+
+extern __thread jdi_trace_ring_t *jdi_trace_ring;
+extern int jdi_trace_enabled;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+jdi_trace_ring_t *jdi_trace_ring_get(void);
+int jdi_trace_dump(const char *path);
+void jdi_trace_incident(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+static inline uint64_t jdi_trace_time_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void jdi_trace(int event, int dev_id, uint32_t a, uint32_t b) {
+  jdi_trace_ring_t *ring = jdi_trace_ring;
+  jdi_trace_entry_t *e;
+
+  if (!jdi_trace_enabled) return;
+  if (!ring && !(ring = jdi_trace_ring_get())) return;
+
+  // Only this thread writes the ring, the dump reads it behind head.
+  e = &ring->entry[ring->head & (JDI_TRACE_RING_ENTRIES - 1)];
+  e->ts_ns = jdi_trace_time_ns();
+  e->tid = ring->tid;
+  e->event = (uint16_t)event;
+  e->dev_id = (uint16_t)dev_id;
+  e->a = a;
+  e->b = b;
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+#define JDI_TRACE(event, dev_id, a, b) \
+  jdi_trace(event, dev_id, (uint32_t)(a), (uint32_t)(b))
+#define JDI_TRACE_INCIDENT() jdi_trace_incident()
+
+#else
+
+#define JDI_TRACE(event, dev_id, a, b) \
+  do {                                 \
+  } while (0)
+#define JDI_TRACE_INCIDENT() \
+  do {                       \
+  } while (0)
+
+#endif  // SUPPORT_JPU_TRACE
+
+#endif  //#ifndef _JDI_TRACE_H_
@@ -6,14 +6,20 @@
 #include "jpuapi.h"
 
 #include <linux/dma-buf.h>
+#include <pthread.h>
 #include <sys/mman.h>
 
+#include "jdi_trace.h"
 #include "jpuapifunc.h"
 #include "jpulog.h"
 #include "jputable.h"
 #include "regdefine.h"
 
 static JPUCap g_JpuAttributes;
+static pthread_once_t s_coreProbeOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t s_corePlaceLock = PTHREAD_MUTEX_INITIALIZER;
+static int s_coreNum;
+static int s_coreDevId[MAX_NUM_JPU_CORE];
 static void SwapByte(Uint8 *data, Uint32 len) {
   Uint8 temp;
   Uint32 i;
@@ -139,6 +145,20 @@ Uint32 JPU_GetStatus(JpgHandle handle) {
   return JpuReadInstReg(pJpgInst->devctx, instRegIndex, MJPEG_PIC_STATUS_REG);
 }
 
+// Output rows written so far by a frame decoding in slices.
+Uint32 JPU_GetSlicePos(JpgHandle handle) {
+  JpgInst *pJpgInst = (JpgInst *)handle;
+  Int32 instRegIndex;
+
+  if (pJpgInst->sliceInstMode == TRUE) {
+    instRegIndex = pJpgInst->instIndex;
+  } else {
+    instRegIndex = 0;
+  }
+
+  return JpuReadInstReg(pJpgInst->devctx, instRegIndex, MJPEG_SLICE_POS_REG);
+}
+
 Uint32 JPU_IsInit(JdiDeviceCtx devctx) {
   jpu_instance_pool_t *pjip;
 
@@ -219,6 +239,8 @@ Int32 JPU_WaitInterrupt(JpgHandle handle, int timeout) {
   Int32 instRegIndex;
 
   Int32 reason = 0;
+  Uint32 spinTimeUs;
+  Uint64 start;
 
   JpgInst *pJpgInst = (JpgInst *)handle;
 
@@ -230,8 +252,11 @@ Int32 JPU_WaitInterrupt(JpgHandle handle, int timeout) {
 
   instPicStatusRegAddr = ((instRegIndex * NPT_REG_SIZE) + MJPEG_PIC_STATUS_REG);
 
+  start = jdi_get_time_us();
   reason = jdi_wait_interrupt(pJpgInst->devctx, timeout, instPicStatusRegAddr,
-                              instRegIndex);
+                              instRegIndex, &spinTimeUs);
+  pJpgInst->waitTimeUs += (Uint32)(jdi_get_time_us() - start) - spinTimeUs;
+  pJpgInst->spinTimeUs += spinTimeUs;
   if (reason == -1) {
     JLOG(ERR, "JPU time out !!!\n");
     JPU_ShowRegisters(handle);
@@ -250,6 +275,18 @@ Int32 JPU_WaitInterrupt(JpgHandle handle, int timeout) {
   return reason;
 }
 
+/* Turn the device counters sampled at the start of a picture into the
+ * number of register writes issued and elided for that picture.
+ */
+static void SetRegisterStats(JdiDeviceCtx devctx, Uint64 issued0,
+                             Uint64 elided0, Uint32 *issued, Uint32 *elided) {
+  Uint64 issued1, elided1;
+
+  jdi_get_register_stats(devctx, &issued1, &elided1);
+  *issued = (Uint32)(issued1 - issued0);
+  *elided = (Uint32)(elided1 - elided0);
+}
+
 JpgRet JPU_Init(int dev_id, JdiDeviceCtx *ctx) {
   jpu_instance_pool_t *pjip;
   Uint32 val;
@@ -291,7 +328,8 @@ JpgRet JPU_Init(int dev_id, JdiDeviceCtx *ctx) {
 
 void JPU_DeInit(JdiDeviceCtx devctx) {
   JpgEnterLock(devctx);
-  if (jdi_get_task_num(devctx) == 1) {
+  // A gated core has stopped already, leave it asleep.
+  if (jdi_get_task_num(devctx) == 1 && jdi_get_clock_gate(devctx)) {
     JpuWriteReg(devctx, MJPEG_INST_CTRL_START_REG, 0);
   }
   JpgLeaveLock(devctx);
@@ -318,6 +356,127 @@ JpgRet JPU_GetVersionInfo(JdiDeviceCtx devctx, Uint32 *apiVersion,
   return JPG_RET_SUCCESS;
 }
 
+static void JpuProbeCores(void) {
+  int i;
+
+  for (i = 0; i < MAX_NUM_JPU_CORE; i++) {
+    if (jdi_probe(i) == 0) s_coreDevId[s_coreNum++] = i;
+  }
+  JLOG(INFO, "[JPU] %d core(s) available\n", s_coreNum);
+}
+
+int JPU_GetCoreNum(void) {
+  pthread_once(&s_coreProbeOnce, JpuProbeCores);
+  return s_coreNum;
+}
+
+JpgRet JPU_GetCoreLoad(int dev_id, Int32 *instances, Int32 *queueDepth) {
+  int i;
+
+  pthread_once(&s_coreProbeOnce, JpuProbeCores);
+  for (i = 0; i < s_coreNum; i++) {
+    if (s_coreDevId[i] == dev_id) break;
+  }
+  if (i == s_coreNum) {
+    return JPG_RET_INVALID_PARAM;
+  }
+
+  if (jdi_get_load(dev_id, instances, queueDepth) < 0) {
+    return JPG_RET_FAILURE;
+  }
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet JPU_InitLeastLoaded(JdiDeviceCtx *ctx, int *dev_id) {
+  Int32 instances, queueDepth;
+  Int32 bestInstances = 0, bestQueueDepth = 0;
+  int best = -1;
+  JpgRet ret;
+  int i;
+
+  pthread_once(&s_coreProbeOnce, JpuProbeCores);
+
+  // Placements are serialized so that each one sees the previous session.
+  pthread_mutex_lock(&s_corePlaceLock);
+  for (i = 0; i < s_coreNum; i++) {
+    if (jdi_get_load(s_coreDevId[i], &instances, &queueDepth) < 0) continue;
+    if (best < 0 || instances < bestInstances ||
+        (instances == bestInstances && queueDepth < bestQueueDepth)) {
+      best = s_coreDevId[i];
+      bestInstances = instances;
+      bestQueueDepth = queueDepth;
+    }
+  }
+  if (best < 0) {
+    pthread_mutex_unlock(&s_corePlaceLock);
+    return JPG_RET_FAILURE;
+  }
+
+  ret = JPU_Init(best, ctx);
+  pthread_mutex_unlock(&s_corePlaceLock);
+  if (dev_id) *dev_id = best;
+
+  return ret;
+}
+
+/* Registers a dma-buf fd with the device until JPU_UnregisterDmaBuf, see
+ * jdi_register_dmabuf. Frames work the same without it.
+ */
+JpgRet JPU_RegisterDmaBuf(JdiDeviceCtx devctx, int fd) {
+  if (JPU_IsInit(devctx) == 0) {
+    return JPG_RET_NOT_INITIALIZED;
+  }
+
+  if (jdi_register_dmabuf(devctx, fd) < 0) {
+    return JPG_RET_FAILURE;
+  }
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet JPU_UnregisterDmaBuf(JdiDeviceCtx devctx, int fd) {
+  if (JPU_IsInit(devctx) == 0) {
+    return JPG_RET_NOT_INITIALIZED;
+  }
+
+  if (jdi_unregister_dmabuf(devctx, fd) < 0) {
+    return JPG_RET_INVALID_PARAM;
+  }
+  return JPG_RET_SUCCESS;
+}
+
+void JPU_GetDmaCfgStats(JdiDeviceCtx devctx, Uint64 *hits, Uint64 *misses) {
+  jdi_get_dma_cfg_stats(devctx, hits, misses);
+}
+
+JpgRet JPU_SetPriority(JpgHandle handle, JpgPriority priority) {
+  JpgInst *pJpgInst = (JpgInst *)handle;
+
+  if (!pJpgInst || priority >= JPU_PRIORITY_MAX) return JPG_RET_INVALID_PARAM;
+  if (jdi_set_priority(pJpgInst->devctx, pJpgInst->instIndex, priority) < 0) {
+    return JPG_RET_FAILURE;
+  }
+  return JPG_RET_SUCCESS;
+}
+
+void JPU_GetLockStats(JdiDeviceCtx devctx, JpgLockStats *stats) {
+  jdi_get_lock_stats(devctx, stats);
+}
+
+JpgRet JPU_TraceDump(const char *path) {
+#ifdef SUPPORT_JPU_TRACE
+  if (!path) return JPG_RET_INVALID_PARAM;
+  return jdi_trace_dump(path) == 0 ? JPG_RET_SUCCESS : JPG_RET_FAILURE;
+#else
+  return JPG_RET_NOT_SUPPORT;
+#endif
+}
+
+void JPU_GetClockStats(JdiDeviceCtx devctx, Uint64 *onCount, Uint64 *offCount,
+                       Uint32 *wakeLatencyUs, Uint32 *wakeLatencyMaxUs) {
+  jdi_get_clock_stats(devctx, onCount, offCount, wakeLatencyUs,
+                      wakeLatencyMaxUs);
+}
+
 JpgRet JPU_DecOpen(JdiDeviceCtx devctx, JpgDecHandle *pHandle,
                    JpgDecOpenParam *pop) {
   JpgInst *pJpgInst;
@@ -353,6 +512,7 @@ JpgRet JPU_DecOpen(JdiDeviceCtx devctx, JpgDecHandle *pHandle,
   pDecInfo->roiOffsetX = pop->roiOffsetX;
   pDecInfo->roiOffsetY = pop->roiOffsetY;
   pDecInfo->sliceHeight = pop->sliceHeight;
+  pDecInfo->thumbNailEn = pop->thumbNailEn;
   pJpgInst->sliceInstMode = pop->sliceInstMode;
   pDecInfo->intrEnableBit = pop->intrEnableBit;
   pDecInfo->decSlicePosY = 0;
@@ -413,20 +573,113 @@ JpgRet JPU_DecClose(JpgDecHandle handle) {
   return JPG_RET_SUCCESS;
 }
 
+/* Derives the window of whole MCUs the core clips to from the ROI in
+ * pixels, and reports it in info when given.
+ */
+static JpgRet DecSetupRoi(JpgDecInfo *pDecInfo, JpgDecInitialInfo *info) {
+  if (pDecInfo->format == FORMAT_400) {
+    pDecInfo->roiMcuWidth = pDecInfo->roiWidth / 8;
+  } else {
+    pDecInfo->roiMcuWidth = pDecInfo->roiWidth / pDecInfo->mcuWidth;
+  }
+  pDecInfo->roiMcuHeight = pDecInfo->roiHeight / pDecInfo->mcuHeight;
+  pDecInfo->roiMcuOffsetX = pDecInfo->roiOffsetX / pDecInfo->mcuWidth;
+  pDecInfo->roiMcuOffsetY = pDecInfo->roiOffsetY / pDecInfo->mcuHeight;
+
+  if ((pDecInfo->roiOffsetX > pDecInfo->alignedWidth) ||
+      (pDecInfo->roiOffsetY > pDecInfo->alignedHeight) ||
+      (pDecInfo->roiOffsetX + pDecInfo->roiWidth > pDecInfo->alignedWidth) ||
+      (pDecInfo->roiOffsetY + pDecInfo->roiHeight > pDecInfo->alignedHeight))
+    return JPG_RET_INVALID_PARAM;
+
+  if (pDecInfo->format == FORMAT_400) {
+    if (((pDecInfo->roiOffsetX + pDecInfo->roiWidth) < 8) ||
+        ((pDecInfo->roiOffsetY + pDecInfo->roiHeight) < pDecInfo->mcuHeight))
+      return JPG_RET_INVALID_PARAM;
+  } else {
+    if (((pDecInfo->roiOffsetX + pDecInfo->roiWidth) < pDecInfo->mcuWidth) ||
+        ((pDecInfo->roiOffsetY + pDecInfo->roiHeight) < pDecInfo->mcuHeight))
+      return JPG_RET_INVALID_PARAM;
+  }
+  // Narrower than an MCU, nothing would be decoded.
+  if (pDecInfo->roiMcuWidth == 0 || pDecInfo->roiMcuHeight == 0)
+    return JPG_RET_INVALID_PARAM;
+
+  if (pDecInfo->format == FORMAT_400)
+    pDecInfo->roiFrameWidth = pDecInfo->roiMcuWidth * 8;
+  else
+    pDecInfo->roiFrameWidth = pDecInfo->roiMcuWidth * pDecInfo->mcuWidth;
+  pDecInfo->roiFrameHeight = pDecInfo->roiMcuHeight * pDecInfo->mcuHeight;
+  if (info) {
+    info->roiFrameWidth = pDecInfo->roiFrameWidth;
+    info->roiFrameHeight = pDecInfo->roiFrameHeight;
+    info->roiFrameOffsetX = pDecInfo->roiMcuOffsetX * pDecInfo->mcuWidth;
+    info->roiFrameOffsetY = pDecInfo->roiMcuOffsetY * pDecInfo->mcuHeight;
+    info->roiMCUSize = pDecInfo->mcuWidth;
+  }
+  return JPG_RET_SUCCESS;
+}
+
+/* Parses the EXIF thumbnail of the header just parsed in its place. The scan
+ * position is kept from the buffer start, so the frame runs the same way. A
+ * thumbnail that does not parse leaves the picture.
+ */
+static BOOL DecParseThumbnail(JpgInst *pJpgInst, JpgDecInfo *pDecInfo) {
+  int frameOffset = pDecInfo->frameOffset;
+  int headerSize = pDecInfo->headerSize;
+  Uint32 thumbOffset = pDecInfo->thumbOffset;
+  Uint32 thumbSize = pDecInfo->thumbSize;
+  BOOL ok;
+
+  pDecInfo->frameOffset = thumbOffset;
+  pDecInfo->consumeByte = 0;
+  pDecInfo->ecsPtr = 0;
+  pDecInfo->headerSize = 0;
+  ok = JpegDecodeHeader(pDecInfo, pJpgInst->devctx) > 0;
+  if (!ok) {
+    JLOG(WARN, "EXIF thumbnail at %u unreadable, decoding the picture\n",
+         thumbOffset);
+    pDecInfo->frameOffset = frameOffset;
+    pDecInfo->consumeByte = 0;
+    pDecInfo->ecsPtr = 0;
+    JpegDecodeHeader(pDecInfo, pJpgInst->devctx);
+  }
+  pDecInfo->headerSize = headerSize;
+  pDecInfo->thumbOffset = thumbOffset;
+  pDecInfo->thumbSize = thumbSize;
+  return ok;
+}
+
 JpgRet JPU_DecGetInitialInfo(JpgDecHandle handle, JpgDecInitialInfo *info) {
+  JpgRet ret;
+
+  ret = CheckJpgInstValidity(handle);
+  if (ret != JPG_RET_SUCCESS) return ret;
+
+  return JPU_DecParseInitialInfo(handle, &handle->JpgInfo->decInfo, info);
+}
+
+/* Same as JPU_DecGetInitialInfo but parses into a caller owned decInfo, so the
+ * header of the next picture can be read while the instance is still busy
+ * with the current one.
+ */
+JpgRet JPU_DecParseInitialInfo(JpgDecHandle handle, JpgDecInfo *pDecInfo,
+                               JpgDecInitialInfo *info) {
   JpgInst *pJpgInst;
-  JpgDecInfo *pDecInfo;
   JpgRet ret;
 
   ret = CheckJpgInstValidity(handle);
   if (ret != JPG_RET_SUCCESS) return ret;
 
-  if (info == 0) {
+  if (info == 0 || pDecInfo == 0) {
     return JPG_RET_INVALID_PARAM;
   }
   pJpgInst = handle;
-  pDecInfo = &pJpgInst->JpgInfo->decInfo;
   if (JpegDecodeHeader(pDecInfo, pJpgInst->devctx) <= 0) return JPG_RET_FAILURE;
+  // Offsets into a ring may wrap, its frames decode as they are.
+  info->thumbnail = pDecInfo->thumbNailEn && pDecInfo->thumbSize &&
+                    !pDecInfo->streamRingSize &&
+                    DecParseThumbnail(pJpgInst, pDecInfo);
   if (pDecInfo->jpg12bit == TRUE && g_JpuAttributes.support12bit == FALSE) {
     return JPG_RET_NOT_SUPPORT;
   }
@@ -436,6 +689,8 @@ JpgRet JPU_DecGetInitialInfo(JpgDecHandle handle, JpgDecInitialInfo *info) {
   info->minFrameBufferCount = 1;
   info->sourceFormat = (FrameFormat)pDecInfo->format;
   info->ecsPtr = pDecInfo->ecsPtr;
+  info->thumbnailOffset = pDecInfo->thumbOffset;
+  info->thumbnailSize = pDecInfo->thumbSize;
 
   pDecInfo->initialInfoObtained = 1;
   pDecInfo->minFrameBufferNum = 1;
@@ -446,52 +701,49 @@ JpgRet JPU_DecGetInitialInfo(JpgDecHandle handle, JpgDecInitialInfo *info) {
   }
 
   if (pDecInfo->roiEnable) {
-    if (pDecInfo->format == FORMAT_400) {
-      pDecInfo->roiMcuWidth = pDecInfo->roiWidth / 8;
-    } else {
-      pDecInfo->roiMcuWidth = pDecInfo->roiWidth / pDecInfo->mcuWidth;
-    }
-    pDecInfo->roiMcuHeight = pDecInfo->roiHeight / pDecInfo->mcuHeight;
-    pDecInfo->roiMcuOffsetX = pDecInfo->roiOffsetX / pDecInfo->mcuWidth;
-    pDecInfo->roiMcuOffsetY = pDecInfo->roiOffsetY / pDecInfo->mcuHeight;
-
-    if ((pDecInfo->roiOffsetX > pDecInfo->alignedWidth) ||
-        (pDecInfo->roiOffsetY > pDecInfo->alignedHeight) ||
-        (pDecInfo->roiOffsetX + pDecInfo->roiWidth > pDecInfo->alignedWidth) ||
-        (pDecInfo->roiOffsetY + pDecInfo->roiHeight > pDecInfo->alignedHeight))
-      return JPG_RET_INVALID_PARAM;
-
-    if (pDecInfo->format == FORMAT_400) {
-      if (((pDecInfo->roiOffsetX + pDecInfo->roiWidth) < 8) ||
-          ((pDecInfo->roiOffsetY + pDecInfo->roiHeight) < pDecInfo->mcuHeight))
-        return JPG_RET_INVALID_PARAM;
-    } else {
-      if (((pDecInfo->roiOffsetX + pDecInfo->roiWidth) < pDecInfo->mcuWidth) ||
-          ((pDecInfo->roiOffsetY + pDecInfo->roiHeight) < pDecInfo->mcuHeight))
-        return JPG_RET_INVALID_PARAM;
-    }
-
-    if (pDecInfo->format == FORMAT_400)
-      pDecInfo->roiFrameWidth = pDecInfo->roiMcuWidth * 8;
-    else
-      pDecInfo->roiFrameWidth = pDecInfo->roiMcuWidth * pDecInfo->mcuWidth;
-    pDecInfo->roiFrameHeight = pDecInfo->roiMcuHeight * pDecInfo->mcuHeight;
-    info->roiFrameWidth = pDecInfo->roiFrameWidth;
-    info->roiFrameHeight = pDecInfo->roiFrameHeight;
-    info->roiFrameOffsetX = pDecInfo->roiMcuOffsetX * pDecInfo->mcuWidth;
-    info->roiFrameOffsetY = pDecInfo->roiMcuOffsetY * pDecInfo->mcuHeight;
-    info->roiMCUSize = pDecInfo->mcuWidth;
+    ret = DecSetupRoi(pDecInfo, info);
+    if (ret != JPG_RET_SUCCESS) return ret;
   }
   info->colorComponents = pDecInfo->compNum;
   info->bitDepth = pDecInfo->bitDepth;
 
-  /* Decide output format */
+  return JPG_RET_SUCCESS;
+}
+
+/* Header information of a JPEG in CPU memory, without a device. The data
+ * must hold the headers up to the first scan, the scan itself may be cut.
+ */
+JpgRet JPU_DecProbe(const BYTE *data, Uint32 size, JpgDecInitialInfo *info) {
+  JpgDecInfo *pDecInfo;
+  JpgRet ret = JPG_RET_SUCCESS;
 
-  if (pDecInfo->sliceHeight == 0) {
-    pDecInfo->sliceHeight = pDecInfo->alignedHeight;
+  if (data == NULL || size == 0 || info == NULL) {
+    return JPG_RET_INVALID_PARAM;
   }
 
-  return JPG_RET_SUCCESS;
+  pDecInfo = (JpgDecInfo *)calloc(1, sizeof(JpgDecInfo));
+  if (pDecInfo == NULL) return JPG_RET_INSUFFICIENT_RESOURCE;
+  pDecInfo->pBitStream = (BYTE *)data;
+  pDecInfo->streamBufSize = size;
+  pDecInfo->streamEndflag = 1;
+
+  if (JpegDecodeHeader(pDecInfo, NULL) <= 0) {
+    ret = JPG_RET_FAILURE;
+  } else {
+    memset(info, 0x00, sizeof(JpgDecInitialInfo));
+    info->picWidth = pDecInfo->picWidth;
+    info->picHeight = pDecInfo->picHeight;
+    info->minFrameBufferCount = 1;
+    info->sourceFormat = (FrameFormat)pDecInfo->format;
+    info->ecsPtr = pDecInfo->ecsPtr;
+    info->colorComponents = pDecInfo->compNum;
+    info->bitDepth = pDecInfo->bitDepth;
+    info->thumbnailOffset = pDecInfo->thumbOffset;
+    info->thumbnailSize = pDecInfo->thumbSize;
+  }
+
+  free(pDecInfo);
+  return ret;
 }
 
 JpgRet JPU_DecRegisterFrameBuffer(JpgDecHandle handle,
@@ -682,12 +934,11 @@ JpgRet JPU_SWReset(JpgHandle handle, JdiDeviceCtx devctx) {
   val = 0x1 << JPG_START_INIT;
   JpuWriteReg(instCtx, MJPEG_PIC_START_REG, val);
 
-  do {
-    val = JpuReadReg(instCtx, MJPEG_PIC_START_REG);
-    if (!(val & (0x1 << 1))) {
-      break;
-    }
-  } while (1);
+  if (jdi_wait_register(instCtx, JPU_BUSY_CHECK_TIMEOUT_MS,
+                        MJPEG_PIC_START_REG, 0x1 << JPG_START_INIT, 0) < 0) {
+    JLOG(ERR, "%s reset did not complete\n", __func__);
+    return JPG_RET_FAILURE;
+  }
   if (handle) jdi_log(JDI_LOG_CMD_RESET, 0, pJpgInst->instIndex);
 
   return JPG_RET_SUCCESS;
@@ -775,6 +1026,7 @@ JpgRet JPU_DecStartOneFrame(JpgDecHandle handle, JpgDecParam *param) {
   Uint32 dataSize = 0;
   Uint32 appendingSize = 0;
   Uint32 frame_virt_addr = 0;
+  Uint64 regIssued, regElided;
   ret = CheckJpgInstValidity(handle);
   if (ret != JPG_RET_SUCCESS) return ret;
 
@@ -793,11 +1045,12 @@ JpgRet JPU_DecStartOneFrame(JpgDecHandle handle, JpgDecParam *param) {
     instRegIndex = 0;
   }
 
-  JpgEnterLock(pJpgInst->devctx);
+  JpgEnterLockInst(pJpgInst->devctx, pJpgInst->instIndex);
   if (GetJpgPendingInstEx(pJpgInst->devctx, pJpgInst->instIndex) == pJpgInst) {
     JpgLeaveLock(pJpgInst->devctx);
     return JPG_RET_FRAME_NOT_COMPLETE;
   }
+  jdi_get_register_stats(pJpgInst->devctx, &regIssued, &regElided);
   val = (pDecInfo->frameIdx % pDecInfo->numFrameBuffers);
   frame_virt_addr = pDecInfo->frameBufPool[val].dmaBuffer.viraddr;
   if (pDecInfo->frameOffset < 0) {
@@ -841,7 +1094,10 @@ JpgRet JPU_DecStartOneFrame(JpgDecHandle handle, JpgDecParam *param) {
 
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_BBC_WR_PTR_REG,
                   pDecInfo->streamWrPtr);
-  if (pDecInfo->streamWrPtr == pDecInfo->streamBufStartAddr) {
+  // In a ring the frame may end below where it starts, the core has to run
+  // to the ring end and wrap.
+  if (pDecInfo->streamWrPtr == pDecInfo->streamBufStartAddr ||
+      pDecInfo->streamRingSize) {
     JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_BBC_END_ADDR_REG,
                     pDecInfo->streamBufEndAddr);
   } else {
@@ -922,7 +1178,9 @@ JpgRet JPU_DecStartOneFrame(JpgDecHandle handle, JpgDecParam *param) {
     }
   }
 
-  bTableInfoUpdate = TRUE;  // it always should be TRUE for multi-instance
+  // Always requested: with several instances the bank may hold another
+  // stream's tables. JpgDecQMatTabSetUp skips banks already holding ours.
+  bTableInfoUpdate = TRUE;
   if (bTableInfoUpdate == TRUE) {
     if (!JpgDecQMatTabSetUp(pDecInfo, pJpgInst->devctx, instRegIndex)) {
       JpgLeaveLock(pJpgInst->devctx);
@@ -930,7 +1188,10 @@ JpgRet JPU_DecStartOneFrame(JpgDecHandle handle, JpgDecParam *param) {
     }
   }
 
-  JpgDecGramSetup(pDecInfo, pJpgInst->devctx, instRegIndex);
+  if (!JpgDecGramSetup(pDecInfo, pJpgInst->devctx, instRegIndex)) {
+    JpgLeaveLock(pJpgInst->devctx);
+    return JPG_RET_FAILURE;
+  }
 
   if (pDecInfo->streamEndflag == 1) {
     val =
@@ -962,6 +1223,14 @@ JpgRet JPU_DecStartOneFrame(JpgDecHandle handle, JpgDecParam *param) {
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_ROT_INFO_REG,
                   (ppuEnable << 4) | (pDecInfo->mirrorIndex << 2) |
                       pDecInfo->rotationIndex);
+  // With a slice height the core stops after each band of that many output
+  // rows, raising INT_JPU_SLICE_DONE, and goes on once it is cleared. A
+  // whole picture is one slice of the aligned height.
+  JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_SLICE_INFO_REG,
+                  pDecInfo->sliceHeight ? pDecInfo->sliceHeight
+                                        : pDecInfo->alignedHeight);
+  JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_SLICE_POS_REG, 0);
+  pDecInfo->decSlicePosY = 0;
 
   val = (pDecInfo->frameIdx % pDecInfo->numFrameBuffers);
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_DPB_BASE00_REG,
@@ -987,8 +1256,12 @@ JpgRet JPU_DecStartOneFrame(JpgDecHandle handle, JpgDecParam *param) {
   } else {
     JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_CLP_INFO_REG, 0);
   }
+  pJpgInst->waitTimeUs = 0;
+  pJpgInst->spinTimeUs = 0;
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_PIC_START_REG,
                   (1 << JPG_START_PIC));
+  SetRegisterStats(pJpgInst->devctx, regIssued, regElided,
+                   &pDecInfo->regWritesIssued, &pDecInfo->regWritesElided);
   pDecInfo->decIdx++;
 
   SetJpgPendingInstEx(pJpgInst, pJpgInst->devctx, pJpgInst->instIndex);
@@ -1025,7 +1298,7 @@ JpgRet JPU_DecGetOutputInfo(JpgDecHandle handle, JpgDecOutputInfo *info) {
   }
 
   if (pJpgInst->sliceInstMode == TRUE) {
-    JpgEnterLock(pJpgInst->devctx);
+    JpgEnterLockInst(pJpgInst->devctx, pJpgInst->instIndex);
   }
 
   if (pJpgInst != GetJpgPendingInstEx(pJpgInst->devctx, pJpgInst->instIndex)) {
@@ -1081,7 +1354,7 @@ JpgRet JPU_DecGetOutputInfo(JpgDecHandle handle, JpgDecOutputInfo *info) {
         JpuReadInstReg(pJpgInst->devctx, instRegIndex, MJPEG_PIC_ERRMB_REG);
     info->decodingSuccess = 0;
 
-  } else if (intStatus & (1 << INT_JPU_OVERFLOW)) {
+  } else if (intStatus & (1 << INT_JPU_SLICE_DONE)) {
     info->decodeState = DECODE_STATE_SLICE_DONE;
     info->decodedSliceYPos =
         JpuReadInstReg(pJpgInst->devctx, instRegIndex, MJPEG_SLICE_POS_REG);
@@ -1089,6 +1362,10 @@ JpgRet JPU_DecGetOutputInfo(JpgDecHandle handle, JpgDecOutputInfo *info) {
   }
   info->frameCycle =
       JpuReadInstReg(pJpgInst->devctx, instRegIndex, MJPEG_CYCLE_INFO_REG);
+  info->waitTimeUs = pJpgInst->waitTimeUs;
+  info->spinTimeUs = pJpgInst->spinTimeUs;
+  info->regWritesIssued = pDecInfo->regWritesIssued;
+  info->regWritesElided = pDecInfo->regWritesElided;
 
   // if (val != 0)
   //    JpuWriteInstReg(instRegIndex, MJPEG_PIC_STATUS_REG, val);
@@ -1147,6 +1424,29 @@ JpgRet JPU_DecGiveCommand(JpgDecHandle handle, JpgCommand cmd, void *param) {
     case DISABLE_LOGGING: {
       pJpgInst->loggingEnable = 0;
     } break;
+    case SET_JPG_ROI: {
+      // Applies at once to a parsed header, an invalid window leaves the
+      // whole picture.
+      JpgDecRoi *roi = (JpgDecRoi *)param;
+      pDecInfo->roiEnable = roi && roi->width;
+      pDecInfo->roiOffsetX = pDecInfo->roiEnable ? roi->x : 0;
+      pDecInfo->roiOffsetY = pDecInfo->roiEnable ? roi->y : 0;
+      pDecInfo->roiWidth = pDecInfo->roiEnable ? roi->width : 0;
+      pDecInfo->roiHeight = pDecInfo->roiEnable ? roi->height : 0;
+      if (!pDecInfo->initialInfoObtained) break;
+      if (pDecInfo->format == FORMAT_400) JpgDecSetMcu400(pDecInfo);
+      if (pDecInfo->roiEnable &&
+          DecSetupRoi(pDecInfo, NULL) != JPG_RET_SUCCESS) {
+        pDecInfo->roiEnable = FALSE;
+        if (pDecInfo->format == FORMAT_400) JpgDecSetMcu400(pDecInfo);
+        return JPG_RET_INVALID_PARAM;
+      }
+    } break;
+    case SET_JPG_THUMBNAIL:
+      // From the next header on.
+      if (param == 0) return JPG_RET_INVALID_PARAM;
+      pDecInfo->thumbNailEn = *(Uint32 *)param ? TRUE : FALSE;
+      break;
     default:
       return JPG_RET_INVALID_COMMAND;
   }
@@ -1559,6 +1859,7 @@ JpgRet JPU_EncStartOneFrame(JpgEncHandle handle, JpgEncParam *param) {
   Uint32 rotMirMode = 0;
   Uint32 dataSize = 0;
   Uint32 appendingSize = 0;
+  Uint64 regIssued, regElided;
 
   ret = CheckJpgInstValidity(handle);
   if (ret != JPG_RET_SUCCESS) return ret;
@@ -1573,12 +1874,13 @@ JpgRet JPU_EncStartOneFrame(JpgEncHandle handle, JpgEncParam *param) {
 
   pBasFrame = param->sourceFrame;
 
-  JpgEnterLock(pJpgInst->devctx);
+  JpgEnterLockInst(pJpgInst->devctx, pJpgInst->instIndex);
 
   if (GetJpgPendingInstEx(pJpgInst->devctx, pJpgInst->instIndex) == pJpgInst) {
     JpgLeaveLock(pJpgInst->devctx);
     return JPG_RET_FRAME_NOT_COMPLETE;
   }
+  jdi_get_register_stats(pJpgInst->devctx, &regIssued, &regElided);
 
   if (pJpgInst->sliceInstMode == TRUE) {
     instRegIndex = pJpgInst->instIndex;
@@ -1818,14 +2120,21 @@ JpgRet JPU_EncStartOneFrame(JpgEncHandle handle, JpgEncParam *param) {
   if (pJpgInst->loggingEnable) jdi_log(JDI_LOG_CMD_PICRUN, 1, instRegIndex);
 
   // JPU_ShowRegisters(handle);
+  pJpgInst->waitTimeUs = 0;
+  pJpgInst->spinTimeUs = 0;
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_PIC_START_REG,
                   (1 << JPG_START_PIC));
+  SetRegisterStats(pJpgInst->devctx, regIssued, regElided,
+                   &pEncInfo->regWritesIssued, &pEncInfo->regWritesElided);
 
   pEncInfo->encIdx++;
 
   SetJpgPendingInstEx(pJpgInst, pJpgInst->devctx, pJpgInst->instIndex);
 
-  JpgLeaveLock(pJpgInst->devctx);
+  // Non-slice mode keeps the core until JPU_EncGetOutputInfo.
+  if (pJpgInst->sliceInstMode == TRUE) {
+    JpgLeaveLock(pJpgInst->devctx);
+  }
 
   return JPG_RET_SUCCESS;
 }
@@ -1851,7 +2160,7 @@ JpgRet JPU_EncGetOutputInfo(void *handle, JpgEncOutputInfo *info) {
   pEncInfo = &pJpgInst->JpgInfo->encInfo;
 
   if (pJpgInst->sliceInstMode == TRUE) {
-    JpgEnterLock(pJpgInst->devctx);
+    JpgEnterLockInst(pJpgInst->devctx, pJpgInst->instIndex);
   }
   if (pJpgInst != GetJpgPendingInstEx(pJpgInst->devctx, pJpgInst->instIndex)) {
     JpgLeaveLock(pJpgInst->devctx);
@@ -1866,6 +2175,10 @@ JpgRet JPU_EncGetOutputInfo(void *handle, JpgEncOutputInfo *info) {
 
   info->frameCycle =
       JpuReadInstReg(pJpgInst->devctx, instRegIndex, MJPEG_CYCLE_INFO_REG);
+  info->waitTimeUs = pJpgInst->waitTimeUs;
+  info->spinTimeUs = pJpgInst->spinTimeUs;
+  info->regWritesIssued = pEncInfo->regWritesIssued;
+  info->regWritesElided = pEncInfo->regWritesElided;
   //    intReason = JpuReadInstReg(instRegIndex, MJPEG_PIC_STATUS_REG);
   intReason = info->intStatus;
 
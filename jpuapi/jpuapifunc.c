@@ -5,6 +5,9 @@
 
 #include "jpuapifunc.h"
 
+#include <limits.h>
+#include <stddef.h>
+
 #include "jpulog.h"
 #include "jputable.h"
 #include "regdefine.h"
@@ -282,6 +285,7 @@ JpgRet GetJpgInstance(JdiDeviceCtx devctx, JpgInst **ppInst) {
 
   pJpgInst->inUse = TRUE;
   pJpgInst->devctx = devctx;
+  jdi_set_priority(devctx, pJpgInst->instIndex, JPU_PRIORITY_NORMAL);
   handleSize = sizeof(JpgDecInfo);
   if (handleSize < sizeof(JpgEncInfo)) {
     handleSize = sizeof(JpgEncInfo);
@@ -671,690 +675,146 @@ int JPUEncGetQMatrix(char *qMatFileName, EncMjpgParam *param) {
 
   return 1;
 }
-int JpgDecHuffTabSetUp(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex) {
-  int i, j;
-  int HuffData;  // 16BITS
-  int HuffLength;
-  int temp;
-
-  // MIN Tables
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x003);
-
-  // DC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[0][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-
-  // DC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[2][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-
-  // AC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[1][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-
-  // AC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[3][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-  // MAX Tables
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x403);
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_ADDR_REG, 0x440);
-
-  // DC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[0][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-  // DC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[2][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-  // AC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[1][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-  // AC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[3][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-
-  // PTR Tables
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x803);
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_ADDR_REG, 0x880);
-
-  // DC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[0][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  // DC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[2][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  // AC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[1][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  // AC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[3][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-
-  // VAL Tables
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0xC03);
-
-  // VAL DC Luma
-  HuffLength = 0;
-  for (i = 0; i < 12; i++) HuffLength += jpg->huffBits[0][i];
-
-  if (HuffLength > 256) return 0;
-
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 12 row, 1 category (DC Luma)
-    HuffData = jpg->huffVal[0][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-
-  for (i = 0; i < 12 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
-  }
-
-  // VAL DC Chroma
-  HuffLength = 0;
-  for (i = 0; i < 12; i++) HuffLength += jpg->huffBits[2][i];
-
-  if (HuffLength > 256) return 0;
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 12 row, 1 category (DC Chroma)
-    HuffData = jpg->huffVal[2][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  for (i = 0; i < 12 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
-  }
-
-  // VAL AC Luma
-  HuffLength = 0;
-  for (i = 0; i < 162; i++) HuffLength += jpg->huffBits[1][i];
-
-  if (HuffLength > 256) return 0;
-
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 162 row, 1 category (AC Luma)
-    HuffData = jpg->huffVal[1][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  for (i = 0; i < 162 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
-  }
-
-  // VAL AC Chroma
-  HuffLength = 0;
-  for (i = 0; i < 162; i++) HuffLength += jpg->huffBits[3][i];
+/* Tags keep the hash of one table layout from matching another, e.g. the
+ * decoder and encoder QMAT formats that share the same bank.
+ */
+enum {
+  JPG_TAB_DEC_HUFF = 1,
+  JPG_TAB_DEC_HUFF_12B,
+  JPG_TAB_DEC_QMAT,
+  JPG_TAB_ENC_HUFF,
+  JPG_TAB_ENC_HUFF_12B,
+  JPG_TAB_ENC_QMAT,
+};
 
-  if (HuffLength > 256) return 0;
+/* 64-bit FNV style hash, used to tell whether a table bank of the core
+ * already holds the contents about to be uploaded.
+ */
+static Uint64 JpgTabHash(Uint64 hash, const void *data, Uint32 size) {
+  const BYTE *p = (const BYTE *)data;
+  Uint64 w;
+
+  if (hash == 0) hash = 0xcbf29ce484222325ULL;
+  for (; size >= 8; size -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    hash = (hash ^ w) * 0x100000001b3ULL;
+    hash ^= hash >> 32;
+  }
+  for (; size; size--, p++) hash = (hash ^ *p) * 0x100000001b3ULL;
+  return hash ? hash : 1;
+}
 
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 162 row, 1 category (AC Chroma)
-    HuffData = jpg->huffVal[3][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
+/* Streams the packed images of the decoder Huffman tables into the core.
+ * MIN, MAX and PTR hold 16 words per table, VAL is padded to 12/162 words
+ * (8-bit) or 16/256 words (12-bit) per DC/AC table.
+ */
+static int JpgDecLoadHuffImage(JpgDecInfo *jpg, JdiDeviceCtx devctx,
+                               int instRegIndex, int numTab, int maxAddr,
+                               int ptrAddr) {
+  // DC Luma, DC Chroma, AC Luma, AC Chroma, DC EX1, AC EX1
+  static const int tabOrder[6] = {0, 2, 1, 3, 4, 5};
+  const JpgHuffImage *image;
+  Uint32 i;
+  int t;
 
-  for (i = 0; i < 162 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
+  for (t = 0; t < numTab; t++) {
+    image = jpg->huffImage[tabOrder[t]];
+    if (image == NULL || image->valLen > 256) return 0;
   }
 
-  // end SerPeriHuffTab
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x000);
-
-  return 1;
-}
-
-int JpgDecHuffTabSetUp_12b(JpgDecInfo *jpg, JdiDeviceCtx devctx,
-                           int instRegIndex) {
-  int i, j;
-  int HuffData;  // 16BITS
-  int HuffLength;
-  int temp;
+  if (jdi_table_loaded(devctx, JDI_TABLE_BANK_HUFF, jpg->huffImageHash))
+    return 1;
+  // The bank holds nothing known until the whole upload went through.
+  jdi_set_table_hash(devctx, JDI_TABLE_BANK_HUFF, 0);
 
   // MIN Tables
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x003);
-
-  // DC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[0][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-  // DC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[2][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-  // AC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[1][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-  // AC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[3][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-  // DC EX1
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[4][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
-  }
-
-  // AC EX1
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMin[5][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));  // 32-bit
+  for (t = 0; t < numTab; t++) {
+    image = jpg->huffImage[tabOrder[t]];
+    for (i = 0; i < 16; i++)
+      JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, image->min[i]);
   }
 
   // MAX Tables
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x403);
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_ADDR_REG, 0x480);
-
-  // DC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[0][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-  // DC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[2][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-  // AC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[1][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-  // AC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[3][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-  // DC EX1
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[4][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
-  }
-
-  // AC EX1
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffMax[5][j];
-    temp = (HuffData & 0x8000) >> 15;
-    temp = (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFF) << 16) | HuffData));
+  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_ADDR_REG, maxAddr);
+  for (t = 0; t < numTab; t++) {
+    image = jpg->huffImage[tabOrder[t]];
+    for (i = 0; i < 16; i++)
+      JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, image->max[i]);
   }
 
   // PTR Tables
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x803);
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_ADDR_REG, 0x900);
-
-  // DC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[0][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  // DC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[2][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  // AC Luma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[1][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  // AC Chroma
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[3][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  // DC EX1
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[4][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-
-  // AC EX1
-  for (j = 0; j < 16; j++) {
-    HuffData = jpg->huffPtr[5][j];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
+  JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_ADDR_REG, ptrAddr);
+  for (t = 0; t < numTab; t++) {
+    image = jpg->huffImage[tabOrder[t]];
+    for (i = 0; i < 16; i++)
+      JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, image->ptr[i]);
   }
 
   // VAL Tables
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0xC03);
-
-  // VAL DC Luma
-  HuffLength = 0;
-  for (i = 0; i < 16; i++) HuffLength += jpg->huffBits[0][i];
-
-  if (HuffLength > 256) return 0;
-
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 12 row, 1 category (DC Luma)
-    HuffData = jpg->huffVal[0][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  for (i = 0; i < 16 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
-  }
-
-  // VAL DC Chroma
-  HuffLength = 0;
-  for (i = 0; i < 16; i++) HuffLength += jpg->huffBits[2][i];
-
-  if (HuffLength > 256) return 0;
-
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 12 row, 1 category (DC Chroma)
-    HuffData = jpg->huffVal[2][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  for (i = 0; i < 16 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
-  }
-
-  // VAL AC Luma
-  HuffLength = 0;
-  for (i = 0; i < 256; i++) HuffLength += jpg->huffBits[1][i];
-
-  if (HuffLength > 256) return 0;
-
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 162 row, 1 category (AC Luma)
-    HuffData = jpg->huffVal[1][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  for (i = 0; i < 256 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
-  }
-
-  // VAL AC Chroma
-  HuffLength = 0;
-  for (i = 0; i < 256; i++) HuffLength += jpg->huffBits[3][i];
-
-  if (HuffLength > 256) return 0;
-
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 162 row, 1 category (AC Chroma)
-    HuffData = jpg->huffVal[3][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  for (i = 0; i < 256 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
-  }
-
-  // VAL DC EX1
-  HuffLength = 0;
-  for (i = 0; i < 16; i++) HuffLength += jpg->huffBits[4][i];
-
-  if (HuffLength > 256) return 0;
-
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 12 row, 1 category (DC Luma)
-    HuffData = jpg->huffVal[4][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  for (i = 0; i < 16 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
-  }
-
-  // VAL AC EX1
-  HuffLength = 0;
-  for (i = 0; i < 256; i++) HuffLength += jpg->huffBits[5][i];
-
-  if (HuffLength > 256) return 0;
-
-  for (i = 0; i < HuffLength; i++) {  // 8-bit, 162 row, 1 category (AC Luma)
-    HuffData = jpg->huffVal[5][i];
-    temp = (HuffData & 0x80) >> 7;
-    temp = (temp << 23) | (temp << 22) | (temp << 21) | (temp << 20) |
-           (temp << 19) | (temp << 18) | (temp << 17) | (temp << 16) |
-           (temp << 15) | (temp << 14) | (temp << 13) | (temp << 12) |
-           (temp << 11) | (temp << 10) | (temp << 9) | (temp << 8) |
-           (temp << 7) | (temp << 6) | (temp << 5) | (temp << 4) | (temp << 3) |
-           (temp << 2) | (temp << 1) | (temp);
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG,
-                    (((temp & 0xFFFFFF) << 8) | HuffData));
-  }
-  for (i = 0; i < 256 - HuffLength; i++) {
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
+  for (t = 0; t < numTab; t++) {
+    image = jpg->huffImage[tabOrder[t]];
+    for (i = 0; i < image->valLen; i++)
+      JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, image->val[i]);
+    for (i = 0; i < image->padLen; i++)
+      JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_DATA_REG, 0xFFFFFFFF);
   }
 
   // end SerPeriHuffTab
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x000);
+  jdi_set_table_hash(devctx, JDI_TABLE_BANK_HUFF, jpg->huffImageHash);
 
   return 1;
 }
 
+int JpgDecHuffTabSetUp(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex) {
+  return JpgDecLoadHuffImage(jpg, devctx, instRegIndex, 4, 0x440, 0x880);
+}
+
+int JpgDecHuffTabSetUp_12b(JpgDecInfo *jpg, JdiDeviceCtx devctx,
+                           int instRegIndex) {
+  return JpgDecLoadHuffImage(jpg, devctx, instRegIndex, 6, 0x480, 0x900);
+}
+
 int JpgDecQMatTabSetUp(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex) {
   int i;
+  int comp;
   int table;
   int val;
+  int tag = JPG_TAB_DEC_QMAT;
+  Uint64 hash;
+  static const int qMatCtrl[3] = {0x03, 0x43, 0x83};
 
   // SetPeriQMatTab
-  // Comp 0
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, 0x03);
-  table = jpg->cInfoTab[0][3];
-
-  if (table >= 4) return 0;
-
-  for (i = 0; i < 64; i++) {
-    val = jpg->qMatTab[table][i];
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_DATA_REG, val);
-  }
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, 0x00);
-
-  // Comp 1
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, 0x43);
-  table = jpg->cInfoTab[1][3];
-  if (table >= 4) return 0;
-
-  for (i = 0; i < 64; i++) {
-    val = jpg->qMatTab[table][i];
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_DATA_REG, val);
-  }
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, 0x00);
+  for (comp = 0; comp < 3; comp++) {
+    table = jpg->cInfoTab[comp][3];
+    if (table >= 4) return 0;
 
-  // Comp 2
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, 0x83);
-  table = jpg->cInfoTab[2][3];
-  if (table >= 4) return 0;
+    hash = JpgTabHash(JpgTabHash(0, &tag, sizeof(tag)), jpg->qMatTab[table],
+                      sizeof(jpg->qMatTab[table]));
+    if (jdi_table_loaded(devctx, JDI_TABLE_BANK_QMAT0 + comp, hash)) continue;
 
-  for (i = 0; i < 64; i++) {
-    val = jpg->qMatTab[table][i];
-    JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_DATA_REG, val);
+    JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, qMatCtrl[comp]);
+    for (i = 0; i < 64; i++) {
+      val = jpg->qMatTab[table][i];
+      JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_DATA_REG, val);
+    }
+    JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, 0x00);
+    jdi_set_table_hash(devctx, JDI_TABLE_BANK_QMAT0 + comp, hash);
   }
-  JpuWriteInstReg(devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, 0x00);
 
   return 1;
 }
 
-void JpgDecGramSetup(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex) {
+int JpgDecGramSetup(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex) {
   int dExtBitBufCurPos;
   int dExtBitBufBaseAddr;
-  int dMibStatus;
+  // Pages of a ring buffer, the prefetch wraps to its start like the core.
+  int numPages = jpg->streamRingSize ? jpg->streamRingSize >> 8 : INT_MAX;
 
-  dMibStatus = 1;
   dExtBitBufCurPos = jpg->pagePtr;
   dExtBitBufBaseAddr = jpg->streamBufStartAddr;
 
@@ -1369,12 +829,14 @@ void JpgDecGramSetup(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex) {
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_BBC_COMMAND_REG,
                   (jpg->streamEndian << 1) | 0);
 
-  while (dMibStatus == 1) {
-    dMibStatus = JpuReadInstReg(devctx, instRegIndex, MJPEG_BBC_BUSY_REG);
+  if (jdi_wait_register(devctx, JPU_BUSY_CHECK_TIMEOUT_MS,
+                        instRegIndex * NPT_REG_SIZE + MJPEG_BBC_BUSY_REG, 1,
+                        0) < 0) {
+    JLOG(ERR, "%s BBC busy timeout\n", __func__);
+    return 0;
   }
 
-  dMibStatus = 1;
-  dExtBitBufCurPos = dExtBitBufCurPos + 1;
+  dExtBitBufCurPos = (dExtBitBufCurPos + 1) % numPages;
 
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_BBC_CUR_POS_REG,
                   dExtBitBufCurPos);
@@ -1387,11 +849,14 @@ void JpgDecGramSetup(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex) {
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_BBC_COMMAND_REG,
                   (jpg->streamEndian << 1) | 0);
 
-  while (dMibStatus == 1) {
-    dMibStatus = JpuReadInstReg(devctx, instRegIndex, MJPEG_BBC_BUSY_REG);
+  if (jdi_wait_register(devctx, JPU_BUSY_CHECK_TIMEOUT_MS,
+                        instRegIndex * NPT_REG_SIZE + MJPEG_BBC_BUSY_REG, 1,
+                        0) < 0) {
+    JLOG(ERR, "%s BBC busy timeout\n", __func__);
+    return 0;
   }
 
-  dExtBitBufCurPos = dExtBitBufCurPos + 1;
+  dExtBitBufCurPos = (dExtBitBufCurPos + 1) % numPages;
 
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_BBC_CUR_POS_REG,
                   dExtBitBufCurPos);  // next unit page pointer
@@ -1415,6 +880,8 @@ void JpgDecGramSetup(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex) {
   }
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_GBU_CTRL_REG, 4);
   JpuWriteInstReg(devctx, instRegIndex, MJPEG_GBU_FF_RPTR_REG, jpg->bitPtr);
+
+  return 1;
 }
 
 enum {
@@ -1607,6 +1074,340 @@ const BYTE cDefHuffVal_ES[8][256] = {
      0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb,
      0xfc, 0xfd, 0xfe, 0xff}};
 
+/* Register images of cDefHuffBits/cDefHuffVal (8-bit, padded for 12 DC and
+ * 162 AC values) and of cDefHuffBits_ES/cDefHuffVal_ES (12-bit, padded for
+ * 16 DC and 256 AC values), laid out as JpgDecPackHuffTab() builds them.
+ */
+static const JpgHuffImage cDefHuffImage[4] = {
+    {// DC index 0 (Luminance DC)
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x0000000E, 0x0000001E, 0x0000003E,
+      0x0000007E, 0x000000FE, 0x000001FE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000000, 0x00000006, 0x0000000E, 0x0000001E, 0x0000003E,
+      0x0000007E, 0x000000FE, 0x000001FE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000000, 0x00000001, 0x00000006, 0x00000007, 0x00000008,
+      0x00000009, 0x0000000A, 0x0000000B, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0x00000000, 0x00000001, 0x00000002, 0x00000003, 0x00000004, 0x00000005,
+      0x00000006, 0x00000007, 0x00000008, 0x00000009, 0x0000000A, 0x0000000B},
+     12,
+     0,
+     0},
+    {// AC index 0 (Luminance AC)
+     {0xFFFFFFFF, 0x00000000, 0x00000004, 0x0000000A, 0x0000001A, 0x0000003A,
+      0x00000078, 0x000000F8, 0x000001F6, 0x000003F6, 0x000007F6, 0x00000FF4,
+      0xFFFFFFFF, 0xFFFFFFFF, 0x00007FC0, 0xFFFFFF82},
+     {0xFFFFFFFF, 0x00000001, 0x00000004, 0x0000000C, 0x0000001C, 0x0000003B,
+      0x0000007B, 0x000000FA, 0x000001FA, 0x000003FA, 0x000007F9, 0x00000FF7,
+      0xFFFFFFFF, 0xFFFFFFFF, 0x00007FC0, 0xFFFFFFFE},
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x00000003, 0x00000006, 0x00000009,
+      0x0000000B, 0x0000000F, 0x00000012, 0x00000017, 0x0000001C, 0x00000020,
+      0xFFFFFFFF, 0xFFFFFFFF, 0x00000024, 0x00000025},
+     {0x00000001, 0x00000002, 0x00000003, 0x00000000, 0x00000004, 0x00000011,
+      0x00000005, 0x00000012, 0x00000021, 0x00000031, 0x00000041, 0x00000006,
+      0x00000013, 0x00000051, 0x00000061, 0x00000007, 0x00000022, 0x00000071,
+      0x00000014, 0x00000032, 0xFFFFFF81, 0xFFFFFF91, 0xFFFFFFA1, 0x00000008,
+      0x00000023, 0x00000042, 0xFFFFFFB1, 0xFFFFFFC1, 0x00000015, 0x00000052,
+      0xFFFFFFD1, 0xFFFFFFF0, 0x00000024, 0x00000033, 0x00000062, 0x00000072,
+      0xFFFFFF82, 0x00000009, 0x0000000A, 0x00000016, 0x00000017, 0x00000018,
+      0x00000019, 0x0000001A, 0x00000025, 0x00000026, 0x00000027, 0x00000028,
+      0x00000029, 0x0000002A, 0x00000034, 0x00000035, 0x00000036, 0x00000037,
+      0x00000038, 0x00000039, 0x0000003A, 0x00000043, 0x00000044, 0x00000045,
+      0x00000046, 0x00000047, 0x00000048, 0x00000049, 0x0000004A, 0x00000053,
+      0x00000054, 0x00000055, 0x00000056, 0x00000057, 0x00000058, 0x00000059,
+      0x0000005A, 0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067,
+      0x00000068, 0x00000069, 0x0000006A, 0x00000073, 0x00000074, 0x00000075,
+      0x00000076, 0x00000077, 0x00000078, 0x00000079, 0x0000007A, 0xFFFFFF83,
+      0xFFFFFF84, 0xFFFFFF85, 0xFFFFFF86, 0xFFFFFF87, 0xFFFFFF88, 0xFFFFFF89,
+      0xFFFFFF8A, 0xFFFFFF92, 0xFFFFFF93, 0xFFFFFF94, 0xFFFFFF95, 0xFFFFFF96,
+      0xFFFFFF97, 0xFFFFFF98, 0xFFFFFF99, 0xFFFFFF9A, 0xFFFFFFA2, 0xFFFFFFA3,
+      0xFFFFFFA4, 0xFFFFFFA5, 0xFFFFFFA6, 0xFFFFFFA7, 0xFFFFFFA8, 0xFFFFFFA9,
+      0xFFFFFFAA, 0xFFFFFFB2, 0xFFFFFFB3, 0xFFFFFFB4, 0xFFFFFFB5, 0xFFFFFFB6,
+      0xFFFFFFB7, 0xFFFFFFB8, 0xFFFFFFB9, 0xFFFFFFBA, 0xFFFFFFC2, 0xFFFFFFC3,
+      0xFFFFFFC4, 0xFFFFFFC5, 0xFFFFFFC6, 0xFFFFFFC7, 0xFFFFFFC8, 0xFFFFFFC9,
+      0xFFFFFFCA, 0xFFFFFFD2, 0xFFFFFFD3, 0xFFFFFFD4, 0xFFFFFFD5, 0xFFFFFFD6,
+      0xFFFFFFD7, 0xFFFFFFD8, 0xFFFFFFD9, 0xFFFFFFDA, 0xFFFFFFE1, 0xFFFFFFE2,
+      0xFFFFFFE3, 0xFFFFFFE4, 0xFFFFFFE5, 0xFFFFFFE6, 0xFFFFFFE7, 0xFFFFFFE8,
+      0xFFFFFFE9, 0xFFFFFFEA, 0xFFFFFFF1, 0xFFFFFFF2, 0xFFFFFFF3, 0xFFFFFFF4,
+      0xFFFFFFF5, 0xFFFFFFF6, 0xFFFFFFF7, 0xFFFFFFF8, 0xFFFFFFF9, 0xFFFFFFFA},
+     162,
+     0,
+     0},
+    {// DC index 1 (Chrominance DC)
+     {0xFFFFFFFF, 0x00000000, 0x00000006, 0x0000000E, 0x0000001E, 0x0000003E,
+      0x0000007E, 0x000000FE, 0x000001FE, 0x000003FE, 0x000007FE, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000002, 0x00000006, 0x0000000E, 0x0000001E, 0x0000003E,
+      0x0000007E, 0x000000FE, 0x000001FE, 0x000003FE, 0x000007FE, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000000, 0x00000003, 0x00000004, 0x00000005, 0x00000006,
+      0x00000007, 0x00000008, 0x00000009, 0x0000000A, 0x0000000B, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0x00000000, 0x00000001, 0x00000002, 0x00000003, 0x00000004, 0x00000005,
+      0x00000006, 0x00000007, 0x00000008, 0x00000009, 0x0000000A, 0x0000000B},
+     12,
+     0,
+     0},
+    {// AC index 1 (Chrominance AC)
+     {0xFFFFFFFF, 0x00000000, 0x00000004, 0x0000000A, 0x00000018, 0x00000038,
+      0x00000078, 0x000000F6, 0x000001F4, 0x000003F6, 0x000007F6, 0x00000FF4,
+      0xFFFFFFFF, 0x00003FE0, 0x00007FC2, 0xFFFFFF88},
+     {0xFFFFFFFF, 0x00000001, 0x00000004, 0x0000000B, 0x0000001B, 0x0000003B,
+      0x0000007A, 0x000000F9, 0x000001FA, 0x000003FA, 0x000007F9, 0x00000FF7,
+      0xFFFFFFFF, 0x00003FE0, 0x00007FC3, 0xFFFFFFFE},
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x00000003, 0x00000005, 0x00000009,
+      0x0000000D, 0x00000010, 0x00000014, 0x0000001B, 0x00000020, 0x00000024,
+      0xFFFFFFFF, 0x00000028, 0x00000029, 0x0000002B},
+     {0x00000000, 0x00000001, 0x00000002, 0x00000003, 0x00000011, 0x00000004,
+      0x00000005, 0x00000021, 0x00000031, 0x00000006, 0x00000012, 0x00000041,
+      0x00000051, 0x00000007, 0x00000061, 0x00000071, 0x00000013, 0x00000022,
+      0x00000032, 0xFFFFFF81, 0x00000008, 0x00000014, 0x00000042, 0xFFFFFF91,
+      0xFFFFFFA1, 0xFFFFFFB1, 0xFFFFFFC1, 0x00000009, 0x00000023, 0x00000033,
+      0x00000052, 0xFFFFFFF0, 0x00000015, 0x00000062, 0x00000072, 0xFFFFFFD1,
+      0x0000000A, 0x00000016, 0x00000024, 0x00000034, 0xFFFFFFE1, 0x00000025,
+      0xFFFFFFF1, 0x00000017, 0x00000018, 0x00000019, 0x0000001A, 0x00000026,
+      0x00000027, 0x00000028, 0x00000029, 0x0000002A, 0x00000035, 0x00000036,
+      0x00000037, 0x00000038, 0x00000039, 0x0000003A, 0x00000043, 0x00000044,
+      0x00000045, 0x00000046, 0x00000047, 0x00000048, 0x00000049, 0x0000004A,
+      0x00000053, 0x00000054, 0x00000055, 0x00000056, 0x00000057, 0x00000058,
+      0x00000059, 0x0000005A, 0x00000063, 0x00000064, 0x00000065, 0x00000066,
+      0x00000067, 0x00000068, 0x00000069, 0x0000006A, 0x00000073, 0x00000074,
+      0x00000075, 0x00000076, 0x00000077, 0x00000078, 0x00000079, 0x0000007A,
+      0xFFFFFF82, 0xFFFFFF83, 0xFFFFFF84, 0xFFFFFF85, 0xFFFFFF86, 0xFFFFFF87,
+      0xFFFFFF88, 0xFFFFFF89, 0xFFFFFF8A, 0xFFFFFF92, 0xFFFFFF93, 0xFFFFFF94,
+      0xFFFFFF95, 0xFFFFFF96, 0xFFFFFF97, 0xFFFFFF98, 0xFFFFFF99, 0xFFFFFF9A,
+      0xFFFFFFA2, 0xFFFFFFA3, 0xFFFFFFA4, 0xFFFFFFA5, 0xFFFFFFA6, 0xFFFFFFA7,
+      0xFFFFFFA8, 0xFFFFFFA9, 0xFFFFFFAA, 0xFFFFFFB2, 0xFFFFFFB3, 0xFFFFFFB4,
+      0xFFFFFFB5, 0xFFFFFFB6, 0xFFFFFFB7, 0xFFFFFFB8, 0xFFFFFFB9, 0xFFFFFFBA,
+      0xFFFFFFC2, 0xFFFFFFC3, 0xFFFFFFC4, 0xFFFFFFC5, 0xFFFFFFC6, 0xFFFFFFC7,
+      0xFFFFFFC8, 0xFFFFFFC9, 0xFFFFFFCA, 0xFFFFFFD2, 0xFFFFFFD3, 0xFFFFFFD4,
+      0xFFFFFFD5, 0xFFFFFFD6, 0xFFFFFFD7, 0xFFFFFFD8, 0xFFFFFFD9, 0xFFFFFFDA,
+      0xFFFFFFE2, 0xFFFFFFE3, 0xFFFFFFE4, 0xFFFFFFE5, 0xFFFFFFE6, 0xFFFFFFE7,
+      0xFFFFFFE8, 0xFFFFFFE9, 0xFFFFFFEA, 0xFFFFFFF2, 0xFFFFFFF3, 0xFFFFFFF4,
+      0xFFFFFFF5, 0xFFFFFFF6, 0xFFFFFFF7, 0xFFFFFFF8, 0xFFFFFFF9, 0xFFFFFFFA},
+     162,
+     0,
+     0}};
+
+static const JpgHuffImage cDefHuffImage_ES[6] = {
+    {// DC index 0 (Luminance DC)
+     {0xFFFFFFFF, 0x00000000, 0x00000004, 0x0000000E, 0xFFFFFFFF, 0x0000003C,
+      0x0000007E, 0x000000FE, 0x000001FE, 0x000003FE, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000001, 0x00000006, 0x0000000E, 0xFFFFFFFF, 0x0000003E,
+      0x0000007E, 0x000000FE, 0x000001FE, 0x000003FE, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x00000005, 0xFFFFFFFF, 0x00000006,
+      0x00000009, 0x0000000A, 0x0000000B, 0x0000000C, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0x00000008, 0x00000009, 0x00000006, 0x00000007, 0x0000000A, 0x00000005,
+      0x00000003, 0x00000004, 0x0000000B, 0x00000002, 0x00000000, 0x00000001,
+      0x0000000C},
+     13,
+     3,
+     0},
+    {// AC index 0 (Luminance AC)
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x0000000C, 0x0000001C, 0x0000003C,
+      0x0000007C, 0x000000FA, 0x000001FC, 0x000003FA, 0xFFFFFFFF, 0x00000FF0,
+      0xFFFFFFFF, 0x00003FC4, 0xFFFFFFFF, 0xFFFFFF14},
+     {0xFFFFFFFF, 0x00000000, 0x00000005, 0x0000000D, 0x0000001D, 0x0000003D,
+      0x0000007C, 0x000000FD, 0x000001FC, 0x000003FB, 0xFFFFFFFF, 0x00000FF0,
+      0xFFFFFFFF, 0x00003FC4, 0xFFFFFFFF, 0xFFFFFFFE},
+     {0xFFFFFFFF, 0x00000000, 0x00000001, 0x00000005, 0x00000007, 0x00000009,
+      0x0000000B, 0x0000000C, 0x00000010, 0x00000011, 0xFFFFFFFF, 0x00000013,
+      0xFFFFFFFF, 0x00000014, 0xFFFFFFFF, 0x00000015},
+     {0x00000002, 0x00000001, 0x00000003, 0x00000004, 0x00000005, 0x00000006,
+      0x00000007, 0x00000008, 0x00000012, 0x00000009, 0x00000011, 0x00000013,
+      0x00000000, 0x00000014, 0x00000021, 0x00000022, 0x00000015, 0x0000000A,
+      0x00000023, 0x00000031, 0x00000016, 0x00000032, 0x00000017, 0x00000024,
+      0x00000033, 0x00000041, 0x00000018, 0x00000025, 0x00000042, 0x00000051,
+      0x0000000B, 0x00000026, 0x00000019, 0x00000043, 0x00000052, 0x00000061,
+      0x00000035, 0x00000062, 0x00000071, 0x0000000C, 0x0000000D, 0x0000000E,
+      0x0000000F, 0x00000010, 0x0000001A, 0x0000001B, 0x0000001C, 0x0000001D,
+      0x0000001E, 0x0000001F, 0x00000020, 0x00000027, 0x00000028, 0x00000029,
+      0x0000002A, 0x0000002B, 0x0000002C, 0x0000002D, 0x0000002E, 0x0000002F,
+      0x00000030, 0x00000034, 0x00000036, 0x00000037, 0x00000038, 0x00000039,
+      0x0000003A, 0x0000003B, 0x0000003C, 0x0000003D, 0x0000003E, 0x0000003F,
+      0x00000040, 0x00000044, 0x00000045, 0x00000046, 0x00000047, 0x00000048,
+      0x00000049, 0x0000004A, 0x0000004B, 0x0000004C, 0x0000004D, 0x0000004E,
+      0x0000004F, 0x00000050, 0x00000053, 0x00000054, 0x00000055, 0x00000056,
+      0x00000057, 0x00000058, 0x00000059, 0x0000005A, 0x0000005B, 0x0000005C,
+      0x0000005D, 0x0000005E, 0x0000005F, 0x00000060, 0x00000063, 0x00000064,
+      0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006A,
+      0x0000006B, 0x0000006C, 0x0000006D, 0x0000006E, 0x0000006F, 0x00000070,
+      0x00000072, 0x00000073, 0x00000074, 0x00000075, 0x00000076, 0x00000077,
+      0x00000078, 0x00000079, 0x0000007A, 0x0000007B, 0x0000007C, 0x0000007D,
+      0x0000007E, 0x0000007F, 0xFFFFFF80, 0xFFFFFF81, 0xFFFFFF82, 0xFFFFFF83,
+      0xFFFFFF84, 0xFFFFFF85, 0xFFFFFF86, 0xFFFFFF87, 0xFFFFFF88, 0xFFFFFF89,
+      0xFFFFFF8A, 0xFFFFFF8B, 0xFFFFFF8C, 0xFFFFFF8D, 0xFFFFFF8E, 0xFFFFFF8F,
+      0xFFFFFF90, 0xFFFFFF91, 0xFFFFFF92, 0xFFFFFF93, 0xFFFFFF94, 0xFFFFFF95,
+      0xFFFFFF96, 0xFFFFFF97, 0xFFFFFF98, 0xFFFFFF99, 0xFFFFFF9A, 0xFFFFFF9B,
+      0xFFFFFF9C, 0xFFFFFF9D, 0xFFFFFF9E, 0xFFFFFF9F, 0xFFFFFFA0, 0xFFFFFFA1,
+      0xFFFFFFA2, 0xFFFFFFA3, 0xFFFFFFA4, 0xFFFFFFA5, 0xFFFFFFA6, 0xFFFFFFA7,
+      0xFFFFFFA8, 0xFFFFFFA9, 0xFFFFFFAA, 0xFFFFFFAB, 0xFFFFFFAC, 0xFFFFFFAD,
+      0xFFFFFFAE, 0xFFFFFFAF, 0xFFFFFFB0, 0xFFFFFFB1, 0xFFFFFFB2, 0xFFFFFFB3,
+      0xFFFFFFB4, 0xFFFFFFB5, 0xFFFFFFB6, 0xFFFFFFB7, 0xFFFFFFB8, 0xFFFFFFB9,
+      0xFFFFFFBA, 0xFFFFFFBB, 0xFFFFFFBC, 0xFFFFFFBD, 0xFFFFFFBE, 0xFFFFFFBF,
+      0xFFFFFFC0, 0xFFFFFFC1, 0xFFFFFFC2, 0xFFFFFFC3, 0xFFFFFFC4, 0xFFFFFFC5,
+      0xFFFFFFC6, 0xFFFFFFC7, 0xFFFFFFC8, 0xFFFFFFC9, 0xFFFFFFCA, 0xFFFFFFCB,
+      0xFFFFFFCC, 0xFFFFFFCD, 0xFFFFFFCE, 0xFFFFFFCF, 0xFFFFFFD0, 0xFFFFFFD1,
+      0xFFFFFFD2, 0xFFFFFFD3, 0xFFFFFFD4, 0xFFFFFFD5, 0xFFFFFFD6, 0xFFFFFFD7,
+      0xFFFFFFD8, 0xFFFFFFD9, 0xFFFFFFDA, 0xFFFFFFDB, 0xFFFFFFDC, 0xFFFFFFDD,
+      0xFFFFFFDE, 0xFFFFFFDF, 0xFFFFFFE0, 0xFFFFFFE1, 0xFFFFFFE2, 0xFFFFFFE3,
+      0xFFFFFFE4, 0xFFFFFFE5, 0xFFFFFFE6, 0xFFFFFFE7, 0xFFFFFFE8, 0xFFFFFFE9,
+      0xFFFFFFEA, 0xFFFFFFEB, 0xFFFFFFEC, 0xFFFFFFED, 0xFFFFFFEE, 0xFFFFFFEF,
+      0xFFFFFFF0, 0xFFFFFFF1, 0xFFFFFFF2, 0xFFFFFFF3, 0xFFFFFFF4, 0xFFFFFFF5,
+      0xFFFFFFF6, 0xFFFFFFF7, 0xFFFFFFF8, 0xFFFFFFF9, 0xFFFFFFFA, 0xFFFFFFFB,
+      0xFFFFFFFC, 0xFFFFFFFD, 0xFFFFFFFE, 0xFFFFFFFF},
+     256,
+     0,
+     0},
+    {// DC index 1 (Chrominance DC)
+     {0xFFFFFFFF, 0x00000000, 0x00000004, 0x0000000C, 0x0000001C, 0x0000003E,
+      0x0000007E, 0x000000FE, 0x000001FE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000001, 0x00000005, 0x0000000D, 0x0000001E, 0x0000003E,
+      0x0000007E, 0x000000FE, 0x000001FE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x00000004, 0x00000006, 0x00000009,
+      0x0000000A, 0x0000000B, 0x0000000C, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0x00000006, 0x00000007, 0x00000005, 0x00000008, 0x00000004, 0x00000009,
+      0x00000002, 0x00000003, 0x0000000A, 0x00000001, 0x0000000B, 0x00000000,
+      0x0000000C},
+     13,
+     3,
+     0},
+    {// AC index 1 (Chrominance AC)
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x0000000A, 0x00000018, 0x0000003A,
+      0x00000076, 0x000000F6, 0x000001F6, 0x000003F2, 0x000007F2, 0x00000FEC,
+      0x00001FE0, 0x00003FC6, 0x00007F94, 0xFFFFFF34},
+     {0xFFFFFFFF, 0x00000000, 0x00000004, 0x0000000B, 0x0000001C, 0x0000003A,
+      0x0000007A, 0x000000FA, 0x000001F8, 0x000003F8, 0x000007F5, 0x00000FEF,
+      0x00001FE2, 0x00003FC9, 0x00007F99, 0xFFFFFFFE},
+     {0xFFFFFFFF, 0x00000000, 0x00000001, 0x00000004, 0x00000006, 0x0000000B,
+      0x0000000C, 0x00000011, 0x00000016, 0x00000019, 0x00000020, 0x00000024,
+      0x00000028, 0x0000002B, 0x0000002F, 0x00000035},
+     {0x00000001, 0x00000002, 0x00000003, 0x00000011, 0x00000004, 0x00000021,
+      0x00000000, 0x00000005, 0x00000006, 0x00000012, 0x00000031, 0x00000041,
+      0x00000007, 0x00000013, 0x00000022, 0x00000051, 0x00000061, 0x00000008,
+      0x00000014, 0x00000032, 0x00000071, 0xFFFFFF81, 0x00000042, 0xFFFFFF91,
+      0xFFFFFFA1, 0x00000009, 0x00000015, 0x00000023, 0x00000052, 0xFFFFFFB1,
+      0xFFFFFFC1, 0xFFFFFFF0, 0x00000016, 0x00000062, 0xFFFFFFD1, 0xFFFFFFE1,
+      0x0000000A, 0x00000024, 0x00000072, 0xFFFFFFF1, 0x00000017, 0xFFFFFF82,
+      0xFFFFFF92, 0x00000033, 0x00000043, 0x00000053, 0xFFFFFFB2, 0x0000000B,
+      0x0000000C, 0x00000018, 0x00000035, 0xFFFFFFA2, 0xFFFFFFC2, 0x0000000D,
+      0x0000000E, 0x0000000F, 0x00000010, 0x00000019, 0x0000001A, 0x0000001B,
+      0x0000001C, 0x0000001D, 0x0000001E, 0x0000001F, 0x00000020, 0x00000025,
+      0x00000026, 0x00000027, 0x00000028, 0x00000029, 0x0000002A, 0x0000002B,
+      0x0000002C, 0x0000002D, 0x0000002E, 0x0000002F, 0x00000030, 0x00000034,
+      0x00000036, 0x00000037, 0x00000038, 0x00000039, 0x0000003A, 0x0000003B,
+      0x0000003C, 0x0000003D, 0x0000003E, 0x0000003F, 0x00000040, 0x00000044,
+      0x00000045, 0x00000046, 0x00000047, 0x00000048, 0x00000049, 0x0000004A,
+      0x0000004B, 0x0000004C, 0x0000004D, 0x0000004E, 0x0000004F, 0x00000050,
+      0x00000054, 0x00000055, 0x00000056, 0x00000057, 0x00000058, 0x00000059,
+      0x0000005A, 0x0000005B, 0x0000005C, 0x0000005D, 0x0000005E, 0x0000005F,
+      0x00000060, 0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067,
+      0x00000068, 0x00000069, 0x0000006A, 0x0000006B, 0x0000006C, 0x0000006D,
+      0x0000006E, 0x0000006F, 0x00000070, 0x00000073, 0x00000074, 0x00000075,
+      0x00000076, 0x00000077, 0x00000078, 0x00000079, 0x0000007A, 0x0000007B,
+      0x0000007C, 0x0000007D, 0x0000007E, 0x0000007F, 0xFFFFFF80, 0xFFFFFF83,
+      0xFFFFFF84, 0xFFFFFF85, 0xFFFFFF86, 0xFFFFFF87, 0xFFFFFF88, 0xFFFFFF89,
+      0xFFFFFF8A, 0xFFFFFF8B, 0xFFFFFF8C, 0xFFFFFF8D, 0xFFFFFF8E, 0xFFFFFF8F,
+      0xFFFFFF90, 0xFFFFFF93, 0xFFFFFF94, 0xFFFFFF95, 0xFFFFFF96, 0xFFFFFF97,
+      0xFFFFFF98, 0xFFFFFF99, 0xFFFFFF9A, 0xFFFFFF9B, 0xFFFFFF9C, 0xFFFFFF9D,
+      0xFFFFFF9E, 0xFFFFFF9F, 0xFFFFFFA0, 0xFFFFFFA3, 0xFFFFFFA4, 0xFFFFFFA5,
+      0xFFFFFFA6, 0xFFFFFFA7, 0xFFFFFFA8, 0xFFFFFFA9, 0xFFFFFFAA, 0xFFFFFFAB,
+      0xFFFFFFAC, 0xFFFFFFAD, 0xFFFFFFAE, 0xFFFFFFAF, 0xFFFFFFB0, 0xFFFFFFB3,
+      0xFFFFFFB4, 0xFFFFFFB5, 0xFFFFFFB6, 0xFFFFFFB7, 0xFFFFFFB8, 0xFFFFFFB9,
+      0xFFFFFFBA, 0xFFFFFFBB, 0xFFFFFFBC, 0xFFFFFFBD, 0xFFFFFFBE, 0xFFFFFFBF,
+      0xFFFFFFC0, 0xFFFFFFC3, 0xFFFFFFC4, 0xFFFFFFC5, 0xFFFFFFC6, 0xFFFFFFC7,
+      0xFFFFFFC8, 0xFFFFFFC9, 0xFFFFFFCA, 0xFFFFFFCB, 0xFFFFFFCC, 0xFFFFFFCD,
+      0xFFFFFFCE, 0xFFFFFFCF, 0xFFFFFFD0, 0xFFFFFFD2, 0xFFFFFFD3, 0xFFFFFFD4,
+      0xFFFFFFD5, 0xFFFFFFD6, 0xFFFFFFD7, 0xFFFFFFD8, 0xFFFFFFD9, 0xFFFFFFDA,
+      0xFFFFFFDB, 0xFFFFFFDC, 0xFFFFFFDD, 0xFFFFFFDE, 0xFFFFFFDF, 0xFFFFFFE0,
+      0xFFFFFFE2, 0xFFFFFFE3, 0xFFFFFFE4, 0xFFFFFFE5, 0xFFFFFFE6, 0xFFFFFFE7,
+      0xFFFFFFE8, 0xFFFFFFE9, 0xFFFFFFEA, 0xFFFFFFEB, 0xFFFFFFEC, 0xFFFFFFED,
+      0xFFFFFFEE, 0xFFFFFFEF, 0xFFFFFFF2, 0xFFFFFFF3, 0xFFFFFFF4, 0xFFFFFFF5,
+      0xFFFFFFF6, 0xFFFFFFF7, 0xFFFFFFF8, 0xFFFFFFF9, 0xFFFFFFFA, 0xFFFFFFFB,
+      0xFFFFFFFC, 0xFFFFFFFD, 0xFFFFFFFE, 0xFFFFFFFF},
+     256,
+     0,
+     0},
+    {// DC EX1 (Luminance DC)
+     {0xFFFFFFFF, 0x00000000, 0x00000004, 0x0000000E, 0xFFFFFFFF, 0x0000003C,
+      0x0000007E, 0x000000FE, 0x000001FE, 0x000003FE, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000001, 0x00000006, 0x0000000E, 0xFFFFFFFF, 0x0000003E,
+      0x0000007E, 0x000000FE, 0x000001FE, 0x000003FE, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x00000005, 0xFFFFFFFF, 0x00000006,
+      0x00000009, 0x0000000A, 0x0000000B, 0x0000000C, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+     {0x00000008, 0x00000009, 0x00000006, 0x00000007, 0x0000000A, 0x00000005,
+      0x00000003, 0x00000004, 0x0000000B, 0x00000002, 0x00000000, 0x00000001,
+      0x0000000C},
+     13,
+     3,
+     0},
+    {// AC EX1 (Luminance AC)
+     {0xFFFFFFFF, 0x00000000, 0x00000002, 0x0000000C, 0x0000001C, 0x0000003C,
+      0x0000007C, 0x000000FA, 0x000001FC, 0x000003FA, 0xFFFFFFFF, 0x00000FF0,
+      0xFFFFFFFF, 0x00003FC4, 0xFFFFFFFF, 0xFFFFFF14},
+     {0xFFFFFFFF, 0x00000000, 0x00000005, 0x0000000D, 0x0000001D, 0x0000003D,
+      0x0000007C, 0x000000FD, 0x000001FC, 0x000003FB, 0xFFFFFFFF, 0x00000FF0,
+      0xFFFFFFFF, 0x00003FC4, 0xFFFFFFFF, 0xFFFFFFFE},
+     {0xFFFFFFFF, 0x00000000, 0x00000001, 0x00000005, 0x00000007, 0x00000009,
+      0x0000000B, 0x0000000C, 0x00000010, 0x00000011, 0xFFFFFFFF, 0x00000013,
+      0xFFFFFFFF, 0x00000014, 0xFFFFFFFF, 0x00000015},
+     {0x00000002, 0x00000001, 0x00000003, 0x00000004, 0x00000005, 0x00000006,
+      0x00000007, 0x00000008, 0x00000012, 0x00000009, 0x00000011, 0x00000013,
+      0x00000000, 0x00000014, 0x00000021, 0x00000022, 0x00000015, 0x0000000A,
+      0x00000023, 0x00000031, 0x00000016, 0x00000032, 0x00000017, 0x00000024,
+      0x00000033, 0x00000041, 0x00000018, 0x00000025, 0x00000042, 0x00000051,
+      0x0000000B, 0x00000026, 0x00000019, 0x00000043, 0x00000052, 0x00000061,
+      0x00000035, 0x00000062, 0x00000071, 0x0000000C, 0x0000000D, 0x0000000E,
+      0x0000000F, 0x00000010, 0x0000001A, 0x0000001B, 0x0000001C, 0x0000001D,
+      0x0000001E, 0x0000001F, 0x00000020, 0x00000027, 0x00000028, 0x00000029,
+      0x0000002A, 0x0000002B, 0x0000002C, 0x0000002D, 0x0000002E, 0x0000002F,
+      0x00000030, 0x00000034, 0x00000036, 0x00000037, 0x00000038, 0x00000039,
+      0x0000003A, 0x0000003B, 0x0000003C, 0x0000003D, 0x0000003E, 0x0000003F,
+      0x00000040, 0x00000044, 0x00000045, 0x00000046, 0x00000047, 0x00000048,
+      0x00000049, 0x0000004A, 0x0000004B, 0x0000004C, 0x0000004D, 0x0000004E,
+      0x0000004F, 0x00000050, 0x00000053, 0x00000054, 0x00000055, 0x00000056,
+      0x00000057, 0x00000058, 0x00000059, 0x0000005A, 0x0000005B, 0x0000005C,
+      0x0000005D, 0x0000005E, 0x0000005F, 0x00000060, 0x00000063, 0x00000064,
+      0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006A,
+      0x0000006B, 0x0000006C, 0x0000006D, 0x0000006E, 0x0000006F, 0x00000070,
+      0x00000072, 0x00000073, 0x00000074, 0x00000075, 0x00000076, 0x00000077,
+      0x00000078, 0x00000079, 0x0000007A, 0x0000007B, 0x0000007C, 0x0000007D,
+      0x0000007E, 0x0000007F, 0xFFFFFF80, 0xFFFFFF81, 0xFFFFFF82, 0xFFFFFF83,
+      0xFFFFFF84, 0xFFFFFF85, 0xFFFFFF86, 0xFFFFFF87, 0xFFFFFF88, 0xFFFFFF89,
+      0xFFFFFF8A, 0xFFFFFF8B, 0xFFFFFF8C, 0xFFFFFF8D, 0xFFFFFF8E, 0xFFFFFF8F,
+      0xFFFFFF90, 0xFFFFFF91, 0xFFFFFF92, 0xFFFFFF93, 0xFFFFFF94, 0xFFFFFF95,
+      0xFFFFFF96, 0xFFFFFF97, 0xFFFFFF98, 0xFFFFFF99, 0xFFFFFF9A, 0xFFFFFF9B,
+      0xFFFFFF9C, 0xFFFFFF9D, 0xFFFFFF9E, 0xFFFFFF9F, 0xFFFFFFA0, 0xFFFFFFA1,
+      0xFFFFFFA2, 0xFFFFFFA3, 0xFFFFFFA4, 0xFFFFFFA5, 0xFFFFFFA6, 0xFFFFFFA7,
+      0xFFFFFFA8, 0xFFFFFFA9, 0xFFFFFFAA, 0xFFFFFFAB, 0xFFFFFFAC, 0xFFFFFFAD,
+      0xFFFFFFAE, 0xFFFFFFAF, 0xFFFFFFB0, 0xFFFFFFB1, 0xFFFFFFB2, 0xFFFFFFB3,
+      0xFFFFFFB4, 0xFFFFFFB5, 0xFFFFFFB6, 0xFFFFFFB7, 0xFFFFFFB8, 0xFFFFFFB9,
+      0xFFFFFFBA, 0xFFFFFFBB, 0xFFFFFFBC, 0xFFFFFFBD, 0xFFFFFFBE, 0xFFFFFFBF,
+      0xFFFFFFC0, 0xFFFFFFC1, 0xFFFFFFC2, 0xFFFFFFC3, 0xFFFFFFC4, 0xFFFFFFC5,
+      0xFFFFFFC6, 0xFFFFFFC7, 0xFFFFFFC8, 0xFFFFFFC9, 0xFFFFFFCA, 0xFFFFFFCB,
+      0xFFFFFFCC, 0xFFFFFFCD, 0xFFFFFFCE, 0xFFFFFFCF, 0xFFFFFFD0, 0xFFFFFFD1,
+      0xFFFFFFD2, 0xFFFFFFD3, 0xFFFFFFD4, 0xFFFFFFD5, 0xFFFFFFD6, 0xFFFFFFD7,
+      0xFFFFFFD8, 0xFFFFFFD9, 0xFFFFFFDA, 0xFFFFFFDB, 0xFFFFFFDC, 0xFFFFFFDD,
+      0xFFFFFFDE, 0xFFFFFFDF, 0xFFFFFFE0, 0xFFFFFFE1, 0xFFFFFFE2, 0xFFFFFFE3,
+      0xFFFFFFE4, 0xFFFFFFE5, 0xFFFFFFE6, 0xFFFFFFE7, 0xFFFFFFE8, 0xFFFFFFE9,
+      0xFFFFFFEA, 0xFFFFFFEB, 0xFFFFFFEC, 0xFFFFFFED, 0xFFFFFFEE, 0xFFFFFFEF,
+      0xFFFFFFF0, 0xFFFFFFF1, 0xFFFFFFF2, 0xFFFFFFF3, 0xFFFFFFF4, 0xFFFFFFF5,
+      0xFFFFFFF6, 0xFFFFFFF7, 0xFFFFFFF8, 0xFFFFFFF9, 0xFFFFFFFA, 0xFFFFFFFB,
+      0xFFFFFFFC, 0xFFFFFFFD, 0xFFFFFFFE, 0xFFFFFFFF},
+     256,
+     0,
+     0}};
+
 enum {
   Marker = 0xFF,
   FF_Marker = 0x00,
@@ -1689,6 +1490,75 @@ int decode_app_header(JpgDecInfo *jpg) {
   return 1;
 }
 
+static Uint32 exif_get(const BYTE *p, int bytes, int bigEndian) {
+  Uint32 v = 0;
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    v |= (Uint32)p[bigEndian ? i : bytes - 1 - i] << (8 * (bytes - 1 - i));
+  return v;
+}
+
+/* Looks up the JPEGInterchangeFormat tags of IFD1 in the length bytes of
+ * TIFF data of an EXIF segment. IFD0 is only read for the offset of IFD1.
+ */
+static void exif_find_thumbnail(JpgDecInfo *jpg, const BYTE *tiff,
+                                Uint32 length) {
+  Uint32 ifd, entries, tag, offset = 0, size = 0, i;
+  int bigEndian;
+
+  if (tiff[0] == 'M' && tiff[1] == 'M')
+    bigEndian = 1;
+  else if (tiff[0] == 'I' && tiff[1] == 'I')
+    bigEndian = 0;
+  else
+    return;
+  if (exif_get(tiff + 2, 2, bigEndian) != 42) return;
+
+  // Segments are under 64KB, so none of the sums below can overflow.
+  ifd = exif_get(tiff + 4, 4, bigEndian);
+  if (ifd > length || length - ifd < 2) return;
+  entries = exif_get(tiff + ifd, 2, bigEndian);
+  if (ifd + 2 + entries * 12 + 4 > length) return;
+  ifd = exif_get(tiff + ifd + 2 + entries * 12, 4, bigEndian);
+  if (ifd == 0 || ifd > length || length - ifd < 2) return;
+  entries = exif_get(tiff + ifd, 2, bigEndian);
+  if (ifd + 2 + entries * 12 > length) return;
+
+  for (i = 0; i < entries; i++) {
+    const BYTE *entry = tiff + ifd + 2 + i * 12;
+    tag = exif_get(entry, 2, bigEndian);
+    if (tag == 0x0201)  // JPEGInterchangeFormat
+      offset = exif_get(entry + 8, 4, bigEndian);
+    else if (tag == 0x0202)  // JPEGInterchangeFormatLength
+      size = exif_get(entry + 8, 4, bigEndian);
+  }
+  if (size < 4 || offset > length || size > length - offset ||
+      tiff[offset] != 0xFF || tiff[offset + 1] != 0xD8)
+    return;
+
+  jpg->thumbOffset = (Uint32)(tiff + offset - jpg->pBitStream);
+  jpg->thumbSize = size;
+}
+
+/* APP1. Notes where the JPEG thumbnail of an EXIF segment is, then skips the
+ * segment like any other APPn.
+ */
+int decode_exif_header(JpgDecInfo *jpg) {
+  const BYTE *seg;
+  Uint32 length;
+
+  if (get_bits_left(&jpg->gbc) < 16) return 0;
+  seg = jpg->gbc.buffer + get_bits_count(&jpg->gbc) / 8;
+  length = (seg[0] << 8) | seg[1];
+  // Length, "Exif\0\0" and the 8 byte TIFF header.
+  if (length >= 2 + 6 + 8 && get_bits_left(&jpg->gbc) >= (int)length * 8 &&
+      memcmp(seg + 2, "Exif\0\0", 6) == 0)
+    exif_find_thumbnail(jpg, seg + 8, length - 8);
+
+  return decode_app_header(jpg);
+}
+
 int decode_dri_header(JpgDecInfo *jpg) {
   // Length, Lr
   if (get_bits_left(&jpg->gbc) < 16 * 2) return 0;
@@ -1917,6 +1787,9 @@ int decode_sos_header(JpgDecInfo *jpg) {
   jpg->ecsPtr = get_bits_count(&jpg->gbc) / 8 + len - 2;
 
   ecsPtr = jpg->ecsPtr + jpg->frameOffset;
+  // A scan wrapping in a ring buffer starts near the ring start. Rings are
+  // whole pages, so the parity of pagePtr stays the same.
+  if (jpg->streamRingSize) ecsPtr %= jpg->streamRingSize;
 
   // printf("ecsPtr=0x%x frameOffset=0x%x, ecsOffset=0x%x, wrPtr=0x%x,
   // rdPtr0x%x\n", jpg->ecsPtr, jpg->frameOffset, ecsPtr, jpg->streamWrPtr,
@@ -1973,6 +1846,60 @@ int decode_sos_header(JpgDecInfo *jpg) {
   return 1;
 }
 
+// Sign extension the core expects in the upper bits of MJPEG_HUFF_DATA_REG.
+#define HUFF_DATA16(v) ((((v)&0x8000) ? 0xFFFF0000 : 0) | (v))
+#define HUFF_DATA8(v) ((((v)&0x80) ? 0xFFFFFF00 : 0) | (v))
+
+static void JpgDecPackHuffTab(JpgDecInfo *jpg, int tabNum, Uint32 valPad) {
+  JpgHuffImage *image = &jpg->huffImageBuf[tabNum];
+  Uint32 i;
+
+  for (i = 0; i < 16; i++) {
+    image->min[i] = HUFF_DATA16(jpg->huffMin[tabNum][i]);
+    image->max[i] = HUFF_DATA16(jpg->huffMax[tabNum][i]);
+    image->ptr[i] = HUFF_DATA8(jpg->huffPtr[tabNum][i]);
+  }
+
+  image->valLen = 0;
+  for (i = 0; i < valPad && i < 16; i++)
+    image->valLen += jpg->huffBits[tabNum][i];
+  image->padLen = 0;
+  if (image->valLen <= 256) {
+    for (i = 0; i < image->valLen; i++)
+      image->val[i] = HUFF_DATA8(jpg->huffVal[tabNum][i]);
+    if (image->valLen < valPad) image->padLen = valPad - image->valLen;
+  }
+
+  image->key = JpgTabHash(0, image, offsetof(JpgHuffImage, val));
+  image->key = JpgTabHash(image->key, &image->valLen, sizeof(image->valLen));
+  if (image->valLen <= 256)
+    image->key = JpgTabHash(image->key, image->val,
+                            image->valLen * sizeof(image->val[0]));
+  jpg->huffImage[tabNum] = image;
+}
+
+static const JpgHuffImage *JpgDecDefHuffImage(JpgDecInfo *jpg, int tabNum) {
+  const JpgHuffImage *image;
+  const BYTE *bits, *val;
+
+  if (jpg->jpg12bit) {
+    if (tabNum >= 6) return NULL;
+    image = &cDefHuffImage_ES[tabNum];
+    bits = cDefHuffBits_ES[tabNum];
+    val = cDefHuffVal_ES[tabNum];
+  } else {
+    if (tabNum >= 4) return NULL;
+    image = &cDefHuffImage[tabNum];
+    bits = cDefHuffBits[tabNum];
+    val = cDefHuffVal[tabNum];
+  }
+
+  if (memcmp(jpg->huffBits[tabNum], bits, 16) ||
+      memcmp(jpg->huffVal[tabNum], val, image->valLen))
+    return NULL;
+  return image;
+}
+
 static void genDecHuffTab(JpgDecInfo *jpg, int tabNum) {
   unsigned char *huffPtr, *huffBits;
   unsigned int *huffMax, *huffMin;
@@ -2011,6 +1938,11 @@ static void genDecHuffTab(JpgDecInfo *jpg, int tabNum) {
         huffCode = (huffMax[i] + 1) << 1;
     }
   }
+
+  if (tabNum & 1)
+    JpgDecPackHuffTab(jpg, tabNum, jpg->jpg12bit ? 256 : 162);
+  else
+    JpgDecPackHuffTab(jpg, tabNum, jpg->jpg12bit ? 16 : 12);
 }
 
 int JpuGbuInit(vpu_getbit_context_t *ctx, BYTE *buffer, int size) {
@@ -2157,21 +2089,50 @@ static void CheckUserHuffmanTable(JpgDecInfo *jpg) {
   }
 }
 
+/* Parses the headers up to the first scan. Without a devctx the data isn't
+ * headed for the core, so its stream buffer margins are not enforced. Nor
+ * are they for a ring buffer, which the core wraps in on its own.
+ */
+/* Grayscale is decoded 4 blocks at a time for performance, unless a ROI
+ * starts off a 32 pixel boundary. Depends on the ROI, so it is redone when
+ * the ROI changes.
+ */
+void JpgDecSetMcu400(JpgDecInfo *jpg) {
+  BOOL yuv400_4Blocks = TRUE;
+
+  if (jpg->roiEnable == TRUE) {
+    Uint32 offsetX = JPU_FLOOR(8, jpg->roiOffsetX);
+    yuv400_4Blocks = (BOOL)((offsetX % 32) == 0);
+  }
+  if (yuv400_4Blocks == TRUE) {
+    jpg->mcuBlockNum = 4;
+    jpg->mcuWidth = 32;
+    jpg->mcuHeight = 8;
+  } else {
+    jpg->mcuBlockNum = 1;
+    jpg->mcuWidth = 8;
+    jpg->mcuHeight = 8;
+  }
+  jpg->compInfo[0] = (jpg->mcuWidth >> 3) << 2 | (jpg->mcuHeight >> 3);
+}
+
 int JpegDecodeHeader(JpgDecInfo *jpg, JdiDeviceCtx devctx) {
   unsigned int code;
   int ret;
   int i;
   int temp;
+  int tag;
   int wrOffset;
   BYTE *b = jpg->pBitStream + jpg->frameOffset;
   int size;
-  BOOL yuv400_4Blocks =
-      TRUE; /* process 4block at a time for improving performance */
+  BOOL checkMargin = devctx && !jpg->streamRingSize;
 
   for (i = 0; i < THTC_LIST_CNT; i++) {
     jpg->thtc[i] = -1;
   }
   jpg->numHuffmanTable = 0;
+  jpg->thumbOffset = 0;
+  jpg->thumbSize = 0;
 
   ret = 1;
   if (jpg->streamWrPtr == jpg->streamBufStartAddr) {
@@ -2233,7 +2194,7 @@ int JpegDecodeHeader(JpgDecInfo *jpg, JdiDeviceCtx devctx) {
     jpg->frameOffset += (soiOffset + nextOffset);
   }
 
-  if (jpg->headerSize > 0 &&
+  if (checkMargin && jpg->headerSize > 0 &&
       (jpg->headerSize >
        (jpg->streamBufSize - jpg->frameOffset -
         JPU_GBU_SIZE))) {  // if header size is smaller than room of stream end.
@@ -2263,12 +2224,17 @@ int JpegDecodeHeader(JpgDecInfo *jpg, JdiDeviceCtx devctx) {
       case SOI_Marker:
         break;
       case JFIF_CODE:
-      case EXIF_CODE:
         if (!decode_app_header(jpg)) {
           ret = -1;
           goto DONE_DEC_HEADER;
         }
         break;
+      case EXIF_CODE:
+        if (!decode_exif_header(jpg)) {
+          ret = -1;
+          goto DONE_DEC_HEADER;
+        }
+        break;
       case DRI_Marker:
         if (!decode_dri_header(jpg)) {
           ret = -1;
@@ -2342,24 +2308,33 @@ DONE_DEC_HEADER:
 
   if (!jpg->ecsPtr) return 0;
 
-  if (wrOffset - (jpg->frameOffset + jpg->ecsPtr) < JPU_GBU_SIZE &&
+  if (checkMargin &&
+      wrOffset - (jpg->frameOffset + jpg->ecsPtr) < JPU_GBU_SIZE &&
       jpg->streamEndflag == 0) {
     return -1;
   }
 
   // this bellow is workaround to avoid the case that JPU is run over without
   // interrupt.
-  if (jpg->streamBufSize - (jpg->frameOffset + jpg->ecsPtr) < JPU_GBU_SIZE) {
+  if (checkMargin &&
+      jpg->streamBufSize - (jpg->frameOffset + jpg->ecsPtr) < JPU_GBU_SIZE) {
     return wraparound_bistream_data(jpg, devctx, -1);
   }
 
   CheckUserHuffmanTable(jpg);
 
-  // Generate Huffman table information
-  if (jpg->jpg12bit) {
-    for (i = 0; i < 8; i++) genDecHuffTab(jpg, i);
-  } else {
-    for (i = 0; i < 4; i++) genDecHuffTab(jpg, i);
+  // Generate Huffman table information. The core only needs it for user
+  // tables, and tables equal to the defaults use the prebuilt images.
+  if (jpg->userHuffTab) {
+    tag = jpg->jpg12bit ? JPG_TAB_DEC_HUFF_12B : JPG_TAB_DEC_HUFF;
+    jpg->huffImageHash = JpgTabHash(0, &tag, sizeof(tag));
+    for (i = 0; i < (jpg->jpg12bit ? 8 : 4); i++) {
+      jpg->huffImage[i] = JpgDecDefHuffImage(jpg, i);
+      if (jpg->huffImage[i] == NULL) genDecHuffTab(jpg, i);
+      jpg->huffImageHash =
+          JpgTabHash(jpg->huffImageHash, &jpg->huffImage[i]->key,
+                     sizeof(jpg->huffImage[i]->key));
+    }
   }
 
   // Q Idx
@@ -2437,19 +2412,7 @@ DONE_DEC_HEADER:
       jpg->compInfo[2] = 0;
       jpg->alignedWidth = ((jpg->picWidth + 7) & ~7);
       jpg->alignedHeight = ((jpg->picHeight + 7) & ~7);
-      if (jpg->roiEnable == TRUE) {
-        Uint32 offsetX = JPU_FLOOR(8, jpg->roiOffsetX);
-        yuv400_4Blocks = (BOOL)((offsetX % 32) == 0);
-      }
-      if (yuv400_4Blocks == TRUE) {
-        jpg->mcuBlockNum = 4;
-        jpg->mcuWidth = 32;
-        jpg->mcuHeight = 8;
-      } else {
-        jpg->mcuBlockNum = 1;
-        jpg->mcuWidth = 8;
-        jpg->mcuHeight = 8;
-      }
+      JpgDecSetMcu400(jpg);
       break;
     default:
       return 0;
@@ -2594,13 +2557,27 @@ int JpgEncGenHuffTab(JpgEncInfo *pEncInfo, int tabNum) {
   return 1;
 }
 
+static Uint64 JpgEncHuffTabHash(JpgEncInfo *pEncInfo, int tag, int numTab) {
+  Uint64 hash = JpgTabHash(0, &tag, sizeof(tag));
+
+  hash = JpgTabHash(hash, pEncInfo->pHuffBits,
+                    sizeof(pEncInfo->pHuffBits[0]) * numTab);
+  return JpgTabHash(hash, pEncInfo->pHuffVal,
+                    sizeof(pEncInfo->pHuffVal[0]) * numTab);
+}
+
 int JpgEncLoadHuffTab(JpgInst *pJpgInst, int instRegIndex) {
   int i, j, t;
   int huffData;
   JpgEncInfo *pEncInfo;
+  Uint64 hash;
 
   pEncInfo = &pJpgInst->JpgInfo->encInfo;
 
+  hash = JpgEncHuffTabHash(pEncInfo, JPG_TAB_ENC_HUFF, 4);
+  if (jdi_table_loaded(pJpgInst->devctx, JDI_TABLE_BANK_HUFF, hash)) return 1;
+  jdi_set_table_hash(pJpgInst->devctx, JDI_TABLE_BANK_HUFF, 0);
+
   for (i = 0; i < 4; i++) JpgEncGenHuffTab(pEncInfo, i);
 
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x3);
@@ -2628,6 +2605,7 @@ int JpgEncLoadHuffTab(JpgInst *pJpgInst, int instRegIndex) {
     }
   }
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x0);
+  jdi_set_table_hash(pJpgInst->devctx, JDI_TABLE_BANK_HUFF, hash);
   return 1;
 }
 
@@ -2635,10 +2613,15 @@ int JpgEncLoadHuffTab_12b(JpgInst *pJpgInst, int instRegIndex) {
   int i, j, t;
   int huffData;
   JpgEncInfo *pEncInfo;
+  Uint64 hash;
 
   JLOG(INFO, "%s instRegIndex: %d\n", __FUNCTION__, instRegIndex);
   pEncInfo = &pJpgInst->JpgInfo->encInfo;
 
+  hash = JpgEncHuffTabHash(pEncInfo, JPG_TAB_ENC_HUFF_12B, 8);
+  if (jdi_table_loaded(pJpgInst->devctx, JDI_TABLE_BANK_HUFF, hash)) return 1;
+  jdi_set_table_hash(pJpgInst->devctx, JDI_TABLE_BANK_HUFF, 0);
+
   for (i = 0; i < 8; i++) JpgEncGenHuffTab(pEncInfo, i);
 
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x3);
@@ -2675,6 +2658,7 @@ int JpgEncLoadHuffTab_12b(JpgInst *pJpgInst, int instRegIndex) {
     }
   }
   JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_HUFF_CTRL_REG, 0x0);
+  jdi_set_table_hash(pJpgInst->devctx, JDI_TABLE_BANK_HUFF, hash);
   return 1;
 }
 
@@ -2693,6 +2677,8 @@ int JpgEncLoadQMatTab(JpgInst *pJpgInst, int instRegIndex) {
   int comp;
   int i, t;
   int qprec = 0;
+  int tag = JPG_TAB_ENC_QMAT;
+  Uint64 hash;
   JpgEncInfo *pEncInfo;
 
   pEncInfo = &pJpgInst->JpgInfo->encInfo;
@@ -2701,8 +2687,6 @@ int JpgEncLoadQMatTab(JpgInst *pJpgInst, int instRegIndex) {
     quantID = pEncInfo->pCInfoTab[comp][3];
     if (quantID >= 4) return 0;
     t = (comp == 0) ? Q_COMPONENT0 : (comp == 1) ? Q_COMPONENT1 : Q_COMPONENT2;
-    JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_QMAT_CTRL_REG,
-                    0x3 + t);
 
     if (pEncInfo->jpg12bit != 0) {
       if (comp == 0)
@@ -2711,6 +2695,16 @@ int JpgEncLoadQMatTab(JpgInst *pJpgInst, int instRegIndex) {
         qprec = pEncInfo->q_prec1;
     }
 
+    hash = JpgTabHash(0, &tag, sizeof(tag));
+    hash = JpgTabHash(hash, &qprec, sizeof(qprec));
+    hash = JpgTabHash(hash, pEncInfo->pQMatTab[quantID],
+                      sizeof(pEncInfo->pQMatTab[quantID]));
+    if (jdi_table_loaded(pJpgInst->devctx, JDI_TABLE_BANK_QMAT0 + comp, hash))
+      continue;
+
+    JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_QMAT_CTRL_REG,
+                    0x3 + t);
+
     for (i = 0; i < 64; i++) {
       divisor = pEncInfo->pQMatTab[quantID][i];
       if (qprec)
@@ -2728,6 +2722,7 @@ int JpgEncLoadQMatTab(JpgInst *pJpgInst, int instRegIndex) {
                         (int)(divisor << 20) | (int)(quotient & 0xFFFFF));
     }
     JpuWriteInstReg(pJpgInst->devctx, instRegIndex, MJPEG_QMAT_CTRL_REG, t);
+    jdi_set_table_hash(pJpgInst->devctx, JDI_TABLE_BANK_QMAT0 + comp, hash);
   }
 
   return 1;
@@ -3107,6 +3102,12 @@ JpgRet JpgEnterLock(JdiDeviceCtx devctx) {
   return JPG_RET_SUCCESS;
 }
 
+JpgRet JpgEnterLockInst(JdiDeviceCtx devctx, Uint32 instIdx) {
+  jdi_lock_inst(devctx, (int)instIdx);
+
+  return JPG_RET_SUCCESS;
+}
+
 JpgRet JpgLeaveLock(JdiDeviceCtx devctx) {
   jdi_unlock(devctx);
   return JPG_RET_SUCCESS;
@@ -90,11 +90,12 @@ unsigned int JpuGbuGetBit(vpu_getbit_context_t *ctx, int bit_num);
 unsigned int JpuGguShowBit(vpu_getbit_context_t *ctx, int bit_num);
 
 int JpegDecodeHeader(JpgDecInfo *jpg, JdiDeviceCtx devctx);
+void JpgDecSetMcu400(JpgDecInfo *jpg);
 int JpgDecQMatTabSetUp(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex);
 int JpgDecHuffTabSetUp(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex);
 int JpgDecHuffTabSetUp_12b(JpgDecInfo *jpg, JdiDeviceCtx devctx,
                            int instRegIndex);
-void JpgDecGramSetup(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex);
+int JpgDecGramSetup(JpgDecInfo *jpg, JdiDeviceCtx devctx, int instRegIndex);
 
 JpgRet CheckJpgEncOpenParam(JpgEncOpenParam *pop, JPUCap *cap);
 JpgRet CheckJpgEncParam(JpgEncHandle handle, JpgEncParam *param);
@@ -106,6 +107,7 @@ int JpgEncLoadQMatTab(JpgInst *pJpgInst, int instRegIndex);
 int JpgEncEncodeHeader(JpgEncHandle handle, JpgEncParamSet *para);
 
 JpgRet JpgEnterLock(JdiDeviceCtx devctx);
+JpgRet JpgEnterLockInst(JdiDeviceCtx devctx, Uint32 instIdx);
 JpgRet JpgLeaveLock(JdiDeviceCtx devctx);
 JpgRet JpgSetClockGate(Uint32 on);
 
@@ -118,6 +120,8 @@ Uint32 GetDec12bitBusReqNum(FrameFormat iFormat, PackedFormat oPackMode);
 Uint32 GetEnc8bitBusReqNum(PackedFormat iPackMode, FrameFormat oFormat);
 Uint32 GetEnc12bitBusReqNum(PackedFormat iPackMode, FrameFormat oFormat);
 
+void JpuResizeRelease(void *handle);
+
 #ifdef __cplusplus
 }
 #endif
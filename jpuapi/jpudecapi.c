@@ -2,16 +2,23 @@
  * Copyright (C) 2019 ASR Micro Limited
  * All Rights Reserved.
  */
+#include <errno.h>
 #include <linux/dma-buf.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include "jpuapi.h"
 #include "jpuapifunc.h"
-#include "jpuencapi.h"
+#include "jpudecapi.h"
 #include "jpulog.h"
 #include "jputypes.h"
+#include "list.h"
 
 /* CODAJ10 Constraints
  * The minimum value of Qk is 8 for 16bit quantization element, 2 for 8bit
@@ -22,6 +29,80 @@
 #define MIN_Q8_ELEMENT 2
 //JpgEncOpenParam encOpenParam = {0};
 
+typedef struct {
+  struct list_head list;
+  FrameBufferInfo *frameBuffer;
+  ImageBufferInfo *jpegImageBuffer;
+  JpgDecCompletion completion;
+  JpgDecInfo decInfo; /* header state parsed at submit time */
+} JpgDecJob;
+
+typedef struct {
+  struct list_head list;
+  JpgDecInst *handle;
+  pthread_t worker;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct list_head pending;
+  struct list_head done;
+  int numJobs; /* pending + running + done, bounded by the queue depth */
+  int eventFd;
+  BOOL quit;
+  JpgDecCallback callback;
+  JpgDecInfo openInfo; /* decInfo as left by open, the base of every job */
+} JpgDecAsyncCtx;
+
+static LIST_HEAD(s_asyncList);
+static pthread_mutex_t s_asyncLock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef enum {
+  STREAM_SEEK_SOI, /* skipping bytes up to the next SOI */
+  STREAM_SEGMENT,  /* at a marker of the frame headers */
+  STREAM_ENTROPY,  /* in entropy coded data, looking for a marker */
+  STREAM_FRAME,    /* a whole frame lies between frameStart and scanPos */
+} JpgDecStreamState;
+
+/* Motion-JPEG ring. Positions count stream bytes since the start, their
+ * ring offset is the position modulo size.
+ */
+typedef struct {
+  struct list_head list;
+  JpgDecInst *handle;
+  Int32 fd;
+  Uint32 size;           /* ring bytes, whole pages */
+  BYTE *cpu;             /* the ring mapped twice, back to back */
+  BOOL registered;       /* fd registered with the device */
+  pthread_mutex_t lock;  /* rdPos and wrPos, shared with the producer */
+  Uint64 rdPos;          /* bytes the decoder is done with */
+  Uint64 wrPos;          /* bytes the producer committed */
+  Uint64 scanPos;        /* next byte the frame scanner looks at */
+  Uint64 frameStart;     /* SOI of the frame being scanned */
+  JpgDecStreamState state;
+} JpgDecStream;
+
+static LIST_HEAD(s_streamList);
+static pthread_mutex_t s_streamLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Input of a frame that is still arriving, see AsrJpuDecStartOneFrameFeed.
+typedef struct {
+  JpgDecFillCallback fill;
+  void *userData;
+  Int32 fd;     /* bitstream dma-buf */
+  BYTE *data;   /* its CPU mapping */
+  Uint32 size;  /* its bytes */
+  Uint32 len;   /* stream bytes in the buffer */
+  BOOL ended;   /* the stream end is flagged to the core */
+  BOOL failed;  /* the callback failed or the stream overflowed the buffer */
+} JpgDecFeed;
+
+// Band output of a frame, see AsrJpuDecStartOneFrameSlices.
+typedef struct {
+  JpgDecSliceCallback callback;
+  void *userData;
+  Uint32 height; /* output rows of a band */
+  Uint32 y;      /* output rows handed to the callback */
+} JpgDecSlices;
+
 JpgRet AsrJpuDecOpen(void **handle, DecOpenParam *param) {
   JdiDeviceCtx devctx = NULL;
   JpgRet ret;
@@ -33,7 +114,7 @@ JpgRet AsrJpuDecOpen(void **handle, DecOpenParam *param) {
   JpgDecOpenParam decOP = {0};
   pDecHandler = (JpgDecHandle *)handle;
 
-  ret = JPU_Init(0, &devctx);
+  ret = JPU_InitLeastLoaded(&devctx, NULL);
   if (ret != JPG_RET_SUCCESS && ret != JPG_RET_CALLED_BEFORE) {
     JLOG(ERR, "JPU_Init failed Error code is 0x%x \n", ret);
     goto ERR_DEC_INIT;
@@ -68,68 +149,375 @@ ERR_DEC_INIT:
   return JPG_RET_FAILURE;
 }
 JpgRet AsrJpuDecSetParam(void *handle, Uint32 parameterIndex, void *value) {
-  JpgDecInst *pDecHandler = (JpgDecInst *)handle;
-  JpgDecInfo decInfo = pDecHandler->JpgInfo->decInfo;
-  // to do
+  JpgRet ret = JPG_RET_SUCCESS;
+
+  if (handle == NULL) {
+    JLOG(ERR, "%s handle NULL !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
   switch (parameterIndex) {
+    case JPU_ROI:
+      ret = JPU_DecGiveCommand((JpgDecHandle)handle, SET_JPG_ROI, value);
+      break;
+    case JPU_THUMBNAIL:
+      ret = JPU_DecGiveCommand((JpgDecHandle)handle, SET_JPG_THUMBNAIL, value);
+      break;
     default:
       break;
   }
-  return JPG_RET_SUCCESS;
+  return ret;
+}
+
+/* Parses the header of jpegImageBuffer into pDecInfo. Only the image is
+ * mapped, and registered buffers reuse the mapping they already have. Every
+ * buffer is an image of its own, parsed from its first byte rather than
+ * where the previous frame left the instance.
+ */
+static JpgRet DecParseStream(JpgDecInst *pJpgInst,
+                             ImageBufferInfo *jpegImageBuffer,
+                             JpgDecInfo *pDecInfo, JpgDecInitialInfo *info) {
+  Int32 fd = jpegImageBuffer->dmaBuffer.fd;
+  JpgRet ret;
+
+  pDecInfo->frameOffset = 0;
+  pDecInfo->consumeByte = 0;
+  pDecInfo->ecsPtr = 0;
+  // A scale picked by AsrJpuDecFitSize was for the previous picture.
+  pDecInfo->iHorScaleMode = 0;
+  pDecInfo->iVerScaleMode = 0;
+  pDecInfo->streamFd = fd;
+  pDecInfo->streamBufSize = jpegImageBuffer->imageSize
+                                ? jpegImageBuffer->imageSize
+                                : jpegImageBuffer->dmaBuffer.size;
+  pDecInfo->pBitStream = (BYTE *)jdi_dmabuf_map(pJpgInst->devctx, fd,
+                                                pDecInfo->streamBufSize);
+  if (pDecInfo->pBitStream == NULL) {
+    return JPG_RET_INVALID_PARAM;
+  }
+  jdi_dmabuf_sync(fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+  ret = JPU_DecParseInitialInfo(pJpgInst, pDecInfo, info);
+  jdi_dmabuf_sync(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+  jdi_dmabuf_unmap(pJpgInst->devctx, fd, pDecInfo->pBitStream,
+                   pDecInfo->streamBufSize);
+  pDecInfo->pBitStream = NULL;
+
+  return ret;
 }
 
 JpgRet AsrJpuDecGetInitialInfo(void *handle, ImageBufferInfo *jpegImageBuffer,
                                JpgDecInitialInfo *info) {
   JpgRet ret;
-  Uint32 instIdx;
-  JpgDecInfo *pDecInfo;
+  JpgDecInst *JpgDecHandle = (JpgDecInst *)handle;
 
-  JLOG(ERR, "AsrJpuDecGetInitial dma buffer size:%d fd:%d\n",
-       jpegImageBuffer->dmaBuffer.size, jpegImageBuffer->dmaBuffer.fd);
-  if (handle == NULL) {
-    JLOG(ERR, "%s handle invalid !!!\n", __func__);
+  if (handle == NULL || jpegImageBuffer == NULL || info == NULL) {
+    JLOG(ERR, "%s invalid param !!!\n", __func__);
     return JPG_RET_INVALID_PARAM;
   }
-  JpgDecInst *JpgDecHandle = (JpgDecInst *)handle;
-  instIdx = JpgDecHandle->instIndex;
-  pDecInfo = &JpgDecHandle->JpgInfo->decInfo;
-  pDecInfo->streamFd = jpegImageBuffer->dmaBuffer.fd;
-  pDecInfo->streamBufSize = jpegImageBuffer->imageSize;
-  pDecInfo->pBitStream = (BYTE *)mmap(NULL, jpegImageBuffer->dmaBuffer.size,
-                                      PROT_READ | PROT_WRITE, MAP_SHARED,
-                                      jpegImageBuffer->dmaBuffer.fd, 0);
-  if ((ret = JPU_DecGetInitialInfo(handle, info)) != JPG_RET_SUCCESS) {
+  JLOG(DBG, "%s dma buffer size:%d fd:%d\n", __func__,
+       jpegImageBuffer->dmaBuffer.size, jpegImageBuffer->dmaBuffer.fd);
+  ret = DecParseStream(JpgDecHandle, jpegImageBuffer,
+                       &JpgDecHandle->JpgInfo->decInfo, info);
+  if (ret != JPG_RET_SUCCESS) {
     JLOG(ERR, "AsrJpuDecGetInitialInfo failed Error code is 0x%x, inst=%d \n",
-         ret, instIdx);
+         ret, JpgDecHandle->instIndex);
     return JPG_RET_INVALID_PARAM;
   }
-  munmap(pDecInfo->pBitStream, jpegImageBuffer->dmaBuffer.size);
   return JPG_RET_SUCCESS;
 }
 
-JpgRet AsrJpuDecStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
-                              ImageBufferInfo *jpegImageBuffer,
-                              JpgDecInitialInfo *info) {
+/* Layout of a decoded picture, following the rules of the sample allocator:
+ * lines padded to 8 pixels, and wider strides when the scaler is on.
+ */
+static void DecFrameLayout(FrameFormat format, CbCrInterLeave interleave,
+                           PackedFormat packed, BOOL scalerOn, Uint32 width,
+                           Uint32 height, Uint32 bytePerPixel,
+                           FrameBufferInfo *fb) {
+  Uint32 chromaDouble = (interleave == CBCR_SEPARATED) ? 1 : 2;
+  Uint32 lStride = JPU_CEIL(8, width), cStride = 0;
+  Uint32 lHeight = JPU_CEIL(8, height), cHeight = 0;
+  Uint32 lumaSize, chromaSize;
+
+  if (packed == PACKED_FORMAT_444) {
+    lStride *= 3;
+  } else if (packed != PACKED_FORMAT_NONE) {
+    lStride *= 2;
+  } else {
+    switch (format) {
+      case FORMAT_420:
+        cStride = (lStride / 2) * chromaDouble;
+        cHeight = height / 2;
+        break;
+      case FORMAT_422:
+        cStride = (lStride / 2) * chromaDouble;
+        cHeight = height;
+        break;
+      case FORMAT_440:
+        cStride = lStride * chromaDouble;
+        cHeight = height / 2;
+        break;
+      case FORMAT_444:
+        cStride = lStride * chromaDouble;
+        cHeight = height;
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (scalerOn) {
+    if (format == FORMAT_420 || format == FORMAT_422 ||
+        (PACKED_FORMAT_422_YUYV <= packed && packed <= PACKED_FORMAT_422_VYUY))
+      lStride = JPU_CEIL(32, lStride);
+    else
+      lStride = JPU_CEIL(16, lStride);
+    if (interleave != CBCR_SEPARATED)
+      cStride = JPU_CEIL(32, cStride);
+    else
+      cStride = JPU_CEIL(format == FORMAT_444 ? 16 : 8, cStride);
+  } else if (format == FORMAT_420 || format == FORMAT_422) {
+    cStride = JPU_CEIL(16, cStride);
+  }
+  cHeight = JPU_CEIL(8, cHeight);
+
+  fb->stride = lStride * bytePerPixel;
+  fb->strideC = cStride * bytePerPixel;
+  lumaSize = fb->stride * lHeight;
+  chromaSize = fb->strideC * cHeight;
+  fb->format = format;
+  fb->yOffset = 0;
+  fb->uOffset = chromaSize ? lumaSize : 0;
+  fb->vOffset =
+      (chromaSize && interleave == CBCR_SEPARATED) ? lumaSize + chromaSize : 0;
+  fb->dmaBuffer.fd = -1;
+  fb->dmaBuffer.size =
+      lumaSize + chromaSize * (interleave == CBCR_SEPARATED ? 2 : 1);
+}
+
+/* Largest scale mode, 0 to 3, that keeps size at least target. */
+static Uint32 DecFitScaleMode(Uint32 size, Uint32 target) {
+  Uint32 mode = 0;
+
+  while (mode < 3 && (size >> (mode + 1)) >= target) mode++;
+  return mode;
+}
+
+/* Picks the scale modes decoding a picture of whole MCUs to at least
+ * targetWidth x targetHeight after rotation. A target of 0 on one side
+ * follows the other side. The core only scales pictures of 128 lines and
+ * columns or more.
+ */
+static void DecFitScale(Uint32 width, Uint32 height, Uint32 rotation,
+                        Uint32 targetWidth, Uint32 targetHeight, Uint32 *hor,
+                        Uint32 *ver) {
+  Uint32 temp;
+
+  *hor = *ver = 0;
+  if (width < 128 || height < 128) return;
+  if (rotation == 90 || rotation == 270) {
+    temp = targetWidth;
+    targetWidth = targetHeight;
+    targetHeight = temp;
+  }
+  if (targetWidth) *hor = DecFitScaleMode(width, targetWidth);
+  if (targetHeight) *ver = DecFitScaleMode(height, targetHeight);
+  if (!targetWidth) *hor = *ver;
+  if (!targetHeight) *ver = *hor;
+}
+
+/* Size and frame buffer layout of a picture of whole MCUs decoded with the
+ * given scale modes and rotation, see AsrJpuDecProbe.
+ */
+static void DecOutputLayout(FrameFormat format, CbCrInterLeave interleave,
+                            PackedFormat packed, Uint32 width, Uint32 height,
+                            Uint32 hor, Uint32 ver, Uint32 rotation,
+                            Uint32 bitDepth, Uint32 *outputWidth,
+                            Uint32 *outputHeight, FrameBufferInfo *fb) {
+  Uint32 temp;
+
+  width >>= hor;
+  height >>= ver;
+  if (packed != PACKED_FORMAT_NONE && packed != PACKED_FORMAT_444) {
+    width = JPU_CEIL(2, width);
+  }
+
+  if (rotation == 90 || rotation == 270) {
+    temp = width;
+    width = height;
+    height = temp;
+    if (format == FORMAT_422)
+      format = FORMAT_440;
+    else if (format == FORMAT_440)
+      format = FORMAT_422;
+  }
+  *outputWidth = width;
+  *outputHeight = height;
+  DecFrameLayout(format, interleave, packed, hor || ver, width, height,
+                 (bitDepth + 7) / 8, fb);
+}
+
+JpgRet AsrJpuDecProbe(const void *data, Uint32 size,
+                      const JpgDecProbeParam *param, JpgDecProbeInfo *probe) {
+  JpgDecProbeParam defParam;
+  JpgDecInitialInfo *info;
+  Uint32 width, height;
+  JpgRet ret;
+
+  if (data == NULL || probe == NULL) {
+    JLOG(ERR, "%s invalid param !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  if (param == NULL) {
+    memset(&defParam, 0x00, sizeof(JpgDecProbeParam));
+    defParam.outputFormat = FORMAT_MAX;
+    param = &defParam;
+  }
+  if (param->iHorScaleMode > 3 || param->iVerScaleMode > 3 ||
+      param->rotation % 90 || param->rotation > 270 ||
+      param->packedFormat >= PACKED_FORMAT_MAX) {
+    return JPG_RET_INVALID_PARAM;
+  }
+  // Conversions the core can do, see JPU_DecOpen.
+  switch (param->outputFormat) {
+    case FORMAT_420:
+    case FORMAT_422:
+    case FORMAT_444:
+    case FORMAT_MAX:
+      break;
+    default:
+      return JPG_RET_INVALID_PARAM;
+  }
+
+  memset(probe, 0x00, sizeof(JpgDecProbeInfo));
+  info = &probe->info;
+  ret = JPU_DecProbe((const BYTE *)data, size, info);
+  if (ret != JPG_RET_SUCCESS) return ret;
+
+  // The core writes whole MCUs.
+  if (info->sourceFormat == FORMAT_420 || info->sourceFormat == FORMAT_422)
+    width = JPU_CEIL(16, info->picWidth);
+  else
+    width = JPU_CEIL(8, info->picWidth);
+  if (info->sourceFormat == FORMAT_420 || info->sourceFormat == FORMAT_440)
+    height = JPU_CEIL(16, info->picHeight);
+  else
+    height = JPU_CEIL(8, info->picHeight);
+
+  if (param->targetWidth || param->targetHeight) {
+    DecFitScale(width, height, param->rotation, param->targetWidth,
+                param->targetHeight, &probe->iHorScaleMode,
+                &probe->iVerScaleMode);
+  } else {
+    probe->iHorScaleMode = param->iHorScaleMode;
+    probe->iVerScaleMode = param->iVerScaleMode;
+  }
+  DecOutputLayout(param->outputFormat == FORMAT_MAX ? info->sourceFormat
+                                                    : param->outputFormat,
+                  param->chromaInterleave, param->packedFormat, width, height,
+                  probe->iHorScaleMode, probe->iVerScaleMode, param->rotation,
+                  info->bitDepth, &probe->outputWidth, &probe->outputHeight,
+                  &probe->frameBuffer);
+
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecFitSize(void *handle, Uint32 *width, Uint32 *height,
+                        FrameBufferInfo *frameBuffer) {
+  JpgDecInst *pJpgInst = (JpgDecInst *)handle;
+  JpgDecInfo *pDecInfo;
+  Uint32 srcWidth, srcHeight, hor, ver;
+  JpgRet ret;
+
+  if (handle == NULL || width == NULL || height == NULL ||
+      frameBuffer == NULL || (*width == 0 && *height == 0)) {
+    JLOG(ERR, "%s invalid param !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  pDecInfo = &pJpgInst->JpgInfo->decInfo;
+  if (!pDecInfo->initialInfoObtained) return JPG_RET_WRONG_CALL_SEQUENCE;
+
+  // The core does not scale a clipped picture.
+  hor = ver = 0;
+  if (pDecInfo->roiEnable) {
+    srcWidth = pDecInfo->roiFrameWidth;
+    srcHeight = pDecInfo->roiFrameHeight;
+  } else {
+    srcWidth = pDecInfo->alignedWidth;
+    srcHeight = pDecInfo->alignedHeight;
+    DecFitScale(srcWidth, srcHeight, pDecInfo->rotationIndex * 90, *width,
+                *height, &hor, &ver);
+  }
+  ret = JPU_DecGiveCommand(pJpgInst, SET_JPG_SCALE_HOR, &hor);
+  if (ret == JPG_RET_SUCCESS)
+    ret = JPU_DecGiveCommand(pJpgInst, SET_JPG_SCALE_VER, &ver);
+  if (ret != JPG_RET_SUCCESS) return ret;
+
+  DecOutputLayout(pDecInfo->format, (CbCrInterLeave)pDecInfo->chromaInterleave,
+                  pDecInfo->packedFormat, srcWidth, srcHeight, hor, ver,
+                  pDecInfo->rotationIndex * 90, pDecInfo->bitDepth, width,
+                  height, frameBuffer);
+  return JPG_RET_SUCCESS;
+}
+
+/* Appends the next chunk from the fill callback behind the write pointer,
+ * or flags the stream end to the core once the callback has no more. The
+ * write pointer is kept short of the buffer end, where it would wrap to the
+ * start.
+ */
+static void DecFeedStream(JpgDecInst *pJpgInst, JpgDecFeed *feed) {
+  Int32 size = 0;
+
+  if (feed->ended) return;
+  if (feed->len + 1 < feed->size) {
+    jdi_dmabuf_sync(feed->fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+    size = feed->fill(feed->userData, feed->data + feed->len,
+                      feed->size - feed->len - 1);
+    jdi_dmabuf_sync(feed->fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+    if (size < 0 || (Uint32)size > feed->size - feed->len - 1) {
+      JLOG(ERR, "%s fill failed ret=%d\n", __func__, size);
+      feed->failed = TRUE;
+      size = 0;
+    }
+  } else {
+    JLOG(ERR, "%s stream larger than its %u byte buffer\n", __func__,
+         feed->size);
+    feed->failed = TRUE;
+  }
+
+  if (size > 0) {
+    feed->len += size;
+    JPU_DecUpdateBitstreamBuffer(pJpgInst, size);
+  } else {
+    JPU_DecUpdateBitstreamBuffer(pJpgInst, 0);
+    feed->ended = TRUE;
+  }
+}
+
+/* Hands the rows decoded since the last call to the slice callback. */
+static void DecSliceDone(JpgDecInst *pJpgInst, JpgDecSlices *slices) {
+  Uint32 pos = JPU_GetSlicePos(pJpgInst);
+
+  if (pos > slices->y) {
+    slices->callback(slices->userData, slices->y, pos - slices->y);
+    slices->y = pos;
+  }
+}
+
+static JpgRet DecRunFrame(JpgDecInst *pJpgInst, FrameBufferInfo *frameBuffer,
+                          ImageBufferInfo *jpegImageBuffer,
+                          JpgDecOutputInfo *outputInfo, JpgDecFeed *feed,
+                          JpgDecSlices *slices) {
   JpgRet ret;
-  JpgInst *pJpgInst;
   JpgDecInfo *pDecInfo;
-  // JpgDecInitialInfo   initialInfo = {0};
   JpgDecParam decParam = {0};
-  // FrameFormat subsample;
-  JpgDecOutputInfo outputInfo = {0};
-  // FrameFormat initialSourceFormat;
-  // Uint32 initialOutFormat;
   int int_reason;
   Uint32 instIdx;
+  void *handle = pJpgInst;
 
-  if (handle == NULL) {
-    JLOG(INFO, "%s handle NULL !!!\n", __func__);
-    return JPG_RET_INVALID_PARAM;
-  }
-  JpgDecInst *JpgDecHandle = (JpgDecInst *)handle;
-  pJpgInst = JpgDecHandle;
   instIdx = pJpgInst->instIndex;
   pDecInfo = &pJpgInst->JpgInfo->decInfo;
+  // The MMU windows and the registers belong to whichever instance holds
+  // the core, so keep it from the MMU setup to the output of the frame.
+  JpgEnterLockInst(pJpgInst->devctx, instIdx);
   JPU_DMA_CFG cfg =
       jdi_config_mmu(pJpgInst->devctx, jpegImageBuffer->dmaBuffer.fd,
                      frameBuffer->dmaBuffer.fd, frameBuffer->dmaBuffer.size, 0);
@@ -137,54 +525,85 @@ JpgRet AsrJpuDecStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
     JpgLeaveLock(pJpgInst->devctx);
     return JPG_RET_INVALID_PARAM;
   }
-  pDecInfo->streamRdPtr = cfg.intput_virt_addr;
-  pDecInfo->streamWrPtr = cfg.intput_virt_addr;
-  pDecInfo->streamBufStartAddr = cfg.intput_virt_addr;
-  pDecInfo->streamBufEndAddr =
-      cfg.intput_virt_addr + jpegImageBuffer->dmaBuffer.size;
   frameBuffer->dmaBuffer.viraddr = cfg.output_virt_addr;
-  if (ret = JPU_DecSetRdPtrEx(handle, pDecInfo->streamWrPtr, TRUE) !=
-            JPG_RET_SUCCESS) {
-    JLOG(ERR, "JPU_DecSetRdPtrEx failed Error code is 0x%x \n", ret);
+  if (pDecInfo->streamRingSize) {
+    // The frame is imageSize bytes at frameOffset of the ring and may wrap
+    // at its end, the stream pointers stay on the ring.
+    pDecInfo->streamBufStartAddr = cfg.intput_virt_addr;
+    pDecInfo->streamBufEndAddr =
+        cfg.intput_virt_addr + pDecInfo->streamRingSize;
+    pDecInfo->streamWrPtr =
+        cfg.intput_virt_addr +
+        (pDecInfo->frameOffset + jpegImageBuffer->imageSize) %
+            pDecInfo->streamRingSize;
+    ret = JPU_DecSetRdPtr(handle, cfg.intput_virt_addr + pDecInfo->frameOffset,
+                          FALSE);
+  } else {
+    pDecInfo->streamRdPtr = cfg.intput_virt_addr;
+    pDecInfo->streamWrPtr = cfg.intput_virt_addr;
+    pDecInfo->streamBufStartAddr = cfg.intput_virt_addr;
+    pDecInfo->streamBufEndAddr =
+        cfg.intput_virt_addr + jpegImageBuffer->dmaBuffer.size;
+    ret = JPU_DecSetRdPtrEx(handle, pDecInfo->streamWrPtr, TRUE);
+  }
+  if (ret != JPG_RET_SUCCESS) {
+    JLOG(ERR, "JPU_DecSetRdPtr failed Error code is 0x%x \n", ret);
   }
   // Register frame buffers requested by the decoder.
   if ((ret = JPU_DecRegisterFrameBuffer(
            handle, frameBuffer, 1, frameBuffer->stride)) != JPG_RET_SUCCESS) {
     JLOG(ERR, "JPU_DecRegisterFrameBuffer failed Error code is 0x%x \n", ret);
+    JpgLeaveLock(pJpgInst->devctx);
     return JPG_RET_FAILURE;
   }
 
-  if ((ret = JPU_DecUpdateBitstreamBuffer(
+  if (!pDecInfo->streamRingSize &&
+      (ret = JPU_DecUpdateBitstreamBuffer(
            handle, jpegImageBuffer->imageSize
                        ? jpegImageBuffer->imageSize
                        : jpegImageBuffer->dmaBuffer.size)) != JPG_RET_SUCCESS) {
     JLOG(ERR, "JPU_DecUpdateBitstreamBuffer failed Error code is 0x%x \n", ret);
+    JpgLeaveLock(pJpgInst->devctx);
     return JPG_RET_FAILURE;
   }
-  // Update bitstream EOS
-  if ((ret = JPU_DecUpdateBitstreamBuffer(handle, 0)) != JPG_RET_SUCCESS) {
+  // Update bitstream EOS, a frame still arriving gets it from the feed. An
+  // earlier frame of the handle left the end flag set, clear it so that
+  // JPU_DecStartOneFrame clears STREAM_END instead of ending at the chunk.
+  if (feed) pDecInfo->streamEndflag = 0;
+  if (!feed &&
+      (ret = JPU_DecUpdateBitstreamBuffer(handle, 0)) != JPG_RET_SUCCESS) {
     JLOG(ERR, "Update EOS failed, Error code is 0x%x\n", ret);
+    JpgLeaveLock(pJpgInst->devctx);
     return JPG_RET_FAILURE;
   }
 
   JPU_DecGiveCommand(handle, SET_JPG_SCALE_HOR, &pDecInfo->iHorScaleMode);
   JPU_DecGiveCommand(handle, SET_JPG_SCALE_VER, &pDecInfo->iVerScaleMode);
-  // Start decoding a frame.
-  ret = JPU_DecStartOneFrame(handle, &decParam);
+  pDecInfo->sliceHeight = slices ? slices->height : 0;
+  // Start decoding a frame. The core wants some data ahead of it unless the
+  // stream has ended.
+  while ((ret = JPU_DecStartOneFrame(handle, &decParam)) ==
+             JPG_RET_BIT_EMPTY &&
+         feed && !feed->ended) {
+    DecFeedStream(pJpgInst, feed);
+  }
   if (ret != JPG_RET_SUCCESS && ret != JPG_RET_EOS) {
     if (ret == JPG_RET_BIT_EMPTY) {
       JLOG(INFO, "BITSTREAM NOT ENOUGH.............\n");
     }
 
     JLOG(ERR, "JPU_DecStartOneFrame failed Error code is 0x%x \n", ret);
+    JpgLeaveLock(pJpgInst->devctx);
     return JPG_RET_FAILURE;
   }
 
   while (1) {
     if ((int_reason = JPU_WaitInterrupt(handle, JPU_INTERRUPT_TIMEOUT_MS)) ==
         -1) {
+      // JPU_WaitInterrupt already released the lock and the pending instance.
       JLOG(ERR, "Error : timeout happened\n");
-      break;
+      JpgLeaveLock(pJpgInst->devctx);
+      return JPG_RET_FAILURE;
     }
     if (int_reason & ((1 << INT_JPU_DONE) | (1 << INT_JPU_ERROR))) {
       // Do no clear INT_JPU_DONE and INT_JPU_ERROR interrupt. these will be
@@ -192,23 +611,43 @@ JpgRet AsrJpuDecStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
       JLOG(INFO, "INSTANCE #%d int_reason: %08x\n", instIdx, int_reason);
       break;
     }
+    if (feed && (int_reason & (1 << INT_JPU_BIT_BUF_EMPTY))) {
+      // The core holds at the write pointer until the interrupt is cleared.
+      DecFeedStream(pJpgInst, feed);
+      JPU_ClrStatus(handle, 1 << INT_JPU_BIT_BUF_EMPTY);
+    }
+    if (slices && (int_reason & (1 << INT_JPU_SLICE_DONE))) {
+      // The core holds after the band until the interrupt is cleared.
+      DecSliceDone(pJpgInst, slices);
+      JPU_ClrStatus(handle, 1 << INT_JPU_SLICE_DONE);
+    }
   }
+  // The last band ends with the frame.
+  if (slices && (int_reason & (1 << INT_JPU_DONE)))
+    DecSliceDone(pJpgInst, slices);
+  outputInfo->intStatus =
+      int_reason == -2 ? (1 << INT_JPU_ERROR) : (Uint32)int_reason;
 
-  if ((ret = JPU_DecGetOutputInfo(handle, &outputInfo)) != JPG_RET_SUCCESS) {
+  ret = JPU_DecGetOutputInfo(handle, outputInfo);
+  JpgLeaveLock(pJpgInst->devctx);
+  if (ret != JPG_RET_SUCCESS) {
     JLOG(ERR, "JPU_DecGetOutputInfo failed Error code is 0x%x \n", ret);
     return JPG_RET_FAILURE;
   }
 
-  JLOG(INFO, "%02d %8d %8x %8x %10d %8x %8x %10d\n", instIdx,
-       outputInfo.indexFrameDisplay, outputInfo.bytePosFrameStart,
-       outputInfo.ecsPtr, outputInfo.consumedByte, outputInfo.rdPtr,
-       outputInfo.wrPtr, outputInfo.frameCycle);
+  JLOG(INFO, "%02d %8d %8x %8x %10d %8x %8x %10d %8dus\n", instIdx,
+       outputInfo->indexFrameDisplay, outputInfo->bytePosFrameStart,
+       outputInfo->ecsPtr, outputInfo->consumedByte, outputInfo->rdPtr,
+       outputInfo->wrPtr, outputInfo->frameCycle, outputInfo->waitTimeUs);
 
-  if (outputInfo.numOfErrMBs) {
+  JLOG(DBG, "register writes issued:%d elided:%d\n",
+       outputInfo->regWritesIssued, outputInfo->regWritesElided);
+
+  if (outputInfo->numOfErrMBs) {
     Int32 errRstIdx, errPosX, errPosY;
-    errRstIdx = (outputInfo.numOfErrMBs & 0x0F000000) >> 24;
-    errPosX = (outputInfo.numOfErrMBs & 0x00FFF000) >> 12;
-    errPosY = (outputInfo.numOfErrMBs & 0x00000FFF);
+    errRstIdx = (outputInfo->numOfErrMBs & 0x0F000000) >> 24;
+    errPosX = (outputInfo->numOfErrMBs & 0x00FFF000) >> 12;
+    errPosY = (outputInfo->numOfErrMBs & 0x00000FFF);
     JLOG(ERR, "Error restart Idx : %d, MCU x:%d, y:%d \n", errRstIdx, errPosX,
          errPosY);
   }
@@ -216,13 +655,1080 @@ JpgRet AsrJpuDecStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
   return JPG_RET_SUCCESS;
 }
 
+JpgRet AsrJpuDecStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
+                              ImageBufferInfo *jpegImageBuffer) {
+  JpgDecOutputInfo outputInfo = {0};
+  JpgRet ret;
+
+  if (handle == NULL) {
+    JLOG(INFO, "%s handle NULL !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  jdi_add_queue_depth(((JpgDecInst *)handle)->devctx, 1);
+  ret = DecRunFrame((JpgDecInst *)handle, frameBuffer, jpegImageBuffer,
+                    &outputInfo, NULL, NULL);
+  jdi_add_queue_depth(((JpgDecInst *)handle)->devctx, -1);
+  return ret;
+}
+
+JpgRet AsrJpuDecStartOneFrameFeed(void *handle, FrameBufferInfo *frameBuffer,
+                                  ImageBufferInfo *jpegImageBuffer,
+                                  JpgDecFillCallback fill, void *userData) {
+  JpgDecInst *pJpgInst = (JpgDecInst *)handle;
+  JpgDecOutputInfo outputInfo = {0};
+  JpgDecFeed feed = {0};
+  JpgRet ret;
+
+  if (handle == NULL || frameBuffer == NULL || jpegImageBuffer == NULL ||
+      fill == NULL || jpegImageBuffer->imageSize == 0 ||
+      jpegImageBuffer->imageSize >= jpegImageBuffer->dmaBuffer.size) {
+    JLOG(ERR, "%s invalid param\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  feed.fill = fill;
+  feed.userData = userData;
+  feed.fd = jpegImageBuffer->dmaBuffer.fd;
+  feed.size = jpegImageBuffer->dmaBuffer.size;
+  feed.len = jpegImageBuffer->imageSize;
+  feed.data = (BYTE *)jdi_dmabuf_map(pJpgInst->devctx, feed.fd, feed.size);
+  if (feed.data == NULL) return JPG_RET_INVALID_PARAM;
+
+  jdi_add_queue_depth(pJpgInst->devctx, 1);
+  ret = DecRunFrame(pJpgInst, frameBuffer, jpegImageBuffer, &outputInfo,
+                    &feed, NULL);
+  jdi_add_queue_depth(pJpgInst->devctx, -1);
+  jdi_dmabuf_unmap(pJpgInst->devctx, feed.fd, feed.data, feed.size);
+
+  jpegImageBuffer->imageSize = feed.len;
+  if (ret == JPG_RET_SUCCESS && (feed.failed || !outputInfo.decodingSuccess))
+    ret = JPG_RET_FAILURE;
+  return ret;
+}
+
+JpgRet AsrJpuDecStartOneFrameSlices(void *handle, FrameBufferInfo *frameBuffer,
+                                    ImageBufferInfo *jpegImageBuffer,
+                                    Uint32 sliceHeight,
+                                    JpgDecSliceCallback callback,
+                                    void *userData) {
+  JpgDecInst *pJpgInst = (JpgDecInst *)handle;
+  JpgDecInfo *pDecInfo;
+  JpgDecOutputInfo outputInfo = {0};
+  JpgDecSlices slices = {0};
+  Uint32 mcuRows;
+  JpgRet ret;
+
+  if (handle == NULL || frameBuffer == NULL || jpegImageBuffer == NULL ||
+      callback == NULL || sliceHeight == 0) {
+    JLOG(ERR, "%s invalid param\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  pDecInfo = &pJpgInst->JpgInfo->decInfo;
+  // Bands are whole MCU rows of the output, which the rotator would turn
+  // into columns.
+  mcuRows = pDecInfo->mcuHeight >> pDecInfo->iVerScaleMode;
+  if (mcuRows == 0 || sliceHeight % mcuRows || pDecInfo->rotationIndex ||
+      pDecInfo->mirrorIndex) {
+    JLOG(ERR, "%s slice height %u unsupported\n", __func__, sliceHeight);
+    return JPG_RET_INVALID_PARAM;
+  }
+  slices.callback = callback;
+  slices.userData = userData;
+  slices.height = sliceHeight;
+
+  jdi_add_queue_depth(pJpgInst->devctx, 1);
+  ret = DecRunFrame(pJpgInst, frameBuffer, jpegImageBuffer, &outputInfo, NULL,
+                    &slices);
+  jdi_add_queue_depth(pJpgInst->devctx, -1);
+  if (ret == JPG_RET_SUCCESS && !outputInfo.decodingSuccess)
+    ret = JPG_RET_FAILURE;
+  return ret;
+}
+
+// Parses the header of a batch job into its own copy of the decoder state.
+static JpgRet DecBatchParse(JpgDecInst *pJpgInst, JpgDecBatchJob *job,
+                            JpgDecInfo *pDecInfo) {
+  job->frameCycle = 0;
+  job->waitTimeUs = 0;
+  job->spinTimeUs = 0;
+  job->decodeTimeUs = 0;
+  if (job->frameBuffer == NULL || job->jpegImageBuffer == NULL) {
+    return JPG_RET_INVALID_PARAM;
+  }
+
+  memcpy(pDecInfo, &pJpgInst->JpgInfo->decInfo, sizeof(JpgDecInfo));
+
+  return DecParseStream(pJpgInst, job->jpegImageBuffer, pDecInfo, &job->info);
+}
+
+JpgRet AsrJpuDecBatch(void *handle, JpgDecBatchJob *jobs, Uint32 numJobs) {
+  JpgDecInst *pJpgInst = (JpgDecInst *)handle;
+  JpgDecInfo *pDecInfo, *jobInfo;
+  JpgDecOutputInfo outputInfo;
+  JpgDecBatchJob *job;
+  JdiDeviceCtx devctx;
+  JpgRet ret = JPG_RET_SUCCESS;
+  Uint32 i;
+  Uint32 decIdx;
+  Uint64 start;
+  int frameIdx;
+
+  if (handle == NULL || (jobs == NULL && numJobs > 0)) {
+    JLOG(ERR, "%s invalid param !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  if (numJobs == 0) return JPG_RET_SUCCESS;
+
+  jobInfo = (JpgDecInfo *)malloc(sizeof(JpgDecInfo) * numJobs);
+  if (!jobInfo) return JPG_RET_INSUFFICIENT_RESOURCE;
+
+  devctx = pJpgInst->devctx;
+  pDecInfo = &pJpgInst->JpgInfo->decInfo;
+  jdi_add_queue_depth(devctx, numJobs);
+
+  // Every header is parsed on the CPU before the core is taken.
+  for (i = 0; i < numJobs; i++) {
+    jobs[i].ret = DecBatchParse(pJpgInst, &jobs[i], &jobInfo[i]);
+    if (jobs[i].ret != JPG_RET_SUCCESS) {
+      JLOG(ERR, "%s job %d header parse failed Error code is 0x%x\n",
+           __func__, i, jobs[i].ret);
+    }
+  }
+
+  // Held across the batch, DecRunFrame only nests in it. Keeping the core
+  // also keeps its clock, the idle timer can't take the lock.
+  JpgEnterLockInst(devctx, pJpgInst->instIndex);
+  for (i = 0; i < numJobs; i++) {
+    job = &jobs[i];
+    if (job->ret == JPG_RET_SUCCESS) {
+      frameIdx = pDecInfo->frameIdx;
+      decIdx = pDecInfo->decIdx;
+      memcpy(pDecInfo, &jobInfo[i], sizeof(JpgDecInfo));
+      pDecInfo->frameIdx = frameIdx;
+      pDecInfo->decIdx = decIdx;
+
+      memset(&outputInfo, 0x00, sizeof(JpgDecOutputInfo));
+      start = jdi_get_time_us();
+      job->ret = DecRunFrame(pJpgInst, job->frameBuffer, job->jpegImageBuffer,
+                             &outputInfo, NULL, NULL);
+      job->decodeTimeUs = (Uint32)(jdi_get_time_us() - start);
+      if (job->ret == JPG_RET_SUCCESS && !outputInfo.decodingSuccess)
+        job->ret = JPG_RET_FAILURE;
+      job->frameCycle = outputInfo.frameCycle;
+      job->waitTimeUs = outputInfo.waitTimeUs;
+      job->spinTimeUs = outputInfo.spinTimeUs;
+    }
+    if (job->ret != JPG_RET_SUCCESS) ret = JPG_RET_FAILURE;
+    jdi_add_queue_depth(devctx, -1);
+
+    // Other sessions get their turn between two images.
+    if (jdi_lock_contended(devctx)) {
+      JpgLeaveLock(devctx);
+      JpgEnterLockInst(devctx, pJpgInst->instIndex);
+    }
+  }
+  JpgLeaveLock(devctx);
+
+  free(jobInfo);
+  return ret;
+}
+
+JpgRet AsrJpuDecStartOneFrameRois(void *handle,
+                                  ImageBufferInfo *jpegImageBuffer,
+                                  JpgDecRoiJob *jobs, Uint32 numJobs) {
+  JpgDecInst *pJpgInst = (JpgDecInst *)handle;
+  JpgDecInfo *pDecInfo, *parsed;
+  JpgDecInitialInfo info;
+  JpgDecOutputInfo outputInfo;
+  JpgDecRoiJob *job;
+  JdiDeviceCtx devctx;
+  JpgRet ret;
+  Uint32 decIdx, i;
+  int frameIdx;
+
+  if (handle == NULL || jpegImageBuffer == NULL ||
+      (jobs == NULL && numJobs > 0)) {
+    JLOG(ERR, "%s invalid param !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  if (numJobs == 0) return JPG_RET_SUCCESS;
+
+  parsed = (JpgDecInfo *)malloc(sizeof(JpgDecInfo));
+  if (!parsed) return JPG_RET_INSUFFICIENT_RESOURCE;
+
+  devctx = pJpgInst->devctx;
+  pDecInfo = &pJpgInst->JpgInfo->decInfo;
+  // One header parse, and one CPU mapping of the bitstream, for all crops.
+  ret = DecParseStream(pJpgInst, jpegImageBuffer, pDecInfo, &info);
+  if (ret != JPG_RET_SUCCESS) {
+    JLOG(ERR, "%s header parse failed Error code is 0x%x\n", __func__, ret);
+    free(parsed);
+    return ret;
+  }
+  memcpy(parsed, pDecInfo, sizeof(JpgDecInfo));
+  jdi_add_queue_depth(devctx, numJobs);
+
+  JpgEnterLockInst(devctx, pJpgInst->instIndex);
+  for (i = 0; i < numJobs; i++) {
+    job = &jobs[i];
+    job->offsetX = job->offsetY = job->width = job->height = 0;
+    frameIdx = pDecInfo->frameIdx;
+    decIdx = pDecInfo->decIdx;
+    memcpy(pDecInfo, parsed, sizeof(JpgDecInfo));
+    pDecInfo->frameIdx = frameIdx;
+    pDecInfo->decIdx = decIdx;
+
+    job->ret = job->frameBuffer
+                   ? JPU_DecGiveCommand(pJpgInst, SET_JPG_ROI, &job->roi)
+                   : JPG_RET_INVALID_PARAM;
+    if (job->ret == JPG_RET_SUCCESS) {
+      if (pDecInfo->roiEnable) {
+        job->offsetX = pDecInfo->roiMcuOffsetX * pDecInfo->mcuWidth;
+        job->offsetY = pDecInfo->roiMcuOffsetY * pDecInfo->mcuHeight;
+      }
+      memset(&outputInfo, 0x00, sizeof(JpgDecOutputInfo));
+      job->ret = DecRunFrame(pJpgInst, job->frameBuffer, jpegImageBuffer,
+                             &outputInfo, NULL, NULL);
+      if (job->ret == JPG_RET_SUCCESS && !outputInfo.decodingSuccess)
+        job->ret = JPG_RET_FAILURE;
+      job->width = outputInfo.decPicWidth;
+      job->height = outputInfo.decPicHeight;
+    }
+    if (job->ret != JPG_RET_SUCCESS) {
+      JLOG(ERR, "%s crop %d failed Error code is 0x%x\n", __func__, i,
+           job->ret);
+      ret = JPG_RET_FAILURE;
+    }
+    jdi_add_queue_depth(devctx, -1);
+
+    if (jdi_lock_contended(devctx)) {
+      JpgLeaveLock(devctx);
+      JpgEnterLockInst(devctx, pJpgInst->instIndex);
+    }
+  }
+  JpgLeaveLock(devctx);
+
+  // The handle is left with the header and its own ROI.
+  frameIdx = pDecInfo->frameIdx;
+  decIdx = pDecInfo->decIdx;
+  memcpy(pDecInfo, parsed, sizeof(JpgDecInfo));
+  pDecInfo->frameIdx = frameIdx;
+  pDecInfo->decIdx = decIdx;
+
+  free(parsed);
+  return ret;
+}
+
+static JpgDecStream *DecStreamFind(void *handle) {
+  JpgDecStream *s;
+
+  pthread_mutex_lock(&s_streamLock);
+  list_for_each_entry(s, &s_streamList, list) {
+    if (s->handle == handle) {
+      pthread_mutex_unlock(&s_streamLock);
+      return s;
+    }
+  }
+  pthread_mutex_unlock(&s_streamLock);
+  return NULL;
+}
+
+/* Advances the frame scanner over the bytes committed up to wrPos and
+ * returns TRUE once a whole frame, SOI to EOI, is in the ring. Header
+ * segments are skipped by their length, so thumbnails in APP segments don't
+ * end the frame, and the entropy coded data only ends at a marker. Damaged
+ * frames are dropped by looking for the next SOI.
+ */
+static BOOL DecStreamScan(JpgDecStream *s, Uint64 wrPos) {
+  BYTE *p, *ff;
+  Uint32 avail, len;
+
+  while (s->state != STREAM_FRAME && s->scanPos + 2 <= wrPos) {
+    // The second mapping makes the bytes up to wrPos contiguous.
+    p = s->cpu + s->scanPos % s->size;
+    avail = (Uint32)(wrPos - s->scanPos);
+    switch (s->state) {
+      case STREAM_SEEK_SOI:
+      case STREAM_ENTROPY:
+        ff = (BYTE *)memchr(p, 0xFF, avail - 1);
+        if (!ff) {
+          s->scanPos += avail - 1;
+          break;
+        }
+        s->scanPos += ff - p;
+        if (s->state == STREAM_SEEK_SOI) {
+          if (ff[1] == 0xD8) {
+            s->frameStart = s->scanPos;
+            s->state = STREAM_SEGMENT;
+            s->scanPos += 2;
+          } else {
+            s->scanPos++;
+          }
+        } else if (ff[1] == 0x00 || (ff[1] >= 0xD0 && ff[1] <= 0xD7)) {
+          s->scanPos += 2;  // stuffed byte or restart marker
+        } else if (ff[1] == 0xFF) {
+          s->scanPos++;
+        } else if (ff[1] == 0xD9) {
+          s->state = STREAM_FRAME;
+          s->scanPos += 2;
+        } else {
+          s->state = STREAM_SEGMENT;  // DNL or the next scan
+        }
+        break;
+      case STREAM_SEGMENT:
+        if (p[0] != 0xFF || p[1] == 0x00 || p[1] == 0xD8 || p[1] == 0xD9) {
+          JLOG(DBG, "%s damaged frame at %llu skipped\n", __func__,
+               (unsigned long long)s->frameStart);
+          s->state = STREAM_SEEK_SOI;
+          break;
+        }
+        if (p[1] == 0x01 || (p[1] >= 0xD0 && p[1] <= 0xD7)) {
+          s->scanPos += 2;
+          break;
+        }
+        // Like JpegDecodeHeader, FFFF starts a segment as the encoder pads
+        // its headers with one.
+        if (avail < 4) return FALSE;
+        len = (p[2] << 8) | p[3];
+        if (len < 2) {
+          s->state = STREAM_SEEK_SOI;
+          break;
+        }
+        if (p[1] == 0xDA) s->state = STREAM_ENTROPY;
+        s->scanPos += 2 + len;
+        break;
+      default:
+        break;
+    }
+  }
+  return s->state == STREAM_FRAME;
+}
+
+JpgRet AsrJpuDecStreamStart(void *handle, Int32 fd, Uint32 size) {
+  JpgDecInst *pJpgInst = (JpgDecInst *)handle;
+  JpgDecStream *s;
+  BYTE *cpu;
+  JpgRet ret;
+
+  if (handle == NULL || fd < 0 || size == 0 ||
+      size % (Uint32)sysconf(_SC_PAGESIZE) != 0 || size > 0x40000000) {
+    JLOG(ERR, "%s invalid param fd:%d size:%u\n", __func__, fd, size);
+    return JPG_RET_INVALID_PARAM;
+  }
+  if (DecStreamFind(handle)) return JPG_RET_CALLED_BEFORE;
+
+  // Reserve twice the ring and map it into both halves, a frame or header
+  // crossing the ring end then reads linearly without a copy.
+  cpu = (BYTE *)mmap(NULL, (size_t)size * 2, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (cpu == MAP_FAILED) {
+    JLOG(ERR, "%s reserve failed errno=%d\n", __func__, errno);
+    return JPG_RET_INSUFFICIENT_RESOURCE;
+  }
+  if (mmap(cpu, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) ==
+          MAP_FAILED ||
+      mmap(cpu + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd, 0) == MAP_FAILED) {
+    JLOG(ERR, "%s map fd %d failed errno=%d\n", __func__, fd, errno);
+    munmap(cpu, (size_t)size * 2);
+    return JPG_RET_INVALID_PARAM;
+  }
+  s = (JpgDecStream *)calloc(1, sizeof(JpgDecStream));
+  if (!s) {
+    munmap(cpu, (size_t)size * 2);
+    return JPG_RET_INSUFFICIENT_RESOURCE;
+  }
+  // Only saves work per frame, without it the MMU is set up as usual.
+  ret = JPU_RegisterDmaBuf(pJpgInst->devctx, fd);
+  if (ret != JPG_RET_SUCCESS)
+    JLOG(WARN, "%s fd %d not registered ret=%d\n", __func__, fd, ret);
+  s->registered = ret == JPG_RET_SUCCESS;
+  s->handle = pJpgInst;
+  s->fd = fd;
+  s->size = size;
+  s->cpu = cpu;
+  s->state = STREAM_SEEK_SOI;
+  pthread_mutex_init(&s->lock, NULL);
+
+  pthread_mutex_lock(&s_streamLock);
+  list_add_tail(&s->list, &s_streamList);
+  pthread_mutex_unlock(&s_streamLock);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecStreamStop(void *handle) {
+  JpgDecStream *s;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  s = DecStreamFind(handle);
+  if (!s) return JPG_RET_WRONG_CALL_SEQUENCE;
+
+  pthread_mutex_lock(&s_streamLock);
+  list_del(&s->list);
+  pthread_mutex_unlock(&s_streamLock);
+
+  if (s->registered) JPU_UnregisterDmaBuf(s->handle->devctx, s->fd);
+  munmap(s->cpu, (size_t)s->size * 2);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecStreamGetWriteBuffer(void *handle, void **data, Uint32 *room) {
+  JpgDecStream *s;
+
+  if (handle == NULL || data == NULL || room == NULL)
+    return JPG_RET_INVALID_PARAM;
+  s = DecStreamFind(handle);
+  if (!s) return JPG_RET_WRONG_CALL_SEQUENCE;
+
+  pthread_mutex_lock(&s->lock);
+  *room = s->size - (Uint32)(s->wrPos - s->rdPos);
+  *data = s->cpu + s->wrPos % s->size;
+  pthread_mutex_unlock(&s->lock);
+  jdi_dmabuf_sync(s->fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecStreamCommit(void *handle, Uint32 size) {
+  JpgDecStream *s;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  s = DecStreamFind(handle);
+  if (!s) return JPG_RET_WRONG_CALL_SEQUENCE;
+
+  jdi_dmabuf_sync(s->fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+  pthread_mutex_lock(&s->lock);
+  if (size > s->size - (Uint32)(s->wrPos - s->rdPos)) {
+    pthread_mutex_unlock(&s->lock);
+    return JPG_RET_INVALID_PARAM;
+  }
+  s->wrPos += size;
+  pthread_mutex_unlock(&s->lock);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecStreamDecodeFrame(void *handle, FrameBufferInfo *frameBuffer,
+                                  JpgDecInitialInfo *info) {
+  JpgDecInst *pJpgInst = (JpgDecInst *)handle;
+  JpgDecInfo *pDecInfo;
+  JpgDecStream *s;
+  JpgDecInitialInfo frameInfo;
+  JpgDecOutputInfo outputInfo = {0};
+  ImageBufferInfo image = {0};
+  Uint64 wrPos;
+  Uint32 frameSize;
+  BOOL found, full;
+  JpgRet ret;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  s = DecStreamFind(handle);
+  if (!s) return JPG_RET_WRONG_CALL_SEQUENCE;
+
+  pthread_mutex_lock(&s->lock);
+  wrPos = s->wrPos;
+  pthread_mutex_unlock(&s->lock);
+
+  jdi_dmabuf_sync(s->fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+  found = DecStreamScan(s, wrPos);
+  if (!found) {
+    jdi_dmabuf_sync(s->fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+    pthread_mutex_lock(&s->lock);
+    // Bytes ahead of a SOI are of no use, give them back to the producer.
+    // A frame filling the whole ring never completes, drop the ring.
+    if (s->state == STREAM_SEEK_SOI) s->rdPos = s->scanPos;
+    full = s->wrPos - s->rdPos == s->size;
+    if (full) {
+      s->rdPos = s->scanPos = s->wrPos;
+      s->state = STREAM_SEEK_SOI;
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (full) {
+      JLOG(ERR, "%s frame larger than the %u byte ring dropped\n", __func__,
+           s->size);
+      return JPG_RET_INSUFFICIENT_RESOURCE;
+    }
+    return JPG_RET_BIT_EMPTY;
+  }
+
+  // Parse in place at the frame's ring offset, the whole frame is there.
+  frameSize = (Uint32)(s->scanPos - s->frameStart);
+  pDecInfo = &pJpgInst->JpgInfo->decInfo;
+  pDecInfo->streamRingSize = s->size;
+  pDecInfo->streamFd = s->fd;
+  pDecInfo->pBitStream = s->cpu;
+  pDecInfo->frameOffset = (int)(s->frameStart % s->size);
+  pDecInfo->streamBufSize = pDecInfo->frameOffset + frameSize;
+  pDecInfo->streamWrPtr = pDecInfo->streamBufStartAddr;
+  pDecInfo->consumeByte = 0;
+  pDecInfo->ecsPtr = 0;
+  ret = JPU_DecParseInitialInfo(pJpgInst, pDecInfo, &frameInfo);
+  jdi_dmabuf_sync(s->fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+  pDecInfo->pBitStream = NULL;
+  if (ret == JPG_RET_SUCCESS && info) *info = frameInfo;
+
+  if (ret == JPG_RET_SUCCESS && frameBuffer) {
+    image.dmaBuffer.fd = s->fd;
+    image.dmaBuffer.size = s->size;
+    image.imageSize = frameSize;
+    ret = DecRunFrame(pJpgInst, frameBuffer, &image, &outputInfo, NULL, NULL);
+    if (ret == JPG_RET_SUCCESS && !outputInfo.decodingSuccess)
+      ret = JPG_RET_FAILURE;
+  }
+  pDecInfo->streamRingSize = 0;
+  // Without a frame buffer the frame stays for the next call.
+  if (ret == JPG_RET_SUCCESS && !frameBuffer) return ret;
+
+  pthread_mutex_lock(&s->lock);
+  s->rdPos = s->scanPos;
+  s->state = STREAM_SEEK_SOI;
+  pthread_mutex_unlock(&s->lock);
+  return ret;
+}
+
+static JpgDecAsyncCtx *DecAsyncFind(void *handle) {
+  JpgDecAsyncCtx *ctx;
+
+  list_for_each_entry(ctx, &s_asyncList, list) {
+    if (ctx->handle == handle) return ctx;
+  }
+  return NULL;
+}
+
+static void DecAsyncRunJob(JpgDecAsyncCtx *ctx, JpgDecJob *job) {
+  JpgDecInfo *pDecInfo = &ctx->handle->JpgInfo->decInfo;
+  JpgDecOutputInfo outputInfo = {0};
+  int frameIdx = pDecInfo->frameIdx;
+  Uint32 decIdx = pDecInfo->decIdx;
+
+  // The header was parsed at submit time, hand its state to the instance.
+  memcpy(pDecInfo, &job->decInfo, sizeof(JpgDecInfo));
+  pDecInfo->frameIdx = frameIdx;
+  pDecInfo->decIdx = decIdx;
+
+  job->completion.ret = DecRunFrame(ctx->handle, job->frameBuffer,
+                                    job->jpegImageBuffer, &outputInfo, NULL,
+                               NULL);
+  if (job->completion.ret == JPG_RET_SUCCESS && !outputInfo.decodingSuccess)
+    job->completion.ret = JPG_RET_FAILURE;
+  job->completion.frameCycle = outputInfo.frameCycle;
+  job->completion.waitTimeUs = outputInfo.waitTimeUs;
+  job->completion.spinTimeUs = outputInfo.spinTimeUs;
+  job->completion.regWritesIssued = outputInfo.regWritesIssued;
+  job->completion.regWritesElided = outputInfo.regWritesElided;
+}
+
+static void *DecAsyncWorker(void *arg) {
+  JpgDecAsyncCtx *ctx = (JpgDecAsyncCtx *)arg;
+  JpgDecJob *job;
+  JpgDecCallback callback;
+  uint64_t one = 1;
+
+  pthread_mutex_lock(&ctx->lock);
+  while (1) {
+    while (!ctx->quit && list_empty(&ctx->pending))
+      pthread_cond_wait(&ctx->cond, &ctx->lock);
+    if (ctx->quit) break;
+
+    job = list_entry(ctx->pending.next, JpgDecJob, list);
+    list_del(&job->list);
+    pthread_mutex_unlock(&ctx->lock);
+
+    DecAsyncRunJob(ctx, job);
+    jdi_add_queue_depth(ctx->handle->devctx, -1);
+
+    pthread_mutex_lock(&ctx->lock);
+    callback = ctx->callback;
+    if (callback) {
+      pthread_mutex_unlock(&ctx->lock);
+      callback(ctx->handle, &job->completion);
+      free(job);
+      pthread_mutex_lock(&ctx->lock);
+      ctx->numJobs--;
+    } else {
+      list_add_tail(&job->list, &ctx->done);
+      if (write(ctx->eventFd, &one, sizeof(one)) != sizeof(one))
+        JLOG(ERR, "%s eventfd write failed errno=%d\n", __func__, errno);
+    }
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  return NULL;
+}
+
+static JpgDecAsyncCtx *DecAsyncGet(JpgDecInst *handle) {
+  JpgDecAsyncCtx *ctx;
+
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = DecAsyncFind(handle);
+  if (ctx) goto OUT;
+
+  ctx = (JpgDecAsyncCtx *)calloc(1, sizeof(JpgDecAsyncCtx));
+  if (!ctx) goto OUT;
+  ctx->handle = handle;
+  INIT_LIST_HEAD(&ctx->pending);
+  INIT_LIST_HEAD(&ctx->done);
+  memcpy(&ctx->openInfo, &handle->JpgInfo->decInfo, sizeof(JpgDecInfo));
+  ctx->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+  if (ctx->eventFd < 0) {
+    JLOG(ERR, "%s eventfd failed errno=%d\n", __func__, errno);
+    free(ctx);
+    ctx = NULL;
+    goto OUT;
+  }
+  pthread_mutex_init(&ctx->lock, NULL);
+  pthread_cond_init(&ctx->cond, NULL);
+  if (pthread_create(&ctx->worker, NULL, DecAsyncWorker, ctx) != 0) {
+    JLOG(ERR, "%s failed to start worker\n", __func__);
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->lock);
+    close(ctx->eventFd);
+    free(ctx);
+    ctx = NULL;
+    goto OUT;
+  }
+  list_add_tail(&ctx->list, &s_asyncList);
+OUT:
+  pthread_mutex_unlock(&s_asyncLock);
+  return ctx;
+}
+
+/* Completes the frames still queued with JPG_RET_CANCELED, through the
+ * callback or the poll queue. Called with ctx->lock held, which is dropped
+ * around the callback.
+ */
+static void DecAsyncCancelPending(JpgDecAsyncCtx *ctx) {
+  JpgDecJob *job;
+  JpgDecCallback callback;
+  uint64_t one = 1;
+
+  while (!list_empty(&ctx->pending)) {
+    job = list_entry(ctx->pending.next, JpgDecJob, list);
+    list_del(&job->list);
+    jdi_add_queue_depth(ctx->handle->devctx, -1);
+    job->completion.ret = JPG_RET_CANCELED;
+    callback = ctx->callback;
+    if (callback) {
+      pthread_mutex_unlock(&ctx->lock);
+      callback(ctx->handle, &job->completion);
+      free(job);
+      pthread_mutex_lock(&ctx->lock);
+      ctx->numJobs--;
+    } else {
+      list_add_tail(&job->list, &ctx->done);
+      if (write(ctx->eventFd, &one, sizeof(one)) != sizeof(one))
+        JLOG(ERR, "%s eventfd write failed errno=%d\n", __func__, errno);
+    }
+  }
+}
+
+/* First step of close: cancels the queued frames. Without a callback their
+ * completions, and any not polled yet, must be collected with AsrJpuDecPoll
+ * before the handle can go, so this returns FALSE while some are left.
+ */
+static BOOL DecAsyncCancel(void *handle) {
+  JpgDecAsyncCtx *ctx;
+  BOOL idle;
+
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = DecAsyncFind(handle);
+  pthread_mutex_unlock(&s_asyncLock);
+  if (!ctx) return TRUE;
+
+  pthread_mutex_lock(&ctx->lock);
+  DecAsyncCancelPending(ctx);
+  idle = ctx->callback || ctx->numJobs == 0;
+  pthread_mutex_unlock(&ctx->lock);
+  return idle;
+}
+
+static void DecAsyncDestroy(void *handle) {
+  JpgDecAsyncCtx *ctx;
+  JpgDecJob *job, *n;
+
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = DecAsyncFind(handle);
+  if (ctx) list_del(&ctx->list);
+  pthread_mutex_unlock(&s_asyncLock);
+  if (!ctx) return;
+
+  // The frame on the JPU, if any, runs to completion and is delivered before
+  // the join returns.
+  pthread_mutex_lock(&ctx->lock);
+  ctx->quit = TRUE;
+  pthread_cond_signal(&ctx->cond);
+  pthread_mutex_unlock(&ctx->lock);
+  pthread_join(ctx->worker, NULL);
+
+  // Frames submitted while closing.
+  pthread_mutex_lock(&ctx->lock);
+  DecAsyncCancelPending(ctx);
+  pthread_mutex_unlock(&ctx->lock);
+  list_for_each_entry_safe(job, n, &ctx->done, list) { free(job); }
+  pthread_cond_destroy(&ctx->cond);
+  pthread_mutex_destroy(&ctx->lock);
+  close(ctx->eventFd);
+  free(ctx);
+}
+
+/* A session goes back to the pool only with no frame queued or running.
+ * Completions nobody collected are dropped and the callback is cleared,
+ * the worker stays for the next user.
+ */
+static BOOL DecAsyncIdle(void *handle) {
+  JpgDecAsyncCtx *ctx;
+  JpgDecJob *job, *n;
+  uint64_t val;
+  int numDone = 0;
+
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = DecAsyncFind(handle);
+  pthread_mutex_unlock(&s_asyncLock);
+  if (!ctx) return TRUE;
+
+  pthread_mutex_lock(&ctx->lock);
+  list_for_each_entry(job, &ctx->done, list) { numDone++; }
+  if (ctx->numJobs > numDone) {
+    pthread_mutex_unlock(&ctx->lock);
+    return FALSE;
+  }
+  list_for_each_entry_safe(job, n, &ctx->done, list) {
+    list_del(&job->list);
+    free(job);
+  }
+  ctx->numJobs = 0;
+  ctx->callback = NULL;
+  while (read(ctx->eventFd, &val, sizeof(val)) == sizeof(val)) {
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  return TRUE;
+}
+
+JpgRet AsrJpuDecSubmit(void *handle, FrameBufferInfo *frameBuffer,
+                       ImageBufferInfo *jpegImageBuffer, void *userData) {
+  JpgDecAsyncCtx *ctx;
+  JpgDecJob *job;
+  JpgDecInfo *pDecInfo;
+  JpgRet ret;
+
+  if (handle == NULL || frameBuffer == NULL || jpegImageBuffer == NULL) {
+    JLOG(ERR, "%s invalid param !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  ctx = DecAsyncGet((JpgDecInst *)handle);
+  if (!ctx) return JPG_RET_INSUFFICIENT_RESOURCE;
+
+  pthread_mutex_lock(&ctx->lock);
+  if (ctx->numJobs >= JPU_DEC_ASYNC_QUEUE_DEPTH) {
+    pthread_mutex_unlock(&ctx->lock);
+    return JPG_RET_INSUFFICIENT_RESOURCE;
+  }
+  ctx->numJobs++;
+  pthread_mutex_unlock(&ctx->lock);
+
+  job = (JpgDecJob *)malloc(sizeof(JpgDecJob));
+  if (!job) {
+    ret = JPG_RET_INSUFFICIENT_RESOURCE;
+    goto ERR_SUBMIT;
+  }
+  memset(&job->completion, 0x00, sizeof(JpgDecCompletion));
+  job->frameBuffer = frameBuffer;
+  job->jpegImageBuffer = jpegImageBuffer;
+  job->completion.userData = userData;
+  job->completion.frameBuffer = frameBuffer;
+  job->completion.jpegImageBuffer = jpegImageBuffer;
+
+  // Parse the header here, while the worker may still be running the JPU.
+  pDecInfo = &job->decInfo;
+  memcpy(pDecInfo, &ctx->openInfo, sizeof(JpgDecInfo));
+  ret = DecParseStream((JpgDecInst *)handle, jpegImageBuffer, pDecInfo,
+                       &job->completion.info);
+  if (ret != JPG_RET_SUCCESS) {
+    JLOG(ERR, "%s header parse failed Error code is 0x%x\n", __func__, ret);
+    goto ERR_SUBMIT;
+  }
+
+  pthread_mutex_lock(&ctx->lock);
+  list_add_tail(&job->list, &ctx->pending);
+  jdi_add_queue_depth(ctx->handle->devctx, 1);
+  pthread_cond_signal(&ctx->cond);
+  pthread_mutex_unlock(&ctx->lock);
+  return JPG_RET_SUCCESS;
+
+ERR_SUBMIT:
+  free(job);
+  pthread_mutex_lock(&ctx->lock);
+  ctx->numJobs--;
+  pthread_mutex_unlock(&ctx->lock);
+  return ret;
+}
+
+JpgRet AsrJpuDecPoll(void *handle, JpgDecCompletion *completion,
+                     Int32 timeoutMs) {
+  JpgDecAsyncCtx *ctx;
+  JpgDecJob *job;
+  struct pollfd pfd;
+  uint64_t val;
+  int ret;
+
+  if (handle == NULL || completion == NULL) return JPG_RET_INVALID_PARAM;
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = DecAsyncFind(handle);
+  pthread_mutex_unlock(&s_asyncLock);
+  if (!ctx) return JPG_RET_WRONG_CALL_SEQUENCE;
+
+  pfd.fd = ctx->eventFd;
+  pfd.events = POLLIN;
+  do {
+    ret = poll(&pfd, 1, timeoutMs);
+  } while (ret < 0 && errno == EINTR);
+  if (ret <= 0) return JPG_RET_FRAME_NOT_COMPLETE;
+  // Another poller may have taken the completion between poll and read.
+  if (read(ctx->eventFd, &val, sizeof(val)) != sizeof(val))
+    return JPG_RET_FRAME_NOT_COMPLETE;
+
+  pthread_mutex_lock(&ctx->lock);
+  job = list_entry(ctx->done.next, JpgDecJob, list);
+  list_del(&job->list);
+  ctx->numJobs--;
+  pthread_mutex_unlock(&ctx->lock);
+
+  *completion = job->completion;
+  free(job);
+  return JPG_RET_SUCCESS;
+}
+
+Int32 AsrJpuDecGetEventFd(void *handle) {
+  JpgDecAsyncCtx *ctx;
+
+  if (handle == NULL) return -1;
+  ctx = DecAsyncGet((JpgDecInst *)handle);
+  return ctx ? ctx->eventFd : -1;
+}
+
+JpgRet AsrJpuDecSetCallback(void *handle, JpgDecCallback callback) {
+  JpgDecAsyncCtx *ctx;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  ctx = DecAsyncGet((JpgDecInst *)handle);
+  if (!ctx) return JPG_RET_INSUFFICIENT_RESOURCE;
+  pthread_mutex_lock(&ctx->lock);
+  ctx->callback = callback;
+  pthread_mutex_unlock(&ctx->lock);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecRegisterDmaBuf(void *handle, Int32 fd) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  return JPU_RegisterDmaBuf(((JpgInst *)handle)->devctx, fd);
+}
+
+JpgRet AsrJpuDecUnregisterDmaBuf(void *handle, Int32 fd) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  return JPU_UnregisterDmaBuf(((JpgInst *)handle)->devctx, fd);
+}
+
+JpgRet AsrJpuDecGetDmaCfgStats(void *handle, Uint64 *hits, Uint64 *misses) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  JPU_GetDmaCfgStats(((JpgInst *)handle)->devctx, hits, misses);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecSetPriority(void *handle, JpgPriority priority) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  return JPU_SetPriority((JpgHandle)handle, priority);
+}
+
+JpgRet AsrJpuDecGetLockStats(void *handle, JpgLockStats *stats) {
+  if (handle == NULL || stats == NULL) return JPG_RET_INVALID_PARAM;
+  JPU_GetLockStats(((JpgInst *)handle)->devctx, stats);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecGetClockStats(void *handle, Uint64 *onCount, Uint64 *offCount,
+                            Uint32 *wakeLatencyUs, Uint32 *wakeLatencyMaxUs) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  JPU_GetClockStats(((JpgInst *)handle)->devctx, onCount, offCount,
+                    wakeLatencyUs, wakeLatencyMaxUs);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecGetCoreLoad(void *handle, Int32 *core, Int32 *instances,
+                            Int32 *queueDepth) {
+  int devId;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  devId = jdi_get_dev_id(((JpgInst *)handle)->devctx);
+  if (core) *core = devId;
+  return JPU_GetCoreLoad(devId, instances, queueDepth);
+}
+
+typedef struct {
+  struct list_head list;
+  JpgDecInst *handle; /* NULL if the slot has no pooled session */
+  BOOL idle;          /* on an idle list */
+  DecOpenParam param;
+  JpgDecInfo openInfo; /* decInfo as left by open, restored on acquire */
+} JpgDecPoolEntry;
+
+// Sessions opened through the pool, by core and instance index.
+static JpgDecPoolEntry s_decPool[MAX_NUM_JPU_CORE][MAX_NUM_INSTANCE];
+static struct list_head s_decPoolIdle[JPU_SESSION_POOL_BUCKETS];
+static int s_decPoolIdleNum;
+static pthread_mutex_t s_decPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Only the fields AsrJpuDecOpen reads, the others may be left uninitialised.
+static BOOL DecPoolSameParam(const DecOpenParam *a, const DecOpenParam *b) {
+  return a->chromaInterleave == b->chromaInterleave &&
+         a->packedFormat == b->packedFormat;
+}
+
+static struct list_head *DecPoolBucket(const DecOpenParam *param) {
+  Uint32 hash = 2166136261u;
+  int i;
+
+  if (s_decPoolIdle[0].next == NULL) {
+    for (i = 0; i < JPU_SESSION_POOL_BUCKETS; i++)
+      INIT_LIST_HEAD(&s_decPoolIdle[i]);
+  }
+  hash = (hash ^ (Uint32)param->chromaInterleave) * 16777619u;
+  hash = (hash ^ (Uint32)param->packedFormat) * 16777619u;
+  return &s_decPoolIdle[hash % JPU_SESSION_POOL_BUCKETS];
+}
+
+static JpgDecPoolEntry *DecPoolEntryOf(JpgDecInst *handle) {
+  int devId = jdi_get_dev_id(handle->devctx);
+
+  if (devId < 0 || devId >= MAX_NUM_JPU_CORE ||
+      handle->instIndex >= MAX_NUM_INSTANCE)
+    return NULL;
+  return &s_decPool[devId][handle->instIndex];
+}
+
+/* Drops the pooled session of handle from its slot, and from its idle list if
+ * it was closed while idle.
+ */
+static void DecPoolForget(JpgDecInst *handle) {
+  JpgDecPoolEntry *entry = DecPoolEntryOf(handle);
+
+  if (!entry) return;
+  pthread_mutex_lock(&s_decPoolLock);
+  if (entry->handle == handle) {
+    if (entry->idle) {
+      list_del(&entry->list);
+      entry->idle = FALSE;
+      s_decPoolIdleNum--;
+    }
+    entry->handle = NULL;
+  }
+  pthread_mutex_unlock(&s_decPoolLock);
+}
+
 JpgRet AsrJpuDecClose(void *handle) {
   JpgRet ret;
   JpgDecOutputInfo outputInfo;
   JpgInst *pJpgInst;
 
   pJpgInst = (JpgInst *)handle;
+  if (!DecAsyncCancel(handle)) return JPG_RET_FRAME_NOT_COMPLETE;
+  DecPoolForget((JpgDecInst *)handle);
+  DecAsyncDestroy(handle);
+  AsrJpuDecStreamStop(handle);
+  JpuResizeRelease(handle);
   JPU_DecClose(handle);
   JPU_DeInit(pJpgInst->devctx);
   return JPG_RET_SUCCESS;
 }
+
+JpgRet AsrJpuDecAcquire(void **handle, DecOpenParam *param) {
+  JpgDecPoolEntry *entry;
+  struct list_head *bucket;
+  JpgRet ret;
+
+  if (handle == NULL || param == NULL) return JPG_RET_INVALID_PARAM;
+
+  pthread_mutex_lock(&s_decPoolLock);
+  bucket = DecPoolBucket(param);
+  list_for_each_entry(entry, bucket, list) {
+    if (DecPoolSameParam(&entry->param, param)) {
+      list_del(&entry->list);
+      entry->idle = FALSE;
+      s_decPoolIdleNum--;
+      pthread_mutex_unlock(&s_decPoolLock);
+      memcpy(&entry->handle->JpgInfo->decInfo, &entry->openInfo,
+             sizeof(JpgDecInfo));
+      JPU_SetPriority(entry->handle, JPU_PRIORITY_NORMAL);
+      *handle = entry->handle;
+      return JPG_RET_SUCCESS;
+    }
+  }
+  pthread_mutex_unlock(&s_decPoolLock);
+
+  ret = AsrJpuDecOpen(handle, param);
+  if (ret != JPG_RET_SUCCESS) return ret;
+  entry = DecPoolEntryOf((JpgDecInst *)*handle);
+  if (entry) {
+    pthread_mutex_lock(&s_decPoolLock);
+    entry->handle = (JpgDecInst *)*handle;
+    entry->param = *param;
+    memcpy(&entry->openInfo, &entry->handle->JpgInfo->decInfo,
+           sizeof(JpgDecInfo));
+    pthread_mutex_unlock(&s_decPoolLock);
+  }
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuDecRelease(void *handle) {
+  JpgDecPoolEntry *entry;
+  BOOL idle;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  entry = DecPoolEntryOf((JpgDecInst *)handle);
+  if (!entry || entry->handle != handle) return AsrJpuDecClose(handle);
+  pthread_mutex_lock(&s_decPoolLock);
+  idle = entry->idle;
+  pthread_mutex_unlock(&s_decPoolLock);
+  if (idle) return JPG_RET_WRONG_CALL_SEQUENCE;
+  if (!DecAsyncIdle(handle)) return JPG_RET_FRAME_NOT_COMPLETE;
+  AsrJpuDecStreamStop(handle);
+
+  pthread_mutex_lock(&s_decPoolLock);
+  // Released twice from two threads, the other one has queued it.
+  if (entry->idle) {
+    pthread_mutex_unlock(&s_decPoolLock);
+    return JPG_RET_WRONG_CALL_SEQUENCE;
+  }
+  if (s_decPoolIdleNum < JPU_DEC_POOL_IDLE_MAX) {
+    list_add_tail(&entry->list, DecPoolBucket(&entry->param));
+    entry->idle = TRUE;
+    s_decPoolIdleNum++;
+    pthread_mutex_unlock(&s_decPoolLock);
+    return JPG_RET_SUCCESS;
+  }
+  entry->handle = NULL;
+  pthread_mutex_unlock(&s_decPoolLock);
+  return AsrJpuDecClose(handle);
+}
+
+void AsrJpuDecPoolFlush(void) {
+  JpgDecPoolEntry *entry;
+  JpgDecInst *handle;
+  int i;
+
+  // Closed one at a time outside the lock, close takes it.
+  for (;;) {
+    handle = NULL;
+    pthread_mutex_lock(&s_decPoolLock);
+    for (i = 0; i < JPU_SESSION_POOL_BUCKETS && !handle; i++) {
+      if (s_decPoolIdle[i].next == NULL) break;
+      if (list_empty(&s_decPoolIdle[i])) continue;
+      entry = list_entry(s_decPoolIdle[i].next, JpgDecPoolEntry, list);
+      list_del(&entry->list);
+      entry->idle = FALSE;
+      s_decPoolIdleNum--;
+      handle = entry->handle;
+      entry->handle = NULL;
+    }
+    pthread_mutex_unlock(&s_decPoolLock);
+    if (!handle) break;
+    AsrJpuDecClose(handle);
+  }
+}
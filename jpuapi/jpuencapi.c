@@ -4,15 +4,22 @@
  */
 #include "jpuencapi.h"
 
+#include <errno.h>
+#include <linux/dma-buf.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "BufferAllocatorWrapper.h"
 #include "jpuapi.h"
 #include "jpuapifunc.h"
 #include "jpulog.h"
 #include "jputypes.h"
+#include "list.h"
 
 /* CODAJ12 Constraints
  * The minimum value of Qk is 8 for 16bit quantization element, 2 for 8bit
@@ -43,7 +50,7 @@ JpgRet AsrJpuEncOpen(void **handle, EncOpenParam *param) {
   encOpenParam.sourceFormat = param->sourceFormat;
   encOpenParam.jpg12bit = param->jpg12bit;
 
-  ret = JPU_Init(0, &devctx);
+  ret = JPU_InitLeastLoaded(&devctx, NULL);
   if (ret != JPG_RET_SUCCESS && ret != JPG_RET_CALLED_BEFORE) {
     JLOG(ERR, "JPU_Init failed Error code is 0x%x \n", ret);
     goto ERR_ENC_INIT;
@@ -168,12 +175,82 @@ static int JpuEncQualityFactor(JpgEncInfo *encInfo, Uint32 quality,
   return 1;
 }
 
+typedef struct {
+  BYTE *inputDmaBufVir;
+  JpgEncParamSet headerParamSet;
+} JpgEncFrame;
+
+typedef struct {
+  struct list_head list;
+  FrameBufferInfo *frameBuffer;
+  ImageBufferInfo *jpegImageBuffer;
+  JpgEncFrame frame;
+  JpgEncCompletion completion;
+} JpgEncJob;
+
+typedef struct {
+  struct list_head list;
+  JpgEncInst *handle;
+  pthread_t worker;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct list_head pending;
+  struct list_head done;
+  int numJobs; /* pending + running + done, bounded by the queue depth */
+  int eventFd;
+  BOOL quit;
+  JpgEncCallback callback;
+} JpgEncAsyncCtx;
+
+static LIST_HEAD(s_asyncList);
+static pthread_mutex_t s_asyncLock = PTHREAD_MUTEX_INITIALIZER;
+
+static JpgEncAsyncCtx *EncAsyncFind(void *handle) {
+  JpgEncAsyncCtx *ctx;
+
+  list_for_each_entry(ctx, &s_asyncList, list) {
+    if (ctx->handle == handle) return ctx;
+  }
+  return NULL;
+}
+
+/* Frames queued or on the JPU; completed ones waiting to be polled do not
+ * count.
+ */
+static BOOL EncAsyncBusy(void *handle) {
+  JpgEncAsyncCtx *ctx;
+  JpgEncJob *job;
+  int numDone = 0;
+  BOOL busy;
+
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = EncAsyncFind(handle);
+  pthread_mutex_unlock(&s_asyncLock);
+  if (!ctx) return FALSE;
+
+  pthread_mutex_lock(&ctx->lock);
+  list_for_each_entry(job, &ctx->done, list) { numDone++; }
+  busy = ctx->numJobs > numDone;
+  pthread_mutex_unlock(&ctx->lock);
+  return busy;
+}
+
 JpgRet AsrJpuEncSetParam(void *handle, Uint32 parameterIndex, void *value) {
   JpgEncInst *pEncHandler = (JpgEncInst *)handle;
   JpgEncInfo *encInfo = &pEncHandler->JpgInfo->encInfo;
   EncMjpgParam *mjpgParam = NULL;
   int i, j;
 
+  // Queued frames already carry a header written with the current tables,
+  // the JPU must encode them with the same ones.
+  if ((parameterIndex == JPU_QUALITY || parameterIndex == JPU_HUFFMAN_TAB ||
+       parameterIndex == JPU_QUANT_TAB) &&
+      EncAsyncBusy(handle)) {
+    JLOG(ERR, "%s param %d while frames are queued\n", __func__,
+         parameterIndex);
+    return JPG_RET_WRONG_CALL_SEQUENCE;
+  }
+
   mjpgParam = (EncMjpgParam *)malloc(sizeof(EncMjpgParam));
   if (mjpgParam == NULL) {
     JLOG(ERR, "Fail to malloc  mjpgParam !!!\n");
@@ -243,59 +320,96 @@ JpgRet AsrJpuEncSetParam(void *handle, Uint32 parameterIndex, void *value) {
   return JPG_RET_SUCCESS;
 }
 
-JpgRet AsrJpuEncStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
-                              ImageBufferInfo *jpegImageBuffer) {
-  JpgRet ret;
-  if (handle == NULL) {
-    JLOG(INFO, "%s handle NULL !!!\n", __func__);
-    return JPG_RET_INVALID_PARAM;
+/* CPU side of a frame: map the destination and write the JPEG header. */
+static JpgRet EncPrepareFrame(JpgEncInst *JpgEncHandle,
+                              ImageBufferInfo *jpegImageBuffer,
+                              JpgEncFrame *frame) {
+  JpgEncParamSet *headerParamSet = &frame->headerParamSet;
+  int headerSize;
+
+  if (jpegImageBuffer->dmaBuffer.size < 600) {
+    JLOG(INFO, "jpeg image buffer can smaller then header !!!\n");
+    return JPG_RET_FAILURE;
   }
-  JpgEncInst *JpgEncHandle = (JpgEncInst *)handle;
-  JpgEncParamSet headerParamSet;
-  int imageHeaderSize = 0;
-  JpgEncParam encParam = {0};
-  JpgEncOutputInfo outputInfo = {0};
-  BYTE *imageDataPtr = NULL;
-  BYTE *inputDmaBufVir = NULL;
-  int int_reason = 0;
-  encParam.sourceFrame = frameBuffer;
-  headerParamSet.disableAPPMarker =
+  memset(headerParamSet, 0x00, sizeof(JpgEncParamSet));
+  headerParamSet->disableAPPMarker =
       JpgEncHandle->JpgInfo->encInfo.disableAPPMarker;
-  headerParamSet.enableSofStuffing =
+  headerParamSet->enableSofStuffing =
       JpgEncHandle->JpgInfo->encInfo.stuffByteEnable;
-  headerParamSet.disableSOIMarker =
+  headerParamSet->disableSOIMarker =
       JpgEncHandle->JpgInfo->encInfo.disableSOIMarker;
-  headerParamSet.headerMode =
+  headerParamSet->headerMode =
       ENC_HEADER_MODE_NORMAL;  // Encoder header disable/enable control.
                                // Annex:A 1.2.3 item 13
-  headerParamSet.quantMode =
+  headerParamSet->quantMode =
       JPG_TBL_NORMAL;  // JPG_TBL_MERGE    // Merge quantization table.
                        // Annex:A 1.2.3 item 7
-  headerParamSet.huffMode = JPG_TBL_NORMAL;  // JPG_TBL_MERGE    //Merge huffman
-                                             // table. Annex:A 1.2.3 item
-  // headerParamSet.pParaSet = (BYTE
-  // *)mmap(NULL,jpegImageBuffer->dmaBuffer.size,PROT_READ|PROT_WRITE,MAP_SHARED,jpegImageBuffer->dmaBuffer.fd,0);
-  inputDmaBufVir = (BYTE *)mmap(NULL, jpegImageBuffer->dmaBuffer.size,
-                                PROT_READ | PROT_WRITE, MAP_SHARED,
-                                jpegImageBuffer->dmaBuffer.fd, 0);
-  headerParamSet.pParaSet = inputDmaBufVir + jpegImageBuffer->dataOffset;
-  headerParamSet.size =
+  headerParamSet->huffMode =
+      JPG_TBL_NORMAL;  // JPG_TBL_MERGE    //Merge huffman
+                       // table. Annex:A 1.2.3 item
+  // The mapping is kept for the next frame, see jdi_dmabuf_map.
+  frame->inputDmaBufVir = (BYTE *)jdi_dmabuf_map(
+      JpgEncHandle->devctx, jpegImageBuffer->dmaBuffer.fd,
+      jpegImageBuffer->dmaBuffer.size);
+  if (frame->inputDmaBufVir == NULL) {
+    return JPG_RET_INVALID_PARAM;
+  }
+  headerParamSet->pParaSet =
+      frame->inputDmaBufVir + jpegImageBuffer->dataOffset;
+  headerParamSet->size =
       jpegImageBuffer->dmaBuffer.size - jpegImageBuffer->dataOffset;
-  if (jpegImageBuffer->dmaBuffer.size < 600) {
-    JLOG(INFO, "jpeg image buffer can smaller then header !!!\n");
+
+  jdi_dmabuf_sync(jpegImageBuffer->dmaBuffer.fd,
+                  DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+  headerSize = JpgEncEncodeHeader(JpgEncHandle, headerParamSet);
+  jdi_dmabuf_sync(jpegImageBuffer->dmaBuffer.fd,
+                  DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+  if (headerSize <= 0) {
+    JLOG(ERR, "%s encode header failed %d\n", __func__, headerSize);
+    jdi_dmabuf_unmap(JpgEncHandle->devctx, jpegImageBuffer->dmaBuffer.fd,
+                     frame->inputDmaBufVir, jpegImageBuffer->dmaBuffer.size);
+    frame->inputDmaBufVir = NULL;
     return JPG_RET_FAILURE;
   }
+  return JPG_RET_SUCCESS;
+}
 
-  ret = JpgEncEncodeHeader(JpgEncHandle, &headerParamSet);
-  imageHeaderSize = headerParamSet.size;
+static void EncUnmapFrame(JpgEncInst *JpgEncHandle,
+                          ImageBufferInfo *jpegImageBuffer,
+                          JpgEncFrame *frame) {
+  jdi_dmabuf_unmap(JpgEncHandle->devctx, jpegImageBuffer->dmaBuffer.fd,
+                   frame->inputDmaBufVir, jpegImageBuffer->dmaBuffer.size);
+  frame->inputDmaBufVir = NULL;
+}
 
+/* JPU side of a frame: run the core on a prepared frame, locate the EOI and
+ * release the mapping taken by EncPrepareFrame.
+ */
+static JpgRet EncRunFrame(JpgEncInst *JpgEncHandle,
+                          FrameBufferInfo *frameBuffer,
+                          ImageBufferInfo *jpegImageBuffer, JpgEncFrame *frame,
+                          JpgEncOutputInfo *outputInfo) {
+  JpgRet ret;
+  int imageHeaderSize = frame->headerParamSet.size;
+  JpgEncParam encParam = {0};
+  BYTE *imageDataPtr = NULL;
+  int int_reason = 0;
+
+  encParam.sourceFrame = frameBuffer;
   JpgEncHandle->JpgInfo->encInfo.streamFd = jpegImageBuffer->dmaBuffer.fd;
   JpgEncHandle->JpgInfo->encInfo.streamBodyOffset =
       imageHeaderSize + jpegImageBuffer->dataOffset;
   JpgEncHandle->JpgInfo->encInfo.streamSize =
       jpegImageBuffer->dmaBuffer.size -
       JpgEncHandle->JpgInfo->encInfo.streamBodyOffset;
+  JpgEnterLockInst(JpgEncHandle->devctx, JpgEncHandle->instIndex);
   ret = JPU_EncStartOneFrame(JpgEncHandle, &encParam);
+  if (ret != JPG_RET_SUCCESS) {
+    JLOG(ERR, "JPU_EncStartOneFrame failed Error code is 0x%x \n", ret);
+    JpgLeaveLock(JpgEncHandle->devctx);
+    EncUnmapFrame(JpgEncHandle, jpegImageBuffer, frame);
+    return ret;
+  }
 
   while (1) {
     int_reason = JPU_WaitInterrupt(JpgEncHandle, JPU_INTERRUPT_TIMEOUT_MS);
@@ -312,20 +426,27 @@ JpgRet AsrJpuEncStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
     if (int_reason & (1 << INT_JPU_DONE)) {  // Must catch PIC_DONE interrupt
                                              // before catching EMPTY interrupt
       // Do no clear INT_JPU_DONE these will be cleared in JPU_EncGetOutputInfo.
-      outputInfo.intStatus = int_reason;
+      outputInfo->intStatus = int_reason;
       break;
     }
   }
 
-  if ((ret = JPU_EncGetOutputInfo(JpgEncHandle, &outputInfo)) !=
-      JPG_RET_SUCCESS) {
+  // On a timeout JPU_WaitInterrupt already released the pending instance.
+  if (int_reason != -1 &&
+      (ret = JPU_EncGetOutputInfo(JpgEncHandle, outputInfo)) !=
+          JPG_RET_SUCCESS) {
     JLOG(ERR, "JPU_EncGetOutputInfo failed Error code is 0x%x \n", ret);
   }
-  imageDataPtr =
-      headerParamSet.pParaSet + outputInfo.bitstreamSize + imageHeaderSize;
-  while (outputInfo.bitstreamSize) {
+  JpgLeaveLock(JpgEncHandle->devctx);
+  // The tail is read back to find the EOI the core wrote.
+  jdi_dmabuf_sync(jpegImageBuffer->dmaBuffer.fd,
+                  DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+  imageDataPtr = frame->headerParamSet.pParaSet + outputInfo->bitstreamSize +
+                 imageHeaderSize;
+  while (outputInfo->bitstreamSize &&
+         imageDataPtr > frame->headerParamSet.pParaSet + imageHeaderSize) {
     if (*(imageDataPtr) == 0xff) {
-      outputInfo.bitstreamSize--;
+      outputInfo->bitstreamSize--;
       JLOG(DBG, "%s:find stuff byte :%p value:%x\n", __func__, imageDataPtr,
            *imageDataPtr);
     } else if (*(imageDataPtr) == 0xd9 && *(imageDataPtr - 1) == 0xff) {
@@ -334,23 +455,410 @@ JpgRet AsrJpuEncStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
     }
     imageDataPtr--;
   }
-  jpegImageBuffer->imageSize = outputInfo.bitstreamSize + imageHeaderSize;
+  jpegImageBuffer->imageSize = outputInfo->bitstreamSize + imageHeaderSize;
+  jdi_dmabuf_sync(jpegImageBuffer->dmaBuffer.fd,
+                  DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
 
-  munmap((void *)inputDmaBufVir, jpegImageBuffer->dmaBuffer.size);
-  JLOG(DBG, "jpu enc image size:%d \n",
-       outputInfo.bitstreamSize + imageHeaderSize);
+  EncUnmapFrame(JpgEncHandle, jpegImageBuffer, frame);
+  JLOG(DBG,
+       "jpu enc image size:%d cycle:%d wait:%dus spin:%dus regs:%d/%d "
+       "elided\n",
+       outputInfo->bitstreamSize + imageHeaderSize, outputInfo->frameCycle,
+       outputInfo->waitTimeUs, outputInfo->spinTimeUs,
+       outputInfo->regWritesElided,
+       outputInfo->regWritesIssued + outputInfo->regWritesElided);
   if (int_reason == -1 || int_reason & (1 << INT_JPU_ERROR)) {
     ret = JPG_RET_FAILURE;
   }
   return ret;
 }
 
+JpgRet AsrJpuEncStartOneFrame(void *handle, FrameBufferInfo *frameBuffer,
+                              ImageBufferInfo *jpegImageBuffer) {
+  JpgRet ret;
+  JpgEncFrame frame;
+  JpgEncOutputInfo outputInfo = {0};
+
+  if (handle == NULL) {
+    JLOG(INFO, "%s handle NULL !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  ret = EncPrepareFrame((JpgEncInst *)handle, jpegImageBuffer, &frame);
+  if (ret != JPG_RET_SUCCESS) return ret;
+  jdi_add_queue_depth(((JpgEncInst *)handle)->devctx, 1);
+  ret = EncRunFrame((JpgEncInst *)handle, frameBuffer, jpegImageBuffer, &frame,
+                    &outputInfo);
+  jdi_add_queue_depth(((JpgEncInst *)handle)->devctx, -1);
+  return ret;
+}
+
+static void *EncAsyncWorker(void *arg) {
+  JpgEncAsyncCtx *ctx = (JpgEncAsyncCtx *)arg;
+  JpgEncJob *job;
+  JpgEncCallback callback;
+  JpgEncOutputInfo outputInfo;
+  uint64_t one = 1;
+
+  pthread_mutex_lock(&ctx->lock);
+  while (1) {
+    while (!ctx->quit && list_empty(&ctx->pending))
+      pthread_cond_wait(&ctx->cond, &ctx->lock);
+    if (ctx->quit) break;
+
+    job = list_entry(ctx->pending.next, JpgEncJob, list);
+    list_del(&job->list);
+    pthread_mutex_unlock(&ctx->lock);
+
+    memset(&outputInfo, 0x00, sizeof(JpgEncOutputInfo));
+    job->completion.ret =
+        EncRunFrame(ctx->handle, job->frameBuffer, job->jpegImageBuffer,
+                    &job->frame, &outputInfo);
+    jdi_add_queue_depth(ctx->handle->devctx, -1);
+    job->completion.frameCycle = outputInfo.frameCycle;
+    job->completion.waitTimeUs = outputInfo.waitTimeUs;
+    job->completion.spinTimeUs = outputInfo.spinTimeUs;
+    job->completion.regWritesIssued = outputInfo.regWritesIssued;
+    job->completion.regWritesElided = outputInfo.regWritesElided;
+
+    pthread_mutex_lock(&ctx->lock);
+    callback = ctx->callback;
+    if (callback) {
+      pthread_mutex_unlock(&ctx->lock);
+      callback(ctx->handle, &job->completion);
+      free(job);
+      pthread_mutex_lock(&ctx->lock);
+      ctx->numJobs--;
+    } else {
+      list_add_tail(&job->list, &ctx->done);
+      if (write(ctx->eventFd, &one, sizeof(one)) != sizeof(one))
+        JLOG(ERR, "%s eventfd write failed errno=%d\n", __func__, errno);
+    }
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  return NULL;
+}
+
+static JpgEncAsyncCtx *EncAsyncGet(JpgEncInst *handle) {
+  JpgEncAsyncCtx *ctx;
+
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = EncAsyncFind(handle);
+  if (ctx) goto OUT;
+
+  ctx = (JpgEncAsyncCtx *)calloc(1, sizeof(JpgEncAsyncCtx));
+  if (!ctx) goto OUT;
+  ctx->handle = handle;
+  INIT_LIST_HEAD(&ctx->pending);
+  INIT_LIST_HEAD(&ctx->done);
+  ctx->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+  if (ctx->eventFd < 0) {
+    JLOG(ERR, "%s eventfd failed errno=%d\n", __func__, errno);
+    free(ctx);
+    ctx = NULL;
+    goto OUT;
+  }
+  pthread_mutex_init(&ctx->lock, NULL);
+  pthread_cond_init(&ctx->cond, NULL);
+  if (pthread_create(&ctx->worker, NULL, EncAsyncWorker, ctx) != 0) {
+    JLOG(ERR, "%s failed to start worker\n", __func__);
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->lock);
+    close(ctx->eventFd);
+    free(ctx);
+    ctx = NULL;
+    goto OUT;
+  }
+  list_add_tail(&ctx->list, &s_asyncList);
+OUT:
+  pthread_mutex_unlock(&s_asyncLock);
+  return ctx;
+}
+
+static void EncAsyncDestroy(void *handle) {
+  JpgEncAsyncCtx *ctx;
+  JpgEncJob *job, *n;
+
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = EncAsyncFind(handle);
+  if (ctx) list_del(&ctx->list);
+  pthread_mutex_unlock(&s_asyncLock);
+  if (!ctx) return;
+
+  // The frame on the JPU, if any, runs to completion before the join returns.
+  pthread_mutex_lock(&ctx->lock);
+  ctx->quit = TRUE;
+  pthread_cond_signal(&ctx->cond);
+  pthread_mutex_unlock(&ctx->lock);
+  pthread_join(ctx->worker, NULL);
+
+  list_for_each_entry_safe(job, n, &ctx->pending, list) {
+    jdi_add_queue_depth(ctx->handle->devctx, -1);
+    EncUnmapFrame(ctx->handle, job->jpegImageBuffer, &job->frame);
+    free(job);
+  }
+  list_for_each_entry_safe(job, n, &ctx->done, list) { free(job); }
+  pthread_cond_destroy(&ctx->cond);
+  pthread_mutex_destroy(&ctx->lock);
+  close(ctx->eventFd);
+  free(ctx);
+}
+
+/* A session goes back to the pool only with no frame queued or running.
+ * Completions nobody collected are dropped and the callback is cleared,
+ * the worker stays for the next user.
+ */
+static BOOL EncAsyncIdle(void *handle) {
+  JpgEncAsyncCtx *ctx;
+  JpgEncJob *job, *n;
+  uint64_t val;
+  int numDone = 0;
+
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = EncAsyncFind(handle);
+  pthread_mutex_unlock(&s_asyncLock);
+  if (!ctx) return TRUE;
+
+  pthread_mutex_lock(&ctx->lock);
+  list_for_each_entry(job, &ctx->done, list) { numDone++; }
+  if (ctx->numJobs > numDone) {
+    pthread_mutex_unlock(&ctx->lock);
+    return FALSE;
+  }
+  list_for_each_entry_safe(job, n, &ctx->done, list) {
+    list_del(&job->list);
+    free(job);
+  }
+  ctx->numJobs = 0;
+  ctx->callback = NULL;
+  while (read(ctx->eventFd, &val, sizeof(val)) == sizeof(val)) {
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  return TRUE;
+}
+
+JpgRet AsrJpuEncSubmit(void *handle, FrameBufferInfo *frameBuffer,
+                       ImageBufferInfo *jpegImageBuffer, void *userData) {
+  JpgEncAsyncCtx *ctx;
+  JpgEncJob *job;
+  JpgRet ret;
+
+  if (handle == NULL || frameBuffer == NULL || jpegImageBuffer == NULL) {
+    JLOG(ERR, "%s invalid param !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+  ctx = EncAsyncGet((JpgEncInst *)handle);
+  if (!ctx) return JPG_RET_INSUFFICIENT_RESOURCE;
+
+  pthread_mutex_lock(&ctx->lock);
+  if (ctx->numJobs >= JPU_ENC_ASYNC_QUEUE_DEPTH) {
+    pthread_mutex_unlock(&ctx->lock);
+    return JPG_RET_INSUFFICIENT_RESOURCE;
+  }
+  ctx->numJobs++;
+  pthread_mutex_unlock(&ctx->lock);
+
+  job = (JpgEncJob *)calloc(1, sizeof(JpgEncJob));
+  if (!job) {
+    ret = JPG_RET_INSUFFICIENT_RESOURCE;
+    goto ERR_SUBMIT;
+  }
+  job->frameBuffer = frameBuffer;
+  job->jpegImageBuffer = jpegImageBuffer;
+  job->completion.userData = userData;
+  job->completion.frameBuffer = frameBuffer;
+  job->completion.jpegImageBuffer = jpegImageBuffer;
+
+  // Write the header here, while the worker may still be running the JPU.
+  ret = EncPrepareFrame((JpgEncInst *)handle, jpegImageBuffer, &job->frame);
+  if (ret != JPG_RET_SUCCESS) goto ERR_SUBMIT;
+
+  pthread_mutex_lock(&ctx->lock);
+  list_add_tail(&job->list, &ctx->pending);
+  jdi_add_queue_depth(ctx->handle->devctx, 1);
+  pthread_cond_signal(&ctx->cond);
+  pthread_mutex_unlock(&ctx->lock);
+  return JPG_RET_SUCCESS;
+
+ERR_SUBMIT:
+  free(job);
+  pthread_mutex_lock(&ctx->lock);
+  ctx->numJobs--;
+  pthread_mutex_unlock(&ctx->lock);
+  return ret;
+}
+
+JpgRet AsrJpuEncPoll(void *handle, JpgEncCompletion *completion,
+                     Int32 timeoutMs) {
+  JpgEncAsyncCtx *ctx;
+  JpgEncJob *job;
+  struct pollfd pfd;
+  uint64_t val;
+  int ret;
+
+  if (handle == NULL || completion == NULL) return JPG_RET_INVALID_PARAM;
+  pthread_mutex_lock(&s_asyncLock);
+  ctx = EncAsyncFind(handle);
+  pthread_mutex_unlock(&s_asyncLock);
+  if (!ctx) return JPG_RET_WRONG_CALL_SEQUENCE;
+
+  pfd.fd = ctx->eventFd;
+  pfd.events = POLLIN;
+  do {
+    ret = poll(&pfd, 1, timeoutMs);
+  } while (ret < 0 && errno == EINTR);
+  if (ret <= 0) return JPG_RET_FRAME_NOT_COMPLETE;
+  // Another poller may have taken the completion between poll and read.
+  if (read(ctx->eventFd, &val, sizeof(val)) != sizeof(val))
+    return JPG_RET_FRAME_NOT_COMPLETE;
+
+  pthread_mutex_lock(&ctx->lock);
+  job = list_entry(ctx->done.next, JpgEncJob, list);
+  list_del(&job->list);
+  ctx->numJobs--;
+  pthread_mutex_unlock(&ctx->lock);
+
+  *completion = job->completion;
+  free(job);
+  return JPG_RET_SUCCESS;
+}
+
+Int32 AsrJpuEncGetEventFd(void *handle) {
+  JpgEncAsyncCtx *ctx;
+
+  if (handle == NULL) return -1;
+  ctx = EncAsyncGet((JpgEncInst *)handle);
+  return ctx ? ctx->eventFd : -1;
+}
+
+JpgRet AsrJpuEncSetCallback(void *handle, JpgEncCallback callback) {
+  JpgEncAsyncCtx *ctx;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  ctx = EncAsyncGet((JpgEncInst *)handle);
+  if (!ctx) return JPG_RET_INSUFFICIENT_RESOURCE;
+  pthread_mutex_lock(&ctx->lock);
+  ctx->callback = callback;
+  pthread_mutex_unlock(&ctx->lock);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuEncRegisterDmaBuf(void *handle, Int32 fd) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  return JPU_RegisterDmaBuf(((JpgInst *)handle)->devctx, fd);
+}
+
+JpgRet AsrJpuEncUnregisterDmaBuf(void *handle, Int32 fd) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  return JPU_UnregisterDmaBuf(((JpgInst *)handle)->devctx, fd);
+}
+
+JpgRet AsrJpuEncGetDmaCfgStats(void *handle, Uint64 *hits, Uint64 *misses) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  JPU_GetDmaCfgStats(((JpgInst *)handle)->devctx, hits, misses);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuEncSetPriority(void *handle, JpgPriority priority) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  return JPU_SetPriority((JpgHandle)handle, priority);
+}
+
+JpgRet AsrJpuEncGetLockStats(void *handle, JpgLockStats *stats) {
+  if (handle == NULL || stats == NULL) return JPG_RET_INVALID_PARAM;
+  JPU_GetLockStats(((JpgInst *)handle)->devctx, stats);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuEncGetClockStats(void *handle, Uint64 *onCount, Uint64 *offCount,
+                            Uint32 *wakeLatencyUs, Uint32 *wakeLatencyMaxUs) {
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  JPU_GetClockStats(((JpgInst *)handle)->devctx, onCount, offCount,
+                    wakeLatencyUs, wakeLatencyMaxUs);
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuEncGetCoreLoad(void *handle, Int32 *core, Int32 *instances,
+                            Int32 *queueDepth) {
+  int devId;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  devId = jdi_get_dev_id(((JpgInst *)handle)->devctx);
+  if (core) *core = devId;
+  return JPU_GetCoreLoad(devId, instances, queueDepth);
+}
+
+typedef struct {
+  struct list_head list;
+  JpgEncInst *handle; /* NULL if the slot has no pooled session */
+  BOOL idle;          /* on an idle list */
+  EncOpenParam param;
+  JpgEncInfo openInfo; /* encInfo as left by open, restored on acquire */
+} JpgEncPoolEntry;
+
+// Sessions opened through the pool, by core and instance index.
+static JpgEncPoolEntry s_encPool[MAX_NUM_JPU_CORE][MAX_NUM_INSTANCE];
+static struct list_head s_encPoolIdle[JPU_SESSION_POOL_BUCKETS];
+static int s_encPoolIdleNum;
+static pthread_mutex_t s_encPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static BOOL EncPoolSameParam(const EncOpenParam *a, const EncOpenParam *b) {
+  return a->picWidth == b->picWidth && a->picHeight == b->picHeight &&
+         a->sourceFormat == b->sourceFormat &&
+         a->packedFormat == b->packedFormat &&
+         a->chromaInterleave == b->chromaInterleave &&
+         a->jpg12bit == b->jpg12bit;
+}
+
+static struct list_head *EncPoolBucket(const EncOpenParam *param) {
+  Uint32 hash = 2166136261u;
+  int i;
+
+  if (s_encPoolIdle[0].next == NULL) {
+    for (i = 0; i < JPU_SESSION_POOL_BUCKETS; i++)
+      INIT_LIST_HEAD(&s_encPoolIdle[i]);
+  }
+  hash = (hash ^ param->picWidth) * 16777619u;
+  hash = (hash ^ param->picHeight) * 16777619u;
+  hash = (hash ^ (Uint32)param->sourceFormat) * 16777619u;
+  return &s_encPoolIdle[hash % JPU_SESSION_POOL_BUCKETS];
+}
+
+static JpgEncPoolEntry *EncPoolEntryOf(JpgEncInst *handle) {
+  int devId = jdi_get_dev_id(handle->devctx);
+
+  if (devId < 0 || devId >= MAX_NUM_JPU_CORE ||
+      handle->instIndex >= MAX_NUM_INSTANCE)
+    return NULL;
+  return &s_encPool[devId][handle->instIndex];
+}
+
+/* Drops the pooled session of handle from its slot, and from its idle list if
+ * it was closed while idle.
+ */
+static void EncPoolForget(JpgEncInst *handle) {
+  JpgEncPoolEntry *entry = EncPoolEntryOf(handle);
+
+  if (!entry) return;
+  pthread_mutex_lock(&s_encPoolLock);
+  if (entry->handle == handle) {
+    if (entry->idle) {
+      list_del(&entry->list);
+      entry->idle = FALSE;
+      s_encPoolIdleNum--;
+    }
+    entry->handle = NULL;
+  }
+  pthread_mutex_unlock(&s_encPoolLock);
+}
+
 JpgRet AsrJpuEncClose(void *handle) {
   JpgRet ret;
   JpgEncOutputInfo outputInfo = {0};
   JpgInst *pJpgInst;
 
   pJpgInst = (JpgInst *)handle;
+  EncPoolForget((JpgEncInst *)handle);
+  EncAsyncDestroy(handle);
 
   if (JPU_EncClose(handle) == JPG_RET_FRAME_NOT_COMPLETE) {
     JPU_EncGetOutputInfo(handle, &outputInfo);
@@ -359,4 +867,98 @@ JpgRet AsrJpuEncClose(void *handle) {
 
   JPU_DeInit(pJpgInst->devctx);
   return JPG_RET_SUCCESS;
-}
\ No newline at end of file
+}
+
+JpgRet AsrJpuEncAcquire(void **handle, EncOpenParam *param) {
+  JpgEncPoolEntry *entry;
+  struct list_head *bucket;
+  JpgRet ret;
+
+  if (handle == NULL || param == NULL) return JPG_RET_INVALID_PARAM;
+
+  pthread_mutex_lock(&s_encPoolLock);
+  bucket = EncPoolBucket(param);
+  list_for_each_entry(entry, bucket, list) {
+    if (EncPoolSameParam(&entry->param, param)) {
+      list_del(&entry->list);
+      entry->idle = FALSE;
+      s_encPoolIdleNum--;
+      pthread_mutex_unlock(&s_encPoolLock);
+      memcpy(&entry->handle->JpgInfo->encInfo, &entry->openInfo,
+             sizeof(JpgEncInfo));
+      JPU_SetPriority(entry->handle, JPU_PRIORITY_NORMAL);
+      *handle = entry->handle;
+      return JPG_RET_SUCCESS;
+    }
+  }
+  pthread_mutex_unlock(&s_encPoolLock);
+
+  ret = AsrJpuEncOpen(handle, param);
+  if (ret != JPG_RET_SUCCESS) return ret;
+  entry = EncPoolEntryOf((JpgEncInst *)*handle);
+  if (entry) {
+    pthread_mutex_lock(&s_encPoolLock);
+    entry->handle = (JpgEncInst *)*handle;
+    entry->param = *param;
+    memcpy(&entry->openInfo, &entry->handle->JpgInfo->encInfo,
+           sizeof(JpgEncInfo));
+    pthread_mutex_unlock(&s_encPoolLock);
+  }
+  return JPG_RET_SUCCESS;
+}
+
+JpgRet AsrJpuEncRelease(void *handle) {
+  JpgEncPoolEntry *entry;
+  BOOL idle;
+
+  if (handle == NULL) return JPG_RET_INVALID_PARAM;
+  entry = EncPoolEntryOf((JpgEncInst *)handle);
+  if (!entry || entry->handle != handle) return AsrJpuEncClose(handle);
+  pthread_mutex_lock(&s_encPoolLock);
+  idle = entry->idle;
+  pthread_mutex_unlock(&s_encPoolLock);
+  if (idle) return JPG_RET_WRONG_CALL_SEQUENCE;
+  if (!EncAsyncIdle(handle)) return JPG_RET_FRAME_NOT_COMPLETE;
+
+  pthread_mutex_lock(&s_encPoolLock);
+  // Released twice from two threads, the other one has queued it.
+  if (entry->idle) {
+    pthread_mutex_unlock(&s_encPoolLock);
+    return JPG_RET_WRONG_CALL_SEQUENCE;
+  }
+  if (s_encPoolIdleNum < JPU_ENC_POOL_IDLE_MAX) {
+    list_add_tail(&entry->list, EncPoolBucket(&entry->param));
+    entry->idle = TRUE;
+    s_encPoolIdleNum++;
+    pthread_mutex_unlock(&s_encPoolLock);
+    return JPG_RET_SUCCESS;
+  }
+  entry->handle = NULL;
+  pthread_mutex_unlock(&s_encPoolLock);
+  return AsrJpuEncClose(handle);
+}
+
+void AsrJpuEncPoolFlush(void) {
+  JpgEncPoolEntry *entry;
+  JpgEncInst *handle;
+  int i;
+
+  // Closed one at a time outside the lock, close takes it.
+  for (;;) {
+    handle = NULL;
+    pthread_mutex_lock(&s_encPoolLock);
+    for (i = 0; i < JPU_SESSION_POOL_BUCKETS && !handle; i++) {
+      if (s_encPoolIdle[i].next == NULL) break;
+      if (list_empty(&s_encPoolIdle[i])) continue;
+      entry = list_entry(s_encPoolIdle[i].next, JpgEncPoolEntry, list);
+      list_del(&entry->list);
+      entry->idle = FALSE;
+      s_encPoolIdleNum--;
+      handle = entry->handle;
+      entry->handle = NULL;
+    }
+    pthread_mutex_unlock(&s_encPoolLock);
+    if (!handle) break;
+    AsrJpuEncClose(handle);
+  }
+}
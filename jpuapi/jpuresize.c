@@ -0,0 +1,559 @@
+/*
+ * Copyright (C) 2019 ASR Micro Limited
+ * All Rights Reserved.
+ */
+
+/* Exact size resize of decoded pictures on the CPU, the step after the 1/2^n
+ * scaler of the core. Separable: each output row is a weighted sum of
+ * source rows that are first filtered horizontally. The filter is a
+ * triangle as wide as the scale ratio, an area average when shrinking and
+ * bilinear when growing. Output rows of large pictures are split in bands,
+ * one per thread. The threads belong to the decoder handle, they are started
+ * by its first large resize and joined when it is closed.
+ */
+
+#include <linux/dma-buf.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jpuapi.h"
+#include "jpuapifunc.h"
+#include "jpudecapi.h"
+#include "jpulog.h"
+#include "jputypes.h"
+#include "list.h"
+
+#define RESIZE_COEF_BITS 14 /* filter weights, both passes */
+#define RESIZE_HOR_SHIFT 8  /* horizontal pass keeps 6 fractional bits */
+#define RESIZE_VER_SHIFT (2 * RESIZE_COEF_BITS - RESIZE_HOR_SHIFT)
+
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9)
+#define RESIZE_SIMD
+#define RESIZE_LANES 8
+typedef Int16 ResizeVecS16 __attribute__((vector_size(16)));
+typedef Int32 ResizeVecS32 __attribute__((vector_size(32)));
+typedef Uint8 ResizeVecU8 __attribute__((vector_size(8)));
+#endif
+
+typedef struct {
+  Uint32 numTaps; /* weights per output sample */
+  Int32 *start;   /* first source sample of each output sample */
+  Int16 *coef;    /* numTaps weights of each output sample, sum 1 << 14 */
+} ResizeFilter;
+
+typedef struct {
+  const BYTE *src;
+  Uint32 srcStride;
+  Uint32 srcStep; /* bytes between samples, 2 for interleaved chroma */
+  Uint32 srcWidth;
+  Uint32 srcHeight;
+  BYTE *dst;
+  Uint32 dstStride;
+  Uint32 dstStep;
+  Uint32 dstWidth;
+  Uint32 dstHeight;
+  const ResizeFilter *hor;
+  const ResizeFilter *ver;
+} ResizePlane;
+
+typedef struct {
+  ResizePlane *planes;
+  Uint32 numPlanes;
+  Uint32 band;
+  Uint32 numBands;
+  JpgRet ret;
+} ResizeBand;
+
+struct ResizePool;
+
+typedef struct {
+  struct ResizePool *pool;
+  Uint32 band; /* band this thread takes, the caller takes band 0 */
+} ResizeWorker;
+
+typedef struct ResizePool {
+  struct list_head list;
+  void *handle;
+  pthread_mutex_t lock;
+  pthread_cond_t start; /* seq moved on or quit set */
+  pthread_cond_t done;  /* pending dropped to 0 */
+  pthread_t threads[JPU_RESIZE_MAX_THREADS - 1];
+  ResizeWorker workers[JPU_RESIZE_MAX_THREADS - 1];
+  Uint32 numThreads;
+  ResizeBand *bands;
+  Uint32 numBands;
+  Uint32 pending; /* bands handed to the threads and not done yet */
+  Uint32 seq;
+  BOOL quit;
+} ResizePool;
+
+static LIST_HEAD(s_resizePoolList);
+static pthread_mutex_t s_resizePoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static Int32 ResizeFloor(double v) {
+  Int32 i = (Int32)v;
+  return i > v ? i - 1 : i;
+}
+
+static void ResizeFilterFree(ResizeFilter *f) {
+  free(f->start);
+  free(f->coef);
+  memset(f, 0x00, sizeof(ResizeFilter));
+}
+
+/* Weights of a srcSize to dstSize resampling. Taps falling off an edge are
+ * folded onto the edge sample, and every window is kept inside the source
+ * so that the passes never clamp.
+ */
+static BOOL ResizeFilterInit(ResizeFilter *f, Uint32 srcSize, Uint32 dstSize) {
+  double scale = (double)srcSize / dstSize;
+  double radius = scale > 1.0 ? scale : 1.0;
+  double center, *w, sum;
+  Int32 lo, i, k, idx, best, total;
+  Uint32 x;
+
+  f->numTaps = (Uint32)-ResizeFloor(-2 * radius) + 1;
+  if (f->numTaps > srcSize) f->numTaps = srcSize;
+  f->start = (Int32 *)malloc(sizeof(Int32) * dstSize);
+  f->coef = (Int16 *)calloc(f->numTaps * dstSize, sizeof(Int16));
+  w = (double *)malloc(sizeof(double) * f->numTaps);
+  if (!f->start || !f->coef || !w) {
+    free(w);
+    ResizeFilterFree(f);
+    return FALSE;
+  }
+
+  for (x = 0; x < dstSize; x++) {
+    center = (x + 0.5) * scale - 0.5;
+    lo = ResizeFloor(center - radius) + 1;
+    f->start[x] = lo < 0 ? 0 : lo;
+    if (f->start[x] > (Int32)(srcSize - f->numTaps))
+      f->start[x] = srcSize - f->numTaps;
+
+    memset(w, 0x00, sizeof(double) * f->numTaps);
+    sum = 0;
+    for (i = lo; i <= ResizeFloor(center + radius); i++) {
+      double d = 1.0 - (i > center ? i - center : center - i) / radius;
+      if (d <= 0) continue;
+      idx = i < 0 ? 0 : (i >= (Int32)srcSize ? (Int32)srcSize - 1 : i);
+      w[idx - f->start[x]] += d;
+      sum += d;
+    }
+    // Rounded to fixed point, the error goes to the largest weight.
+    total = 0;
+    best = 0;
+    for (k = 0; k < (Int32)f->numTaps; k++) {
+      f->coef[x * f->numTaps + k] =
+          (Int16)ResizeFloor(w[k] / sum * (1 << RESIZE_COEF_BITS) + 0.5);
+      total += f->coef[x * f->numTaps + k];
+      if (w[k] > w[best]) best = k;
+    }
+    f->coef[x * f->numTaps + best] += (1 << RESIZE_COEF_BITS) - total;
+  }
+  free(w);
+  return TRUE;
+}
+
+static void ResizeRowHor(const ResizePlane *p, const BYTE *src, Int16 *dst) {
+  const ResizeFilter *f = p->hor;
+  const Int16 *coef = f->coef;
+  const BYTE *s;
+  Uint32 x, k;
+  Int32 acc;
+
+  for (x = 0; x < p->dstWidth; x++, coef += f->numTaps) {
+    s = src + f->start[x] * p->srcStep;
+    acc = 0;
+    for (k = 0; k < f->numTaps; k++, s += p->srcStep) acc += coef[k] * *s;
+    dst[x] = (Int16)((acc + (1 << (RESIZE_HOR_SHIFT - 1))) >> RESIZE_HOR_SHIFT);
+  }
+}
+
+static BYTE ResizeClip(Int32 acc) {
+  acc = (acc + (1 << (RESIZE_VER_SHIFT - 1))) >> RESIZE_VER_SHIFT;
+  return (BYTE)(acc < 0 ? 0 : (acc > 255 ? 255 : acc));
+}
+
+/* Weighted sum of numTaps horizontally filtered rows. */
+static void ResizeRowVer(const ResizePlane *p, Int16 **rows,
+                         const Int16 *coef, BYTE *dst) {
+  Uint32 numTaps = p->ver->numTaps;
+  Uint32 x = 0, k;
+  Int32 acc;
+
+#ifdef RESIZE_SIMD
+  if (p->dstStep == 1) {
+    const ResizeVecS32 zero = {0}, max = zero + 255,
+                       round = zero + (1 << (RESIZE_VER_SHIFT - 1));
+    ResizeVecS16 in;
+    ResizeVecS32 vacc;
+    ResizeVecU8 out;
+
+    for (; x + RESIZE_LANES <= p->dstWidth; x += RESIZE_LANES) {
+      vacc = round;
+      for (k = 0; k < numTaps; k++) {
+        memcpy(&in, rows[k] + x, sizeof(in));
+        vacc += __builtin_convertvector(in, ResizeVecS32) * coef[k];
+      }
+      vacc >>= RESIZE_VER_SHIFT;
+      vacc &= ~(vacc >> 31);
+      vacc = (vacc & ~(vacc > max)) | (max & (vacc > max));
+      out = __builtin_convertvector(vacc, ResizeVecU8);
+      memcpy(dst + x, &out, sizeof(out));
+    }
+  }
+#endif
+  for (; x < p->dstWidth; x++) {
+    acc = 0;
+    for (k = 0; k < numTaps; k++) acc += coef[k] * rows[k][x];
+    dst[x * p->dstStep] = ResizeClip(acc);
+  }
+}
+
+/* Resizes the rows of one band of a plane. The horizontally filtered source
+ * rows are kept in a ring of numTaps rows, a source row lands in slot row %
+ * numTaps, so rows shared by consecutive output rows are filtered once.
+ */
+static BOOL ResizePlaneBand(const ResizePlane *p, Uint32 band,
+                            Uint32 numBands) {
+  Uint32 numTaps = p->ver->numTaps;
+  Uint32 y0 = (Uint32)((Uint64)p->dstHeight * band / numBands);
+  Uint32 y1 = (Uint32)((Uint64)p->dstHeight * (band + 1) / numBands);
+  Int16 *ring, **rows;
+  Int32 *ringRow;
+  Uint32 y, k, row, slot;
+
+  ring = (Int16 *)malloc(sizeof(Int16) * numTaps * p->dstWidth);
+  ringRow = (Int32 *)malloc(sizeof(Int32) * numTaps);
+  rows = (Int16 **)malloc(sizeof(Int16 *) * numTaps);
+  if (!ring || !ringRow || !rows) {
+    free(ring);
+    free(ringRow);
+    free(rows);
+    return FALSE;
+  }
+  for (k = 0; k < numTaps; k++) ringRow[k] = -1;
+
+  for (y = y0; y < y1; y++) {
+    for (k = 0; k < numTaps; k++) {
+      row = p->ver->start[y] + k;
+      slot = row % numTaps;
+      rows[k] = ring + slot * p->dstWidth;
+      if (ringRow[slot] != (Int32)row) {
+        ResizeRowHor(p, p->src + row * p->srcStride, rows[k]);
+        ringRow[slot] = row;
+      }
+    }
+    ResizeRowVer(p, rows, p->ver->coef + y * numTaps,
+                 p->dst + y * p->dstStride);
+  }
+
+  free(ring);
+  free(ringRow);
+  free(rows);
+  return TRUE;
+}
+
+static void *ResizeBandWorker(void *arg) {
+  ResizeBand *b = (ResizeBand *)arg;
+  Uint32 i;
+
+  b->ret = JPG_RET_SUCCESS;
+  for (i = 0; i < b->numPlanes; i++) {
+    if (!ResizePlaneBand(&b->planes[i], b->band, b->numBands))
+      b->ret = JPG_RET_INSUFFICIENT_RESOURCE;
+  }
+  return NULL;
+}
+
+static void *ResizePoolThread(void *arg) {
+  ResizeWorker *w = (ResizeWorker *)arg;
+  ResizePool *pool = w->pool;
+  Uint32 seq = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->quit && pool->seq == seq)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->quit) break;
+    seq = pool->seq;
+    if (w->band >= pool->numBands) continue;
+    pthread_mutex_unlock(&pool->lock);
+    ResizeBandWorker(&pool->bands[w->band]);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static void ResizePoolFree(ResizePool *pool) {
+  Uint32 i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = TRUE;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->numThreads; i++) pthread_join(pool->threads[i], NULL);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+/* Threads of the handle, started on first use. NULL, or fewer threads than
+ * asked for, when they cannot be created, the caller runs the rest.
+ */
+static ResizePool *ResizePoolGet(void *handle, Uint32 numThreads) {
+  ResizePool *pool;
+
+  pthread_mutex_lock(&s_resizePoolLock);
+  list_for_each_entry(pool, &s_resizePoolList, list) {
+    if (pool->handle == handle) {
+      pthread_mutex_unlock(&s_resizePoolLock);
+      return pool;
+    }
+  }
+  pool = (ResizePool *)calloc(1, sizeof(ResizePool));
+  if (pool == NULL) {
+    pthread_mutex_unlock(&s_resizePoolLock);
+    return NULL;
+  }
+  pool->handle = handle;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (; pool->numThreads < numThreads; pool->numThreads++) {
+    ResizeWorker *w = &pool->workers[pool->numThreads];
+
+    w->pool = pool;
+    w->band = pool->numThreads + 1;
+    if (pthread_create(&pool->threads[pool->numThreads], NULL,
+                       ResizePoolThread, w) != 0)
+      break;
+  }
+  list_add_tail(&pool->list, &s_resizePoolList);
+  pthread_mutex_unlock(&s_resizePoolLock);
+  return pool;
+}
+
+void JpuResizeRelease(void *handle) {
+  ResizePool *pool;
+
+  pthread_mutex_lock(&s_resizePoolLock);
+  list_for_each_entry(pool, &s_resizePoolList, list) {
+    if (pool->handle == handle) {
+      list_del(&pool->list);
+      pthread_mutex_unlock(&s_resizePoolLock);
+      ResizePoolFree(pool);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&s_resizePoolLock);
+}
+
+/* Runs the bands on the pool threads and the caller, the bands without a
+ * thread run on the caller too.
+ */
+static void ResizeRun(ResizePool *pool, ResizeBand *bands, Uint32 numBands) {
+  Uint32 numThreads = pool ? pool->numThreads : 0, i;
+
+  if (numThreads > numBands - 1) numThreads = numBands - 1;
+  if (numThreads) {
+    pthread_mutex_lock(&pool->lock);
+    pool->bands = bands;
+    pool->numBands = numThreads + 1;
+    pool->pending = numThreads;
+    pool->seq++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  ResizeBandWorker(&bands[0]);
+  for (i = numThreads + 1; i < numBands; i++) ResizeBandWorker(&bands[i]);
+  if (numThreads) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending) pthread_cond_wait(&pool->done, &pool->lock);
+    pool->bands = NULL;
+    pool->numBands = 0;
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/* Chroma size of a width x height picture, 0 for grayscale. */
+static BOOL ResizeChromaSize(FrameFormat format, Uint32 width, Uint32 height,
+                             Uint32 *chromaWidth, Uint32 *chromaHeight) {
+  switch (format) {
+    case FORMAT_420:
+      *chromaWidth = (width + 1) / 2;
+      *chromaHeight = (height + 1) / 2;
+      break;
+    case FORMAT_422:
+      *chromaWidth = (width + 1) / 2;
+      *chromaHeight = height;
+      break;
+    case FORMAT_440:
+      *chromaWidth = width;
+      *chromaHeight = (height + 1) / 2;
+      break;
+    case FORMAT_444:
+      *chromaWidth = width;
+      *chromaHeight = height;
+      break;
+    case FORMAT_400:
+      *chromaWidth = *chromaHeight = 0;
+      break;
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Whether every plane of a width x height picture fits its stride and the
+ * dma-buf, chroma planes being chromaWidth x chromaHeight.
+ */
+static BOOL ResizeFrameFits(const FrameBufferInfo *fb, Uint32 width,
+                            Uint32 height, Uint32 chromaWidth,
+                            Uint32 chromaHeight) {
+  Uint64 size = fb->dmaBuffer.size;
+  Uint32 step = fb->vOffset == 0 ? 2 : 1;
+
+  if (fb->stride < width ||
+      fb->yOffset + (Uint64)fb->stride * height > size)
+    return FALSE;
+  if (!chromaWidth) return TRUE;
+  if (fb->strideC < chromaWidth * step ||
+      fb->uOffset + (Uint64)fb->strideC * chromaHeight > size)
+    return FALSE;
+  return step == 2 ||
+         fb->vOffset + (Uint64)fb->strideC * chromaHeight <= size;
+}
+
+/* Fills the Cb and Cr planes, interleaved when the frame has no V plane. */
+static void ResizeChromaPlanes(ResizePlane *cb, const FrameBufferInfo *src,
+                               const BYTE *srcData, const FrameBufferInfo *dst,
+                               BYTE *dstData) {
+  ResizePlane *cr = cb + 1;
+  BOOL srcNV = src->vOffset == 0, dstNV = dst->vOffset == 0;
+
+  cb->srcStride = cr->srcStride = src->strideC;
+  cb->srcStep = cr->srcStep = srcNV ? 2 : 1;
+  cb->src = srcData + src->uOffset;
+  cr->src = srcNV ? cb->src + 1 : srcData + src->vOffset;
+  cb->dstStride = cr->dstStride = dst->strideC;
+  cb->dstStep = cr->dstStep = dstNV ? 2 : 1;
+  cb->dst = dstData + dst->uOffset;
+  cr->dst = dstNV ? cb->dst + 1 : dstData + dst->vOffset;
+}
+
+JpgRet AsrJpuDecResize(void *handle, FrameBufferInfo *src, Uint32 srcWidth,
+                       Uint32 srcHeight, FrameBufferInfo *dst, Uint32 dstWidth,
+                       Uint32 dstHeight) {
+  JpgDecInst *pJpgInst = (JpgDecInst *)handle;
+  ResizeFilter filters[4];
+  ResizePlane planes[3];
+  ResizeBand bands[JPU_RESIZE_MAX_THREADS];
+  BYTE *srcData = NULL, *dstData = NULL;
+  Uint32 srcCW, srcCH, dstCW, dstCH;
+  Uint32 numPlanes, numBands = 1, maxBands = 1, i;
+  long cpus;
+  JpgRet ret = JPG_RET_SUCCESS;
+
+  if (handle == NULL || src == NULL || dst == NULL || !srcWidth ||
+      !srcHeight || !dstWidth || !dstHeight || src->format != dst->format ||
+      !ResizeChromaSize(src->format, srcWidth, srcHeight, &srcCW, &srcCH) ||
+      !ResizeChromaSize(dst->format, dstWidth, dstHeight, &dstCW, &dstCH) ||
+      (srcCW && (!src->uOffset || !dst->uOffset)) ||
+      !ResizeFrameFits(src, srcWidth, srcHeight, srcCW, srcCH) ||
+      !ResizeFrameFits(dst, dstWidth, dstHeight, dstCW, dstCH)) {
+    JLOG(ERR, "%s invalid param !!!\n", __func__);
+    return JPG_RET_INVALID_PARAM;
+  }
+
+  memset(filters, 0x00, sizeof(filters));
+  memset(planes, 0x00, sizeof(planes));
+  if (!ResizeFilterInit(&filters[0], srcWidth, dstWidth) ||
+      !ResizeFilterInit(&filters[1], srcHeight, dstHeight) ||
+      (srcCW && (!ResizeFilterInit(&filters[2], srcCW, dstCW) ||
+                 !ResizeFilterInit(&filters[3], srcCH, dstCH)))) {
+    ret = JPG_RET_INSUFFICIENT_RESOURCE;
+    goto DONE;
+  }
+
+  srcData = (BYTE *)jdi_dmabuf_map(pJpgInst->devctx, src->dmaBuffer.fd,
+                                   src->dmaBuffer.size);
+  dstData = (BYTE *)jdi_dmabuf_map(pJpgInst->devctx, dst->dmaBuffer.fd,
+                                   dst->dmaBuffer.size);
+  if (!srcData || !dstData) {
+    ret = JPG_RET_INVALID_PARAM;
+    goto DONE;
+  }
+
+  planes[0].src = srcData + src->yOffset;
+  planes[0].srcStride = src->stride;
+  planes[0].srcStep = 1;
+  planes[0].srcWidth = srcWidth;
+  planes[0].srcHeight = srcHeight;
+  planes[0].dst = dstData + dst->yOffset;
+  planes[0].dstStride = dst->stride;
+  planes[0].dstStep = 1;
+  planes[0].dstWidth = dstWidth;
+  planes[0].dstHeight = dstHeight;
+  planes[0].hor = &filters[0];
+  planes[0].ver = &filters[1];
+  numPlanes = 1;
+  if (srcCW) {
+    ResizeChromaPlanes(&planes[1], src, srcData, dst, dstData);
+    for (i = 1; i < 3; i++) {
+      planes[i].srcWidth = srcCW;
+      planes[i].srcHeight = srcCH;
+      planes[i].dstWidth = dstCW;
+      planes[i].dstHeight = dstCH;
+      planes[i].hor = &filters[2];
+      planes[i].ver = &filters[3];
+    }
+    numPlanes = 3;
+  }
+
+  // One band per CPU, none under JPU_RESIZE_BAND_MIN_ROWS rows, and only for
+  // pictures where waking the threads is worth it.
+  if ((Uint64)srcWidth * srcHeight >= JPU_RESIZE_MT_MIN_PIXELS ||
+      (Uint64)dstWidth * dstHeight >= JPU_RESIZE_MT_MIN_PIXELS) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    maxBands = cpus > 0 ? (Uint32)cpus : 1;
+    if (maxBands > JPU_RESIZE_MAX_THREADS) maxBands = JPU_RESIZE_MAX_THREADS;
+    numBands = maxBands;
+    if (numBands > dstHeight / JPU_RESIZE_BAND_MIN_ROWS)
+      numBands = dstHeight / JPU_RESIZE_BAND_MIN_ROWS;
+    if (numBands == 0) numBands = 1;
+  }
+
+  jdi_dmabuf_sync(src->dmaBuffer.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+  jdi_dmabuf_sync(dst->dmaBuffer.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+  for (i = 0; i < numBands; i++) {
+    bands[i].planes = planes;
+    bands[i].numPlanes = numPlanes;
+    bands[i].band = i;
+    bands[i].numBands = numBands;
+    bands[i].ret = JPG_RET_SUCCESS;
+  }
+  ResizeRun(numBands > 1 ? ResizePoolGet(handle, maxBands - 1) : NULL, bands,
+            numBands);
+  jdi_dmabuf_sync(dst->dmaBuffer.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+  jdi_dmabuf_sync(src->dmaBuffer.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+
+  for (i = 0; i < numBands; i++) {
+    if (bands[i].ret != JPG_RET_SUCCESS) ret = bands[i].ret;
+  }
+
+DONE:
+  if (srcData)
+    jdi_dmabuf_unmap(pJpgInst->devctx, src->dmaBuffer.fd, srcData,
+                     src->dmaBuffer.size);
+  if (dstData)
+    jdi_dmabuf_unmap(pJpgInst->devctx, dst->dmaBuffer.fd, dstData,
+                     dst->dmaBuffer.size);
+  for (i = 0; i < 4; i++) ResizeFilterFree(&filters[i]);
+  return ret;
+}
@@ -23,6 +23,7 @@
 #include <linux/dma-heap.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -82,9 +83,31 @@ BufferAllocator::BufferAllocator() {}
 
 BufferAllocator::~BufferAllocator() { CloseDmabufHeap(); }
 
+/*
+ * Without dma-buf heaps (e.g. a development host running the JPU emulator,
+ * JPU_EMULATOR=1) hand out a memfd. It supports mmap and lseek
+ * like a dmabuf, which is all the emulator needs.
+ */
+static int EmulatorBufferAlloc(size_t len) {
+  const char* emu = getenv("JPU_EMULATOR");
+  if (!emu || !*emu || *emu == '0') return -ENODEV;
+
+  int fd = memfd_create("jpu-emu-buf", MFD_CLOEXEC);
+  if (fd < 0) return -errno;
+  if (ftruncate(fd, len) < 0) {
+    int err = -errno;
+    close(fd);
+    return err;
+  }
+  return fd;
+}
+
 int BufferAllocator::DmabufAlloc(const std::string& heap_name, size_t len) {
   int fd = OpenDmabufHeap(heap_name);
-  if (fd < 0) return fd;
+  if (fd < 0) {
+    int emu_fd = EmulatorBufferAlloc(len);
+    return emu_fd >= 0 ? emu_fd : fd;
+  }
 
   struct dma_heap_allocation_data heap_data {
     .len = len,  // length of data to be allocated in bytes
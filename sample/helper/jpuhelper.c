@@ -772,6 +772,8 @@ BOOL ParseDecTestLongArgs(void* config, const char* argName, char* value) {
     dec->profiling = atoi(value);
   } else if (strcmp(argName, "loop_count") == 0) {
     dec->loop_count = atoi(value);
+  } else if (strcmp(argName, "feed") == 0) {
+    dec->feedSize = atoi(value);
   } else {
     JLOG(ERR, "Not defined option: %s\n", argName);
     ret = FALSE;
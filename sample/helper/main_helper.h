@@ -86,6 +86,7 @@ typedef struct {
   FeedingMethod feedingMode;
   Uint32 profiling;
   Uint32 loop_count;
+  Uint32 feedSize; /* redecode fed from this many bytes on, 0 for none */
 } DecConfigParam;
 
 typedef struct {
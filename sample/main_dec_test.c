@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 
 #include "BufferAllocatorWrapper.h"
 #include "jpuapi.h"
@@ -98,13 +99,84 @@ static void Help(const char* programName) {
        "--profiling             0: performance output will not be printed "
        "1:print performance output \n");
   JLOG(INFO, "--loop_count            loop count\n");
+  JLOG(INFO,
+       "--feed=SIZE             decode again on the same handle from the "
+       "first SIZE bytes, feeding the rest, and compare\n");
   exit(1);
 }
 #endif /* SUPPORT_MULTI_INSTANCE_TEST */
 
+// Small chunks, so that the core runs out of data a few times.
+static Int32 FeedFromFile(void* userData, void* data, Uint32 size) {
+  if (size > 512) size = 512;
+  return (Int32)fread(data, 1, size, (FILE*)userData);
+}
+
+/* Decodes the image again on the handle that already decoded it, starting
+ * from its first feedSize bytes and feeding the rest from the file, and
+ * compares the picture with the first decode in pYuv.
+ */
+static BOOL TestFeedDecoder(void* handle, DecConfigParam* decConfig,
+                            BufferAllocator* bufferAllocator,
+                            ImageBufferInfo* jpegImageBuffer,
+                            Uint32 imagesize, FrameBufferInfo* frameBuffer,
+                            Uint8* pYuv, Uint32 outbufSize, Uint32 width,
+                            Uint32 height, Uint32 bitDepth) {
+  JpgDecInitialInfo initialInfo;
+  Uint8* pRef = NULL;
+  FILE* fp = NULL;
+  BYTE* data;
+  BOOL suc = FALSE;
+  JpgRet ret;
+
+  if (decConfig->feedSize >= imagesize) {
+    JLOG(ERR, "--feed=%u is not shorter than the %u byte image\n",
+         decConfig->feedSize, imagesize);
+    return FALSE;
+  }
+  if ((pRef = malloc(outbufSize)) == NULL ||
+      (fp = fopen(decConfig->bitstreamFileName, "rb")) == NULL ||
+      fseek(fp, decConfig->feedSize, SEEK_SET) != 0)
+    goto DONE;
+  memcpy(pRef, pYuv, outbufSize);
+
+  // Only the first chunk is in the buffer, the rest has to come from fill.
+  data = mmap(NULL, jpegImageBuffer->dmaBuffer.size, PROT_READ | PROT_WRITE,
+              MAP_SHARED, jpegImageBuffer->dmaBuffer.fd, 0);
+  if (data == MAP_FAILED) goto DONE;
+  memset(data + decConfig->feedSize, 0x00, imagesize - decConfig->feedSize);
+  munmap(data, jpegImageBuffer->dmaBuffer.size);
+
+  jpegImageBuffer->imageSize = decConfig->feedSize;
+  ret = AsrJpuDecGetInitialInfo(handle, jpegImageBuffer, &initialInfo);
+  if (ret != JPG_RET_SUCCESS) {
+    JLOG(ERR, "feed: AsrJpuDecGetInitialInfo failed 0x%x\n", ret);
+    goto DONE;
+  }
+  ret = AsrJpuDecStartOneFrameFeed(handle, frameBuffer, jpegImageBuffer,
+                                   FeedFromFile, fp);
+  if (ret != JPG_RET_SUCCESS || jpegImageBuffer->imageSize != imagesize) {
+    JLOG(ERR, "feed: ret 0x%x, %u of %u bytes\n", ret,
+         jpegImageBuffer->imageSize, imagesize);
+    goto DONE;
+  }
+  if (!SaveYuvImageHelperFormat_V20(
+          bufferAllocator, NULL, pYuv, frameBuffer, decConfig->cbcrInterleave,
+          decConfig->packedFormat, width, height, bitDepth))
+    goto DONE;
+  suc = memcmp(pRef, pYuv, outbufSize) == 0;
+  JLOG(suc ? INFO : ERR, "feed decode from %u bytes %s\n", decConfig->feedSize,
+       suc ? "matches" : "differs");
+
+DONE:
+  if (fp) fclose(fp);
+  free(pRef);
+  return suc;
+}
+
 BOOL TestDecoder(DecConfigParam* param) {
   // JpgDecHandle        handle        = {0};
-  DecOpenParam openParam;
+  DecOpenParam openParam = {0};
   void* handle = NULL;
   ImageBufferInfo jpegImageBuffer;
   FrameBufferInfo* frameBuffer;
@@ -142,12 +214,17 @@ BOOL TestDecoder(DecConfigParam* param) {
   loop_count = decConfig.loop_count;
   if (loop_count) {
     bufferAllocator = CreateDmabufHeapBufferAllocator();
-    ret = AsrJpuDecOpen(&handle, &openParam);
+    ret = AsrJpuDecAcquire(&handle, &openParam);
     if (ret != JPG_RET_SUCCESS && ret != JPG_RET_CALLED_BEFORE) {
       suc = 0;
-      JLOG(ERR, "AsrJpuDecOpen failed Error code is 0x%x \n", ret);
+      JLOG(ERR, "AsrJpuDecAcquire failed Error code is 0x%x \n", ret);
       goto ERR_DEC;
     }
+    if (decConfig.roiEnable) {
+      JpgDecRoi roi = {decConfig.roiOffsetX, decConfig.roiOffsetY,
+                       decConfig.roiWidth, decConfig.roiHeight};
+      AsrJpuDecSetParam(handle, JPU_ROI, &roi);
+    }
 
     if ((feeder = BitstreamFeeder_Create(
              decConfig.bitstreamFileName, decConfig.feedingMode,
@@ -249,17 +326,30 @@ BOOL TestDecoder(DecConfigParam* param) {
             decConfig.packedFormat, decodingWidth, decodingHeight, bitDepth)) {
       goto ERR_DEC;
     }
+    if (decConfig.feedSize &&
+        !TestFeedDecoder(handle, &decConfig, bufferAllocator, &jpegImageBuffer,
+                         imagesize, frameBuffer, pYuv, outbufSize,
+                         decodingWidth, decodingHeight, bitDepth)) {
+      goto ERR_DEC;
+    }
 
   ERR_DEC:
     // Now that we are done with decoding, close the open instance.
     FreeDmabufHeapBufferAllocator(bufferAllocator);
-    ret = AsrJpuDecClose(handle);
-    if (ret != JPG_RET_SUCCESS) suc = 0;
+    ret = AsrJpuDecRelease(handle);
+    if (ret != JPG_RET_SUCCESS) {
+      suc = 0;
+    } else if (AsrJpuDecRelease(handle) != JPG_RET_WRONG_CALL_SEQUENCE) {
+      // The session is idle in the pool now, a second release is refused.
+      JLOG(ERR, "double release of a pooled session not refused\n");
+      suc = 0;
+    }
     BitstreamFeeder_Destroy(feeder);
     FreeFrameBuffer(frameBuffer);
     if (jpegImageBuffer.dmaBuffer.fd >= 0) close(jpegImageBuffer.dmaBuffer.fd);
     loop_count--;
   }
+  AsrJpuDecPoolFlush();
   if (profiling)
     JLOG(INFO, "-----frameIdx:%d ,performance:%.2f fps. ------\n", frameIdx,
          frameIdx * 1000 / total_time);
@@ -283,6 +373,7 @@ Int32 main(Int32 argc, char** argv) {
       {"scaleV", required_argument, NULL, 0},
       {"profiling", required_argument, NULL, 0},
       {"loop_count", required_argument, NULL, 0},
+      {"feed", required_argument, NULL, 0},
       {NULL, no_argument, NULL, 0},
   };
   Int32 c, l;
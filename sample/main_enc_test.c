@@ -169,7 +169,7 @@ BOOL TestEncoder(EncConfigParam* param) {
   }
   while (loop_count) {
     bufferAllocator = CreateDmabufHeapBufferAllocator();
-    ret = AsrJpuEncOpen(&handle, &encOP);
+    ret = AsrJpuEncAcquire(&handle, &encOP);
     if (ret != JPG_RET_SUCCESS && ret != JPG_RET_CALLED_BEFORE) {
       JLOG(ERR, "JPU_Init failed Error code is 0x%x \n", ret);
       goto ERR_ENC;
@@ -304,9 +304,10 @@ BOOL TestEncoder(EncConfigParam* param) {
     if (writer != NULL) {
       BitstreamWriter_Destroy(writer);
     }
-    if (handle != NULL) AsrJpuEncClose(handle);
+    if (handle != NULL) AsrJpuEncRelease(handle);
     loop_count--;
   }
+  AsrJpuEncPoolFlush();
   if (profiling)
     JLOG(INFO, "-----frameIdx:%d ,performance:%.2f fps. ------\n", frameIdx,
          frameIdx * 1000 / total_time);
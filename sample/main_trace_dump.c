@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2019 ASR Micro Limited
+ * All Rights Reserved.
+ */
+
+/* Decodes a trace file written by JPU_TraceDump, or by the library on an
+ * interrupt timeout when JPU_TRACE_FILE is set. The rings of all threads are
+ * merged in time order.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jdi_trace.h"
+#include "jpu.h"
+#include "regdefine.h"
+
+typedef struct {
+  uint32_t addr;
+  const char *name;
+} RegName;
+
+#define REG_NAME(reg) \
+  { reg, #reg }
+
+static const RegName s_regNames[] = {
+    REG_NAME(MJPEG_PIC_START_REG),    REG_NAME(MJPEG_PIC_STATUS_REG),
+    REG_NAME(MJPEG_PIC_ERRMB_REG),    REG_NAME(MJPEG_PIC_SETMB_REG),
+    REG_NAME(MJPEG_PIC_CTRL_REG),     REG_NAME(MJPEG_PIC_SIZE_REG),
+    REG_NAME(MJPEG_MCU_INFO_REG),     REG_NAME(MJPEG_ROT_INFO_REG),
+    REG_NAME(MJPEG_SCL_INFO_REG),     REG_NAME(MJPEG_IF_INFO_REG),
+    REG_NAME(MJPEG_CLP_INFO_REG),     REG_NAME(MJPEG_OP_INFO_REG),
+    REG_NAME(MJPEG_DPB_CONFIG_REG),   REG_NAME(MJPEG_DPB_BASE00_REG),
+    REG_NAME(MJPEG_DPB_BASE01_REG),   REG_NAME(MJPEG_DPB_BASE02_REG),
+    REG_NAME(MJPEG_DPB_BASE10_REG),   REG_NAME(MJPEG_DPB_BASE11_REG),
+    REG_NAME(MJPEG_DPB_BASE12_REG),   REG_NAME(MJPEG_DPB_BASE20_REG),
+    REG_NAME(MJPEG_DPB_BASE21_REG),   REG_NAME(MJPEG_DPB_BASE22_REG),
+    REG_NAME(MJPEG_DPB_BASE30_REG),   REG_NAME(MJPEG_DPB_BASE31_REG),
+    REG_NAME(MJPEG_DPB_BASE32_REG),   REG_NAME(MJPEG_DPB_YSTRIDE_REG),
+    REG_NAME(MJPEG_DPB_CSTRIDE_REG),  REG_NAME(MJPEG_WRESP_CHECK_REG),
+    REG_NAME(MJPEG_CLP_BASE_REG),     REG_NAME(MJPEG_CLP_SIZE_REG),
+    REG_NAME(MJPEG_HUFF_CTRL_REG),    REG_NAME(MJPEG_HUFF_ADDR_REG),
+    REG_NAME(MJPEG_HUFF_DATA_REG),    REG_NAME(MJPEG_QMAT_CTRL_REG),
+    REG_NAME(MJPEG_QMAT_ADDR_REG),    REG_NAME(MJPEG_QMAT_DATA_REG),
+    REG_NAME(MJPEG_COEF_CTRL_REG),    REG_NAME(MJPEG_COEF_ADDR_REG),
+    REG_NAME(MJPEG_COEF_DATA_REG),    REG_NAME(MJPEG_RST_INTVAL_REG),
+    REG_NAME(MJPEG_RST_INDEX_REG),    REG_NAME(MJPEG_RST_COUNT_REG),
+    REG_NAME(MJPEG_INTR_MASK_REG),    REG_NAME(MJPEG_CYCLE_INFO_REG),
+    REG_NAME(MJPEG_DPCM_DIFF_Y_REG),  REG_NAME(MJPEG_DPCM_DIFF_CB_REG),
+    REG_NAME(MJPEG_DPCM_DIFF_CR_REG), REG_NAME(MJPEG_VERSION_INFO_REG),
+    REG_NAME(MJPEG_GBU_CTRL_REG),     REG_NAME(MJPEG_GBU_PBIT_BUSY_REG),
+    REG_NAME(MJPEG_GBU_BPTR_REG),     REG_NAME(MJPEG_GBU_WPTR_REG),
+    REG_NAME(MJPEG_GBU_TCNT_REG),     REG_NAME(MJPEG_GBU_PBIT_08_REG),
+    REG_NAME(MJPEG_GBU_PBIT_16_REG),  REG_NAME(MJPEG_GBU_PBIT_24_REG),
+    REG_NAME(MJPEG_GBU_PBIT_32_REG),  REG_NAME(MJPEG_GBU_BBSR_REG),
+    REG_NAME(MJPEG_GBU_BBER_REG),     REG_NAME(MJPEG_GBU_BBIR_REG),
+    REG_NAME(MJPEG_GBU_BBHR_REG),     REG_NAME(MJPEG_GBU_BCNT_REG),
+    REG_NAME(MJPEG_GBU_FF_RPTR_REG),  REG_NAME(MJPEG_GBU_FF_WPTR_REG),
+    REG_NAME(MJPEG_BBC_END_ADDR_REG), REG_NAME(MJPEG_BBC_WR_PTR_REG),
+    REG_NAME(MJPEG_BBC_RD_PTR_REG),   REG_NAME(MJPEG_BBC_EXT_ADDR_REG),
+    REG_NAME(MJPEG_BBC_INT_ADDR_REG), REG_NAME(MJPEG_BBC_DATA_CNT_REG),
+    REG_NAME(MJPEG_BBC_COMMAND_REG),  REG_NAME(MJPEG_BBC_BUSY_REG),
+    REG_NAME(MJPEG_BBC_CTRL_REG),     REG_NAME(MJPEG_BBC_CUR_POS_REG),
+    REG_NAME(MJPEG_BBC_BAS_ADDR_REG), REG_NAME(MJPEG_BBC_STRM_CTRL_REG),
+    REG_NAME(MJPEG_BBC_FLUSH_CMD_REG), REG_NAME(MJPEG_SLICE_INFO_REG),
+    REG_NAME(MJPEG_SLICE_POS_REG),    REG_NAME(MJPEG_SLICE_DPB_POS_REG),
+    REG_NAME(JPU_MMU_BVA_LO),         REG_NAME(JPU_MMU_BVA_HI),
+    REG_NAME(JPU_MMU_IRQ_STATUS),     REG_NAME(JPU_MMU_IRQ_ENABLE),
+    REG_NAME(JPU_MMU_VERSION),        REG_NAME(JPU_MMU_TTBLR0),
+    REG_NAME(JPU_MMU_TTBHR0),         REG_NAME(JPU_MMU_TCR0),
+    REG_NAME(JPU_MMU_TBU0_STATUS),    REG_NAME(JPU_MMU_TTBLR1),
+    REG_NAME(JPU_MMU_TTBHR1),         REG_NAME(JPU_MMU_TCR1),
+    REG_NAME(JPU_MMU_TBU1_STATUS),
+};
+
+// Indexed by the ioctl number the trace records, taken from jpu.h.
+#define IOCTL_NAME(name) [_IOC_NR(JDI_IOCTL_##name)] = #name
+
+static const char *s_ioctlNames[] = {
+    IOCTL_NAME(ALLOCATE_PHYSICAL_MEMORY),
+    IOCTL_NAME(FREE_PHYSICALMEMORY),
+    IOCTL_NAME(WAIT_INTERRUPT),
+    IOCTL_NAME(SET_CLOCK_GATE),
+    IOCTL_NAME(RESET),
+    IOCTL_NAME(GET_INSTANCE_POOL),
+    IOCTL_NAME(GET_RESERVED_VIDEO_MEMORY_INFO),
+    IOCTL_NAME(GET_REGISTER_INFO),
+    IOCTL_NAME(OPEN_INSTANCE),
+    IOCTL_NAME(CLOSE_INSTANCE),
+    IOCTL_NAME(GET_INSTANCE_NUM),
+    IOCTL_NAME(CFG_MMU),
+};
+
+static const char *RegName_Get(uint32_t addr) {
+  size_t i;
+
+  for (i = 0; i < sizeof(s_regNames) / sizeof(s_regNames[0]); i++) {
+    if (s_regNames[i].addr == addr) return s_regNames[i].name;
+  }
+  return "";
+}
+
+static int CompareEntry(const void *a, const void *b) {
+  const jdi_trace_entry_t *ea = (const jdi_trace_entry_t *)a;
+  const jdi_trace_entry_t *eb = (const jdi_trace_entry_t *)b;
+
+  if (ea->ts_ns != eb->ts_ns) return ea->ts_ns < eb->ts_ns ? -1 : 1;
+  return 0;
+}
+
+static void PrintEntry(const jdi_trace_entry_t *e, uint64_t base) {
+  uint64_t us = (e->ts_ns - base) / 1000;
+  uint32_t ns = (uint32_t)((e->ts_ns - base) % 1000);
+
+  printf("%10" PRIu64 ".%03u %6u jpu%u ", us, ns, e->tid, e->dev_id);
+  switch (e->event) {
+    case JDI_TRACE_REG_WRITE:
+      printf("W   0x%03x = 0x%08x %s\n", e->a, e->b, RegName_Get(e->a));
+      break;
+    case JDI_TRACE_REG_READ:
+      printf("R   0x%03x : 0x%08x %s\n", e->a, e->b, RegName_Get(e->a));
+      break;
+    case JDI_TRACE_IOCTL:
+      if (e->a < sizeof(s_ioctlNames) / sizeof(s_ioctlNames[0]) &&
+          s_ioctlNames[e->a])
+        printf("IOCTL %s", s_ioctlNames[e->a]);
+      else
+        printf("IOCTL %u", e->a);
+      printf(" ret=%d\n", (int32_t)e->b);
+      break;
+    case JDI_TRACE_LOCK:
+      printf("LOCK inst=%d waited=%uus\n", (int32_t)e->a, e->b);
+      break;
+    case JDI_TRACE_UNLOCK:
+      printf("UNLOCK inst=%d\n", (int32_t)e->a);
+      break;
+    case JDI_TRACE_IRQ:
+      if ((int32_t)e->a < 0)
+        printf("IRQ inst=%u timeout\n", e->b);
+      else
+        printf("IRQ inst=%u reason=0x%x\n", e->b, e->a);
+      break;
+    default:
+      printf("event %u a=0x%x b=0x%x\n", e->event, e->a, e->b);
+      break;
+  }
+}
+
+static void Help(const char *programName) {
+  fprintf(stderr, "Usage: %s trace_file\n", programName);
+  fprintf(stderr,
+          "Prints the JPU trace written by JPU_TraceDump or JPU_TRACE_FILE\n");
+}
+
+int main(int argc, char **argv) {
+  jdi_trace_file_hdr_t hdr;
+  jdi_trace_ring_hdr_t ringHdr;
+  jdi_trace_entry_t *entries = NULL;
+  size_t total = 0, capacity = 0, i;
+  uint64_t dropped = 0;
+  uint32_t r;
+  FILE *fp;
+
+  if (argc != 2) {
+    Help(argv[0]);
+    return 1;
+  }
+
+  fp = fopen(argv[1], "rb");
+  if (!fp) {
+    fprintf(stderr, "can't open %s\n", argv[1]);
+    return 1;
+  }
+
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+      memcmp(hdr.magic, JDI_TRACE_FILE_MAGIC, sizeof(hdr.magic)) != 0 ||
+      hdr.version != JDI_TRACE_FILE_VERSION ||
+      hdr.entry_size != sizeof(jdi_trace_entry_t)) {
+    fprintf(stderr, "%s isn't a JPU trace file\n", argv[1]);
+    fclose(fp);
+    return 1;
+  }
+
+  for (r = 0; r < hdr.ring_count; r++) {
+    if (fread(&ringHdr, sizeof(ringHdr), 1, fp) != 1) break;
+    if (total + ringHdr.count > capacity) {
+      capacity = total + ringHdr.count;
+      entries = realloc(entries, capacity * sizeof(jdi_trace_entry_t));
+      if (!entries) {
+        fprintf(stderr, "out of memory\n");
+        fclose(fp);
+        return 1;
+      }
+    }
+    if (fread(entries + total, sizeof(jdi_trace_entry_t), ringHdr.count, fp) !=
+        ringHdr.count) {
+      fprintf(stderr, "%s is truncated\n", argv[1]);
+      break;
+    }
+    total += ringHdr.count;
+    dropped += ringHdr.dropped;
+  }
+  fclose(fp);
+
+  qsort(entries, total, sizeof(jdi_trace_entry_t), CompareEntry);
+
+  printf("pid %u, %u thread ring(s), %zu event(s), %" PRIu64
+         " older event(s) overwritten\n",
+         hdr.pid, hdr.ring_count, total, dropped);
+  printf("%14s %6s %4s event\n", "time(us)", "tid", "dev");
+  for (i = 0; i < total; i++) {
+    PrintEntry(&entries[i], entries[0].ts_ns);
+  }
+
+  free(entries);
+  return 0;
+}